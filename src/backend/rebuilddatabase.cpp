@@ -25,13 +25,16 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QStringBuilder>
+#include <QCryptographicHash>
 
 #if defined(Q_OS_WINDOWS)
 #  include <windows.h>
 #endif
 
 #include "utility/utility.h"
+#include "utility/exception.h"
 #include "bricklink/core.h"
+#include "bricklink/databasedelta.h"
 #include "bricklink/textimport.h"
 #include "rebuilddatabase.h"
 
@@ -185,10 +188,24 @@ int RebuildDatabase::exec()
     for (int v = dbVersionHighest; v >= dbVersionLowest; --v) {
         printf("  > version %d... ", v);
         auto dbVersion = static_cast<BrickLink::Core::DatabaseVersion>(v);
-        if (bl->writeDatabase(bl->dataPath() + bl->defaultDatabaseName(dbVersion), dbVersion))
+        QString dbName = bl->defaultDatabaseName(dbVersion);
+        QString fileName = bl->dataPath() + dbName;
+
+        // keep the previous build around, so that we can create a delta against it
+        QByteArray oldData;
+        QFile oldFile(fileName);
+        if (oldFile.open(QIODevice::ReadOnly))
+            oldData = oldFile.readAll();
+        oldFile.close();
+
+        if (bl->writeDatabase(fileName, dbVersion)) {
             printf("done\n");
-        else
+
+            if (!oldData.isEmpty())
+                writeDatabaseDelta(oldData, fileName, dbName);
+        } else {
             printf("failed\n");
+        }
     }
 
     printf("\nFINISHED.\n\n");
@@ -198,6 +215,39 @@ int RebuildDatabase::exec()
     return 0;
 }
 
+void RebuildDatabase::writeDatabaseDelta(const QByteArray &oldData, const QString &fileName,
+                                         const QString &dbName)
+{
+    printf("    > delta... ");
+
+    try {
+        QFile newFile(fileName);
+        if (!newFile.open(QIODevice::ReadOnly))
+            throw Exception(&newFile, "could not read the new database");
+        QByteArray newData = newFile.readAll();
+
+        if (newData == oldData) {
+            printf("not needed\n");
+            return;
+        }
+
+        QByteArray oldHash = QCryptographicHash::hash(oldData, QCryptographicHash::Sha512);
+        QSaveFile f(BrickLink::core()->dataPath()
+                    + BrickLink::DatabaseDelta::fileName(dbName, oldHash));
+        if (!f.open(QIODevice::WriteOnly))
+            throw Exception(&f, "could not open the delta for writing");
+
+        BrickLink::DatabaseDelta::create(oldData, newData, &f);
+
+        if (!f.commit())
+            throw Exception(&f, "could not write the delta");
+
+        printf("done (%lld bytes uncompressed)\n", f.size());
+    } catch (const Exception &e) {
+        printf("failed: %s\n", qPrintable(e.error()));
+    }
+}
+
 static QList<QPair<QString, QString> > itemQuery(char item_type)
 {
     QList<QPair<QString, QString> > query;   //?a=a&viewType=0&itemType=X
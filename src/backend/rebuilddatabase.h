@@ -37,6 +37,8 @@ private:
 
     bool download();
     bool downloadInventories(const std::vector<BrickLink::Item> &invs, const std::vector<bool> &processedInvs);
+    void writeDatabaseDelta(const QByteArray &oldData, const QString &fileName,
+                            const QString &dbName);
 
 private:
     Transfer *m_trans;
@@ -10,29 +10,44 @@ HEADERS += \
   $$PWD/changelogentry.h \
   $$PWD/color.h \
   $$PWD/core.h \
+  $$PWD/databasedelta.h \
+  $$PWD/database_p.h \
   $$PWD/global.h \
+  $$PWD/inventoryindex.h \
   $$PWD/item.h \
+  $$PWD/itemsearchindex.h \
   $$PWD/itemtype.h \
   $$PWD/lot.h \
   $$PWD/partcolorcode.h \
   $$PWD/picture.h \
+  $$PWD/picturecache.h \
   $$PWD/priceguide.h \
+  $$PWD/priceguidestore.h \
   $$PWD/textimport.h \
+  $$PWD/thumbnailpack.h \
   $$PWD/updatedatabase.h \
+  $$PWD/validatorstore.h \
 
 SOURCES += \
   $$PWD/category.cpp \
   $$PWD/changelogentry.cpp \
   $$PWD/color.cpp \
   $$PWD/core.cpp \
+  $$PWD/databasedelta.cpp \
+  $$PWD/inventoryindex.cpp \
   $$PWD/item.cpp \
+  $$PWD/itemsearchindex.cpp \
   $$PWD/itemtype.cpp \
   $$PWD/lot.cpp \
   $$PWD/partcolorcode.cpp \
   $$PWD/picture.cpp \
+  $$PWD/picturecache.cpp \
   $$PWD/priceguide.cpp \
+  $$PWD/priceguidestore.cpp \
   $$PWD/textimport.cpp \
+  $$PWD/thumbnailpack.cpp \
   $$PWD/updatedatabase.cpp \
+  $$PWD/validatorstore.cpp \
 
 bs_mobile|bs_desktop {
 
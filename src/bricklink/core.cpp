@@ -13,14 +13,17 @@
 */
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 
 #include <QFile>
+#include <QScopedPointer>
 #include <QBuffer>
 #include <QSaveFile>
 #include <QFileInfo>
 #include <QDir>
 #include <QTextStream>
 #include <QPixmap>
+#include <QGuiApplication>
 #include <QPainter>
 #include <QPainterPath>
 #include <QDebug>
@@ -33,6 +36,11 @@
 #include <QRunnable>
 #include <QPixmapCache>
 #include <QRegularExpression>
+#include <QMutex>
+#include <QFuture>
+#include <QSet>
+#include <QtConcurrentRun>
+#include <QtConcurrentMap>
 
 
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
@@ -53,12 +61,18 @@
 #include "bricklink/changelogentry.h"
 #include "bricklink/color.h"
 #include "bricklink/core.h"
+#include "bricklink/database_p.h"
 #include "bricklink/item.h"
+#include "bricklink/itemsearchindex.h"
 #include "bricklink/itemtype.h"
 #include "bricklink/lot.h"
 #include "bricklink/partcolorcode.h"
 #include "bricklink/picture.h"
 #include "bricklink/priceguide.h"
+#include "bricklink/priceguidestore.h"
+#include "bricklink/picturecache.h"
+#include "bricklink/thumbnailpack.h"
+#include "bricklink/validatorstore.h"
 #if !defined(BS_BACKEND)
 #  include "bricklink/cart.h"
 #  include "bricklink/order.h"
@@ -526,24 +540,45 @@ Core::Core(const QString &datadir)
     m_diskloadPool.setMaxThreadCount(QThread::idealThreadCount() * 3);
     m_online = true;
 
-    // the max. pic cache size is at least 1GB and at max half the physical memory on 64bit systems
+    // the decoded pic images are limited to 256MB, or 1/8 of the physical memory on 64bit
+    // systems (but at most 1GB). The compressed images get another quarter of that on top.
     // the max. pg cache size is at least 5.000 and 10.000 if more than 3GB of RAM are available
-    quint64 picCacheMem = 1'000'000'000ULL;
+    qint64 picHotMem = 256'000'000LL;
     int pgCacheEntries = 5'000;
 
 #if Q_PROCESSOR_WORDSIZE >= 8
-    picCacheMem = qMax(picCacheMem, SystemInfo::inst()->physicalMemory() / 2);
+    picHotMem = qBound(picHotMem, qint64(SystemInfo::inst()->physicalMemory() / 8), 1'000'000'000LL);
     if (SystemInfo::inst()->physicalMemory() >= 3'000'000'000ULL)
         pgCacheEntries *= 2;
 #endif
 
-    m_pic_cache.setMaxCost(int(picCacheMem / 1024)); // each pic has the cost of memory used in KB
+    m_pic_cache.setMaxCost(50'000); // each pic has a cost of 1: the images are budgeted separately
     m_pg_cache.setMaxCost(pgCacheEntries); // each priceguide has a cost of 1
+
+    m_pgStore = new PriceGuideStore(m_datadir % u"priceguides.bin");
+    // the thumbnails are created for the highest resolution screen (there's no GUI when
+    // rebuilding the database in the backend)
+    auto gui = qobject_cast<QGuiApplication *>(QCoreApplication::instance());
+    m_thumbnailPack = new ThumbnailPack(m_datadir % u"thumbnails.pack",
+                                        gui ? gui->devicePixelRatio() : 1);
+    if (gui) {
+        auto updateDevicePixelRatio = [this, gui]() {
+            m_thumbnailPack->setDevicePixelRatio(gui->devicePixelRatio());
+        };
+        connect(gui, &QGuiApplication::screenAdded, this, updateDevicePixelRatio);
+        connect(gui, &QGuiApplication::screenRemoved, this, updateDevicePixelRatio);
+    }
+    m_pictureCache = new PictureCache(picHotMem, picHotMem / 4);
+    m_validatorStore = new ValidatorStore(m_datadir % u"validators.bin");
 }
 
 Core::~Core()
 {
     clear();
+    delete m_pgStore;
+    delete m_validatorStore;
+    delete m_pictureCache;
+    delete m_thumbnailPack; // after clear(): the cached pictures might reference its mapping
     s_inst = nullptr;
 }
 
@@ -831,6 +866,9 @@ const Color *Core::colorFromName(const QString &name) const
     if (name.isEmpty())
         return nullptr;
 
+    if (!m_colorNameLookup.isEmpty())
+        return m_colorNameLookup.value(name.toCaseFolded());
+
     auto it = std::find_if(m_colors.cbegin(), m_colors.cend(), [name](const auto &color) {
         return !color.name().compare(name, Qt::CaseInsensitive);
     });
@@ -842,6 +880,9 @@ const Color *Core::colorFromName(const QString &name) const
 
 const Color *Core::colorFromLDrawId(int ldrawId) const
 {
+    if (!m_colorLDrawLookup.isEmpty())
+        return m_colorLDrawLookup.value(ldrawId);
+
     auto it = std::find_if(m_colors.cbegin(), m_colors.cend(), [ldrawId](const auto &color) {
         return (color.ldrawId() == ldrawId);
     });
@@ -859,8 +900,46 @@ const ItemType *Core::itemType(char id) const
     return nullptr;
 }
 
+quint64 Core::persistentKey(const Item *item, const Color *color)
+{
+    // FNV-1a 64
+    quint64 h = 14695981039346656037ULL;
+    auto add = [&h](uchar c) { h = (h ^ c) * 1099511628211ULL; };
+
+    add(uchar(item->itemTypeId()));
+    const QByteArray id = item->id();
+    for (char c : id)
+        add(uchar(c));
+    add(0);
+    for (uint colorId = color ? color->id() : uint(-1), i = 0; i < 4; ++i, colorId >>= 8)
+        add(uchar(colorId));
+    return h;
+}
+
+static quint32 itemLookupHash(char tid, const QByteArray &id)
+{
+    // FNV-1a: cheap and good enough for short ids
+    quint32 h = 2166136261u;
+    h = (h ^ uchar(tid)) * 16777619u;
+    for (char c : id)
+        h = (h ^ uchar(c)) * 16777619u;
+    return h;
+}
+
 const Item *Core::item(char tid, const QByteArray &id) const
 {
+    if (!m_itemLookup.empty()) {
+        const auto mask = quint32(m_itemLookup.size() - 1);
+
+        for (quint32 slot = itemLookupHash(tid, id) & mask; m_itemLookup[slot]; slot = (slot + 1) & mask) {
+            const Item &item = m_items[m_itemLookup[slot] - 1];
+            if ((item.m_itemTypeId == tid) && (item.m_id == id))
+                return &item;
+        }
+        return nullptr;
+    }
+
+    // no lookup index while the database is being rebuilt
     auto needle = std::make_pair(tid, id);
     auto it = std::lower_bound(m_items.cbegin(), m_items.cend(), needle, Item::lessThan);
     if ((it != m_items.cend()) && (it->m_itemTypeId == tid) && (it->m_id == id))
@@ -871,14 +950,40 @@ const Item *Core::item(char tid, const QByteArray &id) const
 const Item *Core::item(const std::string &tids, const QByteArray &id) const
 {
     for (const char &tid : tids) {
-        auto needle = std::make_pair(tid, id);
-        auto it = std::lower_bound(m_items.cbegin(), m_items.cend(), needle, Item::lessThan);
-        if ((it != m_items.cend()) && (it->m_itemTypeId == tid) && (it->m_id == id))
-            return &(*it);
+        if (auto i = item(tid, id))
+            return i;
     }
     return nullptr;
 }
 
+void Core::buildLookupIndexes()
+{
+    // open addressing with linear probing, kept at a load factor of less than 50%
+    quint32 capacity = 16;
+    while (capacity < (m_items.size() * 2))
+        capacity <<= 1;
+    const quint32 mask = capacity - 1;
+
+    m_itemLookup.assign(capacity, 0);
+    for (quint32 i = 0; i < quint32(m_items.size()); ++i) {
+        quint32 slot = itemLookupHash(m_items[i].m_itemTypeId, m_items[i].m_id) & mask;
+        while (m_itemLookup[slot])
+            slot = (slot + 1) & mask;
+        m_itemLookup[slot] = i + 1;
+    }
+
+    // the linear search returned the first match, so we do not overwrite existing entries
+    m_colorNameLookup.clear();
+    m_colorLDrawLookup.clear();
+    for (const Color &color : m_colors) {
+        const QString name = color.name().toCaseFolded();
+        if (!name.isEmpty() && !m_colorNameLookup.contains(name))
+            m_colorNameLookup.insert(name, &color);
+        if (!m_colorLDrawLookup.contains(color.ldrawId()))
+            m_colorLDrawLookup.insert(color.ldrawId(), &color);
+    }
+}
+
 const PartColorCode *Core::partColorCode(uint id)
 {
     auto it = std::lower_bound(m_pccs.cbegin(), m_pccs.cend(), id, &PartColorCode::lessThan);
@@ -918,14 +1023,25 @@ void Core::clear()
 
     m_pg_cache.clear();
     m_pic_cache.clear();
+    m_pictureCache->clear();
+
+    delete m_itemSearchIndex; // waits for the builder thread, which is accessing m_items
+    m_itemSearchIndex = nullptr;
 
     m_colors.clear();
     m_item_types.clear();
     m_categories.clear();
     m_items.clear();
-    m_pccs.clear();
+    m_pccs = { };
+    m_inventoryIndex = { };
+    m_itemLookup.clear();
+    m_colorNameLookup.clear();
+    m_colorLDrawLookup.clear();
     m_itemChangelog.clear();
     m_colorChangelog.clear();
+
+    delete m_databaseFile;
+    m_databaseFile = nullptr;
 }
 
 
@@ -942,178 +1058,230 @@ bool Core::readDatabase(const QString &filename)
 
         QDateTime generationDate;
 
-        QFile f(!filename.isEmpty() ? filename : dataPath() + defaultDatabaseName());
+        if (!Database::isMappingSupported())
+            throw Exception("the database format is not supported on big endian systems");
 
-        if (!f.open(QFile::ReadOnly))
-            throw Exception(&f, "could not open database for reading");
+        std::unique_ptr<QFile> f(new QFile(!filename.isEmpty() ? filename : dataPath() + defaultDatabaseName()));
 
-        const char *data = reinterpret_cast<char *>(f.map(0, f.size()));
+        if (!f->open(QFile::ReadOnly))
+            throw Exception(f.get(), "could not open database for reading");
+
+        // the mapping has to stay valid for as long as the database is loaded: all the strings
+        // and arrays of the colors, categories, items and pccs are pointing into it
+        const char *data = reinterpret_cast<char *>(f->map(0, f->size()));
 
         if (!data)
-            throw Exception("could not memory map the database (%1)").arg(f.fileName());
+            throw Exception("could not memory map the database (%1)").arg(f->fileName());
 
-        QByteArray ba = QByteArray::fromRawData(data, int(f.size()));
+        QByteArray ba = QByteArray::fromRawData(data, int(f->size()));
         QBuffer buf(&ba);
         buf.open(QIODevice::ReadOnly);
         ChunkReader cr(&buf, QDataStream::LittleEndian);
-        QDataStream &ds = cr.dataStream();
 
         if (!cr.startChunk() || cr.chunkId() != ChunkId('B','S','D','B'))
-            throw Exception("invalid database format - wrong magic (%1)").arg(f.fileName());
+            throw Exception("invalid database format - wrong magic (%1)").arg(f->fileName());
 
         if (cr.chunkVersion() != int(DatabaseVersion::Latest)) {
             throw Exception("invalid database version: expected %1, but got %2")
                 .arg(int(DatabaseVersion::Latest)).arg(cr.chunkVersion());
         }
 
+        // All the data chunks are independent of each other: we get their positions from the
+        // directory and decode them in parallel.
+        const auto chunks = cr.directory();
+
+        QSet<quint32> chunkIds;
+        for (const auto &chunk : chunks) {
+            if (chunkIds.contains(chunk.id)) {
+                throw Exception("found a duplicate chunk %1 in the database (%2)")
+                    .arg(QString::number(chunk.id, 16)).arg(f->fileName());
+            }
+            chunkIds.insert(chunk.id);
+        }
+
         bool gotColors = false, gotCategories = false, gotItemTypes = false, gotItems = false;
         bool gotItemChangeLog = false, gotColorChangeLog = false, gotPccs = false;
+        bool gotInventoryIndex = false;
 
-        auto check = [&ds, &f]() {
-            if (ds.status() != QDataStream::Ok)
-                throw Exception("failed to read from database (%1) at position %2")
-                    .arg(f.fileName()).arg(f.pos());
-        };
+        const QString fileName = f->fileName();
+        QMutex errorMutex;
+        QString error;
 
-        auto sizeCheck = [&f](int s, int max) {
-            if (s > max)
-                throw Exception("failed to read from database (%1) at position %2: size value %L3 is larger than expected maximum %L4")
-                    .arg(f.fileName()).arg(f.pos()).arg(s).arg(max);
+        auto setError = [&errorMutex, &error](const QString &message) {
+            QMutexLocker locker(&errorMutex);
+            if (error.isEmpty())
+                error = message;
         };
 
-        while (cr.startChunk()) {
-            switch (cr.chunkId() | quint64(cr.chunkVersion()) << 32) {
-            case ChunkId('D','A','T','E') | 1ULL << 32: {
-                ds >> generationDate;
-                break;
-            }
-            case ChunkId('C','O','L',' ') | 1ULL << 32: {
-                quint32 colc = 0;
-                ds >> colc;
-                check();
-                sizeCheck(colc, 1'000);
-
-                m_colors.resize(colc);
-                for (quint32 i = 0; i < colc; ++i) {
-                    readColorFromDatabase(m_colors[i], ds, DatabaseVersion::Latest);
-                    check();
+        auto decodeChunk = [&](const ChunkDirectoryEntry &chunk) {
+            try {
+                QByteArray chunkData = QByteArray::fromRawData(data + chunk.offset, int(chunk.size));
+                QBuffer chunkBuf(&chunkData);
+                chunkBuf.open(QIODevice::ReadOnly);
+                QDataStream ds(&chunkBuf);
+                ds.setVersion(QDataStream::Qt_5_11);
+                ds.setByteOrder(QDataStream::LittleEndian);
+
+                auto check = [&]() {
+                    if (ds.status() != QDataStream::Ok)
+                        throw Exception("failed to read from database (%1) at position %2")
+                            .arg(fileName).arg(chunk.offset + chunkBuf.pos());
+                };
+
+                auto sizeCheck = [&](int s, int max) {
+                    if (s > max)
+                        throw Exception("failed to read from database (%1) at position %2: size value %L3 is larger than expected maximum %L4")
+                            .arg(fileName).arg(chunk.offset + chunkBuf.pos()).arg(s).arg(max);
+                };
+
+                auto mappedChunk = [&](quint32 recordSize, int maxRecords) {
+                    Database::MappedChunk mc(data + chunk.offset, chunk.size, recordSize);
+                    sizeCheck(int(mc.recordCount()), maxRecords);
+                    return mc;
+                };
+
+                switch (chunk.id | quint64(chunk.version) << 32) {
+                case ChunkId('D','A','T','E') | 1ULL << 32: {
+                    ds >> generationDate;
+                    break;
                 }
-                gotColors = true;
-                break;
-            }
-            case ChunkId('C','A','T',' ') | 1ULL << 32: {
-                quint32 catc = 0;
-                ds >> catc;
-                check();
-                sizeCheck(catc, 10'000);
-
-                m_categories.resize(catc);
-                for (quint32 i = 0; i < catc; ++i) {
-                    readCategoryFromDatabase(m_categories[i], ds, DatabaseVersion::Latest);
-                    check();
+                case ChunkId('C','O','L',' ') | 2ULL << 32: {
+                    auto mc = mappedChunk(sizeof(Database::ColorRecord), 1'000);
+
+                    m_colors.resize(mc.recordCount());
+                    for (quint32 i = 0; i < mc.recordCount(); ++i)
+                        readColorFromDatabase(m_colors[i], mc, i);
+                    gotColors = true;
+                    break;
                 }
-                gotCategories = true;
-                break;
-            }
-            case ChunkId('T','Y','P','E') | 1ULL << 32: {
-                quint32 ittc = 0;
-                ds >> ittc;
-                check();
-                sizeCheck(ittc, 20);
-
-                m_item_types.resize(ittc);
-                for (quint32 i = 0; i < ittc; ++i) {
-                    readItemTypeFromDatabase(m_item_types[i], ds, DatabaseVersion::Latest);
-                    check();
+                case ChunkId('C','A','T',' ') | 2ULL << 32: {
+                    auto mc = mappedChunk(sizeof(Database::CategoryRecord), 10'000);
+
+                    m_categories.resize(mc.recordCount());
+                    for (quint32 i = 0; i < mc.recordCount(); ++i)
+                        readCategoryFromDatabase(m_categories[i], mc, i);
+                    gotCategories = true;
+                    break;
                 }
-                gotItemTypes = true;
-                break;
-            }
-            case ChunkId('I','T','E','M') | 1ULL << 32: {
-                quint32 itc = 0;
-                ds >> itc;
-                check();
-                sizeCheck(itc, 1'000'000);
-
-                m_items.resize(itc);
-                for (quint32 i = 0; i < itc; ++i) {
-                    readItemFromDatabase(m_items[i], ds, DatabaseVersion::Latest);
+                case ChunkId('T','Y','P','E') | 1ULL << 32: {
+                    quint32 ittc = 0;
+                    ds >> ittc;
                     check();
+                    sizeCheck(ittc, 20);
+
+                    m_item_types.resize(ittc);
+                    for (quint32 i = 0; i < ittc; ++i) {
+                        readItemTypeFromDatabase(m_item_types[i], ds, DatabaseVersion::Latest);
+                        check();
+                    }
+                    gotItemTypes = true;
+                    break;
                 }
-                m_items.shrink_to_fit();
-                gotItems = true;
-                break;
-            }
-            case ChunkId('I','C','H','G') | 1ULL << 32: {
-                quint32 clc = 0;
-                ds >> clc;
-                check();
-                sizeCheck(clc, 1'000'000);
-
-                m_itemChangelog.resize(clc);
-                for (quint32 i = 0; i < clc; ++i) {
-                    readItemChangeLogFromDatabase(m_itemChangelog[i], ds, DatabaseVersion::Latest);
+                case ChunkId('I','T','E','M') | 2ULL << 32: {
+                    auto mc = mappedChunk(sizeof(Database::ItemRecord), 1'000'000);
+
+                    // The item records have a fixed size, so we can split them up into blocks
+                    // and let the thread pool fill the pre-allocated slots in m_items.
+                    const quint32 itemCount = mc.recordCount();
+                    const quint32 blockSize = 8192;
+
+                    m_items.resize(itemCount);
+
+                    QVector<quint32> blocks;
+                    blocks.reserve(int(itemCount / blockSize + 1));
+                    for (quint32 first = 0; first < itemCount; first += blockSize)
+                        blocks << first;
+
+                    QtConcurrent::blockingMap(blocks, [&](quint32 first) {
+                        try {
+                            const quint32 last = std::min(first + blockSize, itemCount);
+                            for (quint32 i = first; i < last; ++i)
+                                readItemFromDatabase(m_items[i], mc, i);
+                        } catch (const Exception &e) {
+                            setError(e.error());
+                        }
+                    });
+                    gotItems = true;
+                    break;
+                }
+                case ChunkId('I','C','H','G') | 1ULL << 32: {
+                    quint32 clc = 0;
+                    ds >> clc;
                     check();
+                    sizeCheck(clc, 1'000'000);
+
+                    m_itemChangelog.resize(clc);
+                    for (quint32 i = 0; i < clc; ++i) {
+                        readItemChangeLogFromDatabase(m_itemChangelog[i], ds, DatabaseVersion::Latest);
+                        check();
+                    }
+                    gotItemChangeLog = true;
+                    break;
                 }
-                gotItemChangeLog = true;
-                break;
-            }
-            case ChunkId('C','C','H','G') | 1ULL << 32: {
-                quint32 clc = 0;
-                ds >> clc;
-                check();
-                sizeCheck(clc, 1'000);
-
-                m_colorChangelog.resize(clc);
-                for (quint32 i = 0; i < clc; ++i) {
-                    readColorChangeLogFromDatabase(m_colorChangelog[i], ds, DatabaseVersion::Latest);
+                case ChunkId('C','C','H','G') | 1ULL << 32: {
+                    quint32 clc = 0;
+                    ds >> clc;
                     check();
+                    sizeCheck(clc, 1'000);
+
+                    m_colorChangelog.resize(clc);
+                    for (quint32 i = 0; i < clc; ++i) {
+                        readColorChangeLogFromDatabase(m_colorChangelog[i], ds, DatabaseVersion::Latest);
+                        check();
+                    }
+                    gotColorChangeLog = true;
+                    break;
                 }
-                gotColorChangeLog = true;
-                break;
-            }
-            case ChunkId('P','C','C',' ') | 1ULL << 32: {
-                if (!gotItems || !gotColors)
-                    throw Exception("found a 'PCC ' chunk before the 'ITEM' and 'COL ' chunks");
+                case ChunkId('P','C','C',' ') | 2ULL << 32: {
+                    auto mc = mappedChunk(sizeof(PartColorCode), 1'000'000);
 
-                quint32 pccc = 0;
-                ds >> pccc;
-                check();
-                sizeCheck(pccc, 1'000'000);
+                    m_pccs = PooledArray<PartColorCode>::fromRawData(mc.records<PartColorCode>(),
+                                                                     mc.recordCount());
+                    gotPccs = true;
+                    break;
+                }
+                case ChunkId('I','N','V','X') | 1ULL << 32: {
+                    auto mc = mappedChunk(sizeof(InventoryIndex::Record), 1'000'000);
 
-                m_pccs.resize(pccc);
-                for (quint32 i = 0; i < pccc; ++i) {
-                    readPCCFromDatabase(m_pccs[i], ds, DatabaseVersion::Latest);
-                    check();
+                    m_inventoryIndex = InventoryIndex(mc);
+                    gotInventoryIndex = true;
+                    break;
+                }
+                default: {
+                    break;
+                }
                 }
-                gotPccs = true;
-                break;
-            }
-            default: {
-                cr.skipChunk();
                 check();
-                break;
+            } catch (const Exception &e) {
+                setError(e.error());
             }
-            }
-            if (!cr.endChunk()) {
-                throw Exception("missed the end of a chunk when reading from database (%1) at position %2")
-                    .arg(f.fileName()).arg(f.pos());
-            }
-        }
-        if (!cr.endChunk()) {
-            throw Exception("missed the end of the root chunk when reading from database (%1) at position %2")
-                .arg(f.fileName()).arg(f.pos());
-        }
+        };
+
+        QVector<QFuture<void>> decoders;
+        decoders.reserve(chunks.size());
+        for (const auto &chunk : chunks)
+            decoders << QtConcurrent::run(decodeChunk, chunk);
+        for (auto &decoder : decoders)
+            decoder.waitForFinished();
+
+        if (!error.isEmpty())
+            throw Exception(error);
 
         delete sw;
 
         if (!gotColors || !gotCategories || !gotItemTypes || !gotItems || !gotItemChangeLog
                 || !gotColorChangeLog || !gotPccs) {
             throw Exception("not all required data chunks were found in the database (%1)")
-                .arg(f.fileName());
+                .arg(f->fileName());
         }
 
-        qDebug().noquote() << "Loaded database from" << f.fileName()
+        // this is an optional chunk, but it can be regenerated cheaply
+        if (!gotInventoryIndex || (m_inventoryIndex.itemCount() != m_items.size()))
+            m_inventoryIndex = InventoryIndex(m_items);
+
+        buildLookupIndexes();
+
+        qDebug().noquote() << "Loaded database from" << f->fileName()
                  << "\n  Generated at:" << QLocale().toString(generationDate)
                  << "\n  Colors      :" << m_colors.size()
                  << "\n  Item Types  :" << m_item_types.size()
@@ -1123,6 +1291,8 @@ bool Core::readDatabase(const QString &filename)
                  << "\n  ChangeLog I :" << m_itemChangelog.size()
                  << "\n  ChangeLog C :" << m_colorChangelog.size();
 
+        m_databaseFile = f.release();
+        m_itemSearchIndex = new ItemSearchIndex(m_items);
         m_databaseDate = generationDate;
         emit databaseDateChanged(generationDate);
 
@@ -1135,6 +1305,11 @@ bool Core::readDatabase(const QString &filename)
     }
 }
 
+void Core::unloadDatabase()
+{
+    clear();
+}
+
 
 bool Core::writeDatabase(const QString &filename, DatabaseVersion version) const
 {
@@ -1163,17 +1338,40 @@ bool Core::writeDatabase(const QString &filename, DatabaseVersion version) const
         ds << QDateTime::currentDateTimeUtc();
         check(cw.endChunk());
 
-        check(cw.startChunk(ChunkId('C','O','L',' '), 1));
-        ds << quint32(m_colors.size());
-        for (const Color &col : m_colors)
-            writeColorToDatabase(col, ds, version);
-        check(cw.endChunk());
+        // version 6 and up use memory mappable chunks for all the big data structures
+        bool mapped = (version >= DatabaseVersion::Version_6);
 
-        check(cw.startChunk(ChunkId('C','A','T',' '), 1));
-        ds << quint32(m_categories.size());
-        for (const Category &cat : m_categories)
-            writeCategoryToDatabase(cat, ds, version);
-        check(cw.endChunk());
+        auto writeMappedChunk = [&](quint32 id, quint32 recordSize, const auto &container,
+                                    const auto &writeFunction) {
+            Database::MappedChunkBuilder mcb;
+            for (const auto &t : container)
+                writeFunction(t, mcb);
+            check(cw.startChunk(id, 2));
+            check(mcb.write(ds, recordSize));
+            check(cw.endChunk());
+        };
+
+        if (mapped) {
+            writeMappedChunk(ChunkId('C','O','L',' '), sizeof(Database::ColorRecord), m_colors,
+                             [](const Color &col, auto &mcb) { writeColorToDatabase(col, mcb); });
+        } else {
+            check(cw.startChunk(ChunkId('C','O','L',' '), 1));
+            ds << quint32(m_colors.size());
+            for (const Color &col : m_colors)
+                writeColorToDatabase(col, ds, version);
+            check(cw.endChunk());
+        }
+
+        if (mapped) {
+            writeMappedChunk(ChunkId('C','A','T',' '), sizeof(Database::CategoryRecord), m_categories,
+                             [](const Category &cat, auto &mcb) { writeCategoryToDatabase(cat, mcb); });
+        } else {
+            check(cw.startChunk(ChunkId('C','A','T',' '), 1));
+            ds << quint32(m_categories.size());
+            for (const Category &cat : m_categories)
+                writeCategoryToDatabase(cat, ds, version);
+            check(cw.endChunk());
+        }
 
         check(cw.startChunk(ChunkId('T','Y','P','E'), 1));
         ds << quint32(m_item_types.size());
@@ -1181,11 +1379,16 @@ bool Core::writeDatabase(const QString &filename, DatabaseVersion version) const
             writeItemTypeToDatabase(itt, ds, version);
         check(cw.endChunk());
 
-        check(cw.startChunk(ChunkId('I','T','E','M'), 1));
-        ds << quint32(m_items.size());
-        for (const Item &item : m_items)
-            writeItemToDatabase(item, ds, version);
-        check(cw.endChunk());
+        if (mapped) {
+            writeMappedChunk(ChunkId('I','T','E','M'), sizeof(Database::ItemRecord), m_items,
+                             [](const Item &item, auto &mcb) { writeItemToDatabase(item, mcb); });
+        } else {
+            check(cw.startChunk(ChunkId('I','T','E','M'), 1));
+            ds << quint32(m_items.size());
+            for (const Item &item : m_items)
+                writeItemToDatabase(item, ds, version);
+            check(cw.endChunk());
+        }
 
         if (version >= DatabaseVersion::Version_5) {
             check(cw.startChunk(ChunkId('I','C','H','G'), 1));
@@ -1213,7 +1416,12 @@ bool Core::writeDatabase(const QString &filename, DatabaseVersion version) const
             check(cw.endChunk());
         }
 
-        if (version >= DatabaseVersion::Version_3) {
+        if (mapped) {
+            writeMappedChunk(ChunkId('P','C','C',' '), sizeof(PartColorCode), m_pccs,
+                             [](const PartColorCode &pcc, Database::MappedChunkBuilder &mcb) {
+                mcb.addRecord<PartColorCode>() = pcc;
+            });
+        } else if (version >= DatabaseVersion::Version_3) {
             check(cw.startChunk(ChunkId('P','C','C',' '), 1));
             ds << quint32(m_pccs.size());
             for (const PartColorCode &pcc : m_pccs)
@@ -1221,6 +1429,17 @@ bool Core::writeDatabase(const QString &filename, DatabaseVersion version) const
             check(cw.endChunk());
         }
 
+        if (mapped) {
+            Database::MappedChunkBuilder mcb;
+            m_inventoryIndex.write(mcb);
+            check(cw.startChunk(ChunkId('I','N','V','X'), 1));
+            check(mcb.write(ds, sizeof(InventoryIndex::Record)));
+            check(cw.endChunk());
+        }
+
+        if (version >= DatabaseVersion::Version_6) // allows for parallel loading
+            check(cw.writeDirectory());
+
         check(cw.endChunk()); // BSDB root chunk
 
         if (!f.commit())
@@ -1235,13 +1454,34 @@ bool Core::writeDatabase(const QString &filename, DatabaseVersion version) const
 }
 
 
-void Core::readColorFromDatabase(Color &col, QDataStream &dataStream, DatabaseVersion)
+void Core::readColorFromDatabase(Color &col, const Database::MappedChunk &mc, quint32 index)
+{
+    const auto &r = mc.record<Database::ColorRecord>(index);
+
+    col.m_id = r.id;
+    col.m_name = mc.string(r.nameOffset, r.nameSize);
+    col.m_ldraw_id = r.ldrawId;
+    col.m_color = (r.flags & 0x01) ? QColor::fromRgba(r.rgba) : QColor();
+    col.m_type = static_cast<Color::Type>(r.type);
+    col.m_popularity = r.popularity;
+    col.m_year_from = r.yearFrom;
+    col.m_year_to = r.yearTo;
+}
+
+void Core::writeColorToDatabase(const Color &col, Database::MappedChunkBuilder &mcb)
 {
-    quint32 flags;
+    auto &r = mcb.addRecord<Database::ColorRecord>();
 
-    dataStream >> col.m_id >> col.m_name >> col.m_ldraw_id >> col.m_color >> flags
-            >> col.m_popularity >> col.m_year_from >> col.m_year_to;
-    col.m_type = static_cast<Color::Type>(flags);
+    r.id = col.m_id;
+    r.nameOffset = mcb.addString(col.m_name);
+    r.nameSize = quint32(col.m_name.size());
+    r.ldrawId = col.m_ldraw_id;
+    r.rgba = col.m_color.rgba();
+    r.flags = col.m_color.isValid() ? 0x01 : 0;
+    r.type = quint32(col.m_type);
+    r.popularity = col.m_popularity;
+    r.yearFrom = col.m_year_from;
+    r.yearTo = col.m_year_to;
 }
 
 void Core::writeColorToDatabase(const Color &col, QDataStream &dataStream, DatabaseVersion v)
@@ -1256,9 +1496,21 @@ void Core::writeColorToDatabase(const Color &col, QDataStream &dataStream, Datab
 }
 
 
-void Core::readCategoryFromDatabase(Category &cat, QDataStream &dataStream, DatabaseVersion)
+void Core::readCategoryFromDatabase(Category &cat, const Database::MappedChunk &mc, quint32 index)
 {
-    dataStream >> cat.m_id >> cat.m_name;
+    const auto &r = mc.record<Database::CategoryRecord>(index);
+
+    cat.m_id = r.id;
+    cat.m_name = mc.string(r.nameOffset, r.nameSize);
+}
+
+void Core::writeCategoryToDatabase(const Category &cat, Database::MappedChunkBuilder &mcb)
+{
+    auto &r = mcb.addRecord<Database::CategoryRecord>();
+
+    r.id = cat.m_id;
+    r.nameOffset = mcb.addString(cat.m_name);
+    r.nameSize = quint32(cat.m_name.size());
 }
 
 void Core::writeCategoryToDatabase(const Category &cat, QDataStream &dataStream, DatabaseVersion v)
@@ -1316,56 +1568,45 @@ void Core::writeItemTypeToDatabase(const ItemType &itt, QDataStream &dataStream,
 }
 
 
-void Core::readItemFromDatabase(Item &item, QDataStream &dataStream, DatabaseVersion)
+void Core::readItemFromDatabase(Item &item, const Database::MappedChunk &mc, quint32 index)
 {
-    dataStream >> item.m_id >> item.m_name >> item.m_itemTypeIndex >> item.m_categoryIndex
-            >> item.m_defaultColorIndex >> (qint8 &) item.m_itemTypeId >> item.m_year
-            >> item.m_lastInventoryUpdate >> item.m_weight;
-
-    quint32 appearsInSize = 0;
-    dataStream >> appearsInSize;
-    item.m_appears_in.clear();
-    item.m_appears_in.reserve(appearsInSize);
+    const auto &r = mc.record<Database::ItemRecord>(index);
 
-    union {
-        quint32 ui32;
-        Item::AppearsInRecord ai;
-    } appearsInUnion;
-
-    while (appearsInSize-- > 0) {
-        dataStream >> appearsInUnion.ui32;
-        item.m_appears_in.push_back(appearsInUnion.ai);
-    }
-    item.m_appears_in.shrink_to_fit();
-
-    quint32 consistsOfSize = 0;
-    dataStream >> consistsOfSize;
-    item.m_consists_of.clear();
-    item.m_consists_of.reserve(consistsOfSize);
-
-    union {
-        quint64 ui64;
-        Item::ConsistsOf co;
-    } consistsOfUnion;
-
-    while (consistsOfSize-- > 0) {
-        dataStream >> consistsOfUnion.ui64;
-        item.m_consists_of.push_back(consistsOfUnion.co);
-    }
-    item.m_consists_of.shrink_to_fit();
-
-    quint32 knownColorsSize;
-    dataStream >> knownColorsSize;
-    item.m_knownColorIndexes.clear();
-    item.m_knownColorIndexes.reserve(knownColorsSize);
+    item.m_name = mc.string(r.nameOffset, r.nameSize);
+    item.m_id = mc.byteArray(r.idOffset, r.idSize);
+    item.m_itemTypeIndex = r.itemTypeIndex;
+    item.m_categoryIndex = r.categoryIndex;
+    item.m_defaultColorIndex = r.defaultColorIndex;
+    item.m_itemTypeId = char(r.itemTypeId);
+    item.m_year = r.year;
+    item.m_lastInventoryUpdate = r.lastInventoryUpdate;
+    item.m_weight = r.weight;
+    item.m_knownColorIndexes = mc.array<quint16>(r.knownColorsOffset, r.knownColorsSize);
+    item.m_appears_in = mc.array<Item::AppearsInRecord>(r.appearsInOffset, r.appearsInSize);
+    item.m_consists_of = mc.array<Item::ConsistsOf>(r.consistsOfOffset, r.consistsOfSize);
+}
 
-    quint16 colorIndex;
+void Core::writeItemToDatabase(const Item &item, Database::MappedChunkBuilder &mcb)
+{
+    auto &r = mcb.addRecord<Database::ItemRecord>();
 
-    while (knownColorsSize-- > 0) {
-        dataStream >> colorIndex;
-        item.m_knownColorIndexes.push_back(colorIndex);
-    }
-    item.m_knownColorIndexes.shrink_to_fit();
+    r.nameOffset = mcb.addString(item.m_name);
+    r.nameSize = quint32(item.m_name.size());
+    r.idOffset = mcb.addByteArray(item.m_id);
+    r.idSize = quint32(item.m_id.size());
+    r.itemTypeIndex = item.m_itemTypeIndex;
+    r.categoryIndex = item.m_categoryIndex;
+    r.defaultColorIndex = item.m_defaultColorIndex;
+    r.itemTypeId = qint8(item.m_itemTypeId);
+    r.year = item.m_year;
+    r.lastInventoryUpdate = item.m_lastInventoryUpdate;
+    r.weight = item.m_weight;
+    r.knownColorsOffset = mcb.addArray(item.m_knownColorIndexes);
+    r.knownColorsSize = item.m_knownColorIndexes.size();
+    r.appearsInOffset = mcb.addArray(item.m_appears_in);
+    r.appearsInSize = item.m_appears_in.size();
+    r.consistsOfOffset = mcb.addArray(item.m_consists_of);
+    r.consistsOfSize = item.m_consists_of.size();
 }
 
 void Core::writeItemToDatabase(const Item &item, QDataStream &dataStream, DatabaseVersion v)
@@ -1448,14 +1689,6 @@ void Core::writeItemToDatabase(const Item &item, QDataStream &dataStream, Databa
     }
 }
 
-void Core::readPCCFromDatabase(PartColorCode &pcc, QDataStream &dataStream, Core::DatabaseVersion) const
-{
-    qint32 itemIndex, colorIndex;
-    dataStream >> pcc.m_id >> itemIndex >> colorIndex;
-    pcc.m_itemIndex = itemIndex;
-    pcc.m_colorIndex = colorIndex;
-}
-
 void Core::writePCCToDatabase(const PartColorCode &pcc,
                               QDataStream &dataStream, Core::DatabaseVersion v)
 {
@@ -1626,55 +1859,68 @@ namespace BrickLink {
 class PriceGuideLoaderJob : public QRunnable
 {
 public:
-    explicit PriceGuideLoaderJob(PriceGuide *pg)
+    explicit PriceGuideLoaderJob(const QVector<PriceGuide *> &pgs)
         : QRunnable()
-        , m_pg(pg)
+        , m_pgs(pgs)
     {
-        pg->m_update_status = UpdateStatus::Loading;
+        for (PriceGuide *pg : pgs)
+            pg->m_update_status = UpdateStatus::Loading;
     }
 
     void run() override;
 
-    PriceGuide *priceGuide() const
-    {
-        return m_pg;
-    }
-
 private:
     Q_DISABLE_COPY(PriceGuideLoaderJob)
 
-    PriceGuide *m_pg;
+    QVector<PriceGuide *> m_pgs;
 };
 
 void PriceGuideLoaderJob::run()
 {
-    if (m_pg) {
+    struct Result {
+        PriceGuide *pg;
+        bool valid;
         QDateTime fetched;
         PriceGuide::Data data;
-        bool valid = m_pg->loadFromDisk(fetched, data);
-        auto pg = m_pg;
+    };
+    QVector<Result> results;
+    results.reserve(m_pgs.size());
 
-        QMetaObject::invokeMethod(core(), [=]() {
-            pg->m_valid = valid;
+    for (PriceGuide *pg : qAsConst(m_pgs)) {
+        Result r { pg, false, { }, { } };
+        r.valid = pg->loadFromDisk(r.fetched, r.data);
+        results.append(r);
+    }
+
+    // deliver all the results in one go, instead of flooding the event loop
+    QMetaObject::invokeMethod(core(), [results]() {
+        for (const Result &r : results) {
+            PriceGuide *pg = r.pg;
+            pg->m_valid = r.valid;
             pg->m_update_status = UpdateStatus::Ok;
-            if (valid) {
-                pg->m_fetched = fetched;
-                pg->m_data = data;
+            if (r.valid) {
+                pg->m_fetched = r.fetched;
+                pg->m_data = r.data;
             }
             core()->priceGuideLoaded(pg);
-        }, Qt::QueuedConnection);
-    }
+        }
+    }, Qt::QueuedConnection);
 }
 
 }
 
+static quint64 priceGuideKey(const BrickLink::Item *item, const BrickLink::Color *color)
+{
+    return quint64(color->id()) << 32 | quint64(item->itemTypeId()) << 24 | quint64(item->index());
+}
+
 BrickLink::PriceGuide *BrickLink::Core::priceGuide(const Item *item,
                                                    const Color *color, bool highPriority)
 {
     if (!item || !color)
         return nullptr;
 
-    quint64 key = quint64(color->id()) << 32 | quint64(item->itemTypeId()) << 24 | quint64(item->index());
+    quint64 key = priceGuideKey(item, color);
     PriceGuide *pg = m_pg_cache [key];
 
     bool needToLoad = false;
@@ -1700,12 +1946,64 @@ BrickLink::PriceGuide *BrickLink::Core::priceGuide(const Item *item,
     }
     else if (needToLoad) {
         pg->addRef();
-        m_diskloadPool.start(new PriceGuideLoaderJob(pg));
+        m_diskloadPool.start(new PriceGuideLoaderJob({ pg }));
     }
 
     return pg;
 }
 
+QVector<BrickLink::PriceGuide *> BrickLink::Core::priceGuides(const QVector<QPair<const Item *, const Color *>> &itemsAndColors)
+{
+    QVector<PriceGuide *> result;
+    result.reserve(itemsAndColors.size());
+
+    QHash<quint64, PriceGuide *> unique;
+    QVector<PriceGuide *> toLoad;
+
+    for (const auto &ic : itemsAndColors) {
+        PriceGuide *pg = nullptr;
+
+        if (ic.first && ic.second) {
+            const quint64 key = priceGuideKey(ic.first, ic.second);
+            auto it = unique.constFind(key);
+
+            if (it != unique.cend()) {
+                pg = it.value();
+            } else {
+                pg = m_pg_cache [key];
+                if (!pg) {
+                    pg = new PriceGuide(ic.first, ic.second);
+                    if (!m_pg_cache.insert(key, pg)) {
+                        qWarning("Can not add priceguide to cache (cache max/cur: %d/%d, cost: %d)",
+                                 int(m_pg_cache.maxCost()), int(m_pg_cache.totalCost()), 1);
+                        pg = nullptr;
+                    } else {
+                        pg->addRef(); // for the loader job
+                        toLoad << pg;
+                    }
+                }
+                unique.insert(key, pg);
+            }
+        }
+        // the reference keeps the cache from purging the earlier results while adding the
+        // later ones
+        if (pg)
+            pg->addRef();
+        result << pg;
+    }
+
+    // split the loading into a few large batches, so we end up with just a handful of
+    // result deliveries back to this thread
+    if (!toLoad.isEmpty()) {
+        const int batchCount = std::max(1, m_diskloadPool.maxThreadCount());
+        const int batchSize = std::max(64, (toLoad.size() + batchCount - 1) / batchCount);
+
+        for (int i = 0; i < toLoad.size(); i += batchSize)
+            m_diskloadPool.start(new PriceGuideLoaderJob(toLoad.mid(i, batchSize)));
+    }
+    return result;
+}
+
 
 void BrickLink::Core::priceGuideLoaded(BrickLink::PriceGuide *pg)
 {
@@ -1722,9 +2020,16 @@ void BrickLink::Core::priceGuideLoaded(BrickLink::PriceGuide *pg)
 
 void BrickLink::Core::updatePriceGuide(BrickLink::PriceGuide *pg, bool highPriority)
 {
-    if (!pg || (pg->m_update_status == UpdateStatus::Updating))
+    if (!pg)
         return;
 
+    if (pg->m_update_status == UpdateStatus::Updating) {
+        // the user is now waiting for a price guide that was queued as a background update
+        if (highPriority && pg->m_transferJob && m_transfer)
+            m_transfer->raisePriority(pg->m_transferJob, TransferJob::HighPriority);
+        return;
+    }
+
     if (!m_online || !m_transfer) {
         pg->m_update_status = UpdateStatus::UpdateFailed;
         emit priceGuideUpdated(pg);
@@ -1764,8 +2069,20 @@ void BrickLink::Core::updatePriceGuide(BrickLink::PriceGuide *pg, bool highPrior
     }
     url.setQuery(query);
 
+    // if we have a valid copy already, the server might be able to just confirm it
+    ValidatorStore::Validators validators;
+    if (pg->isValid()) {
+        validators = m_validatorStore->load(ValidatorStore::Kind::PriceGuide,
+                                            persistentKey(pg->item(), pg->color()));
+    }
+
     //qDebug ( "PG request started for %s", (const char *) url );
-    pg->m_transferJob = TransferJob::get(url, nullptr, 2);
+    if (validators.isEmpty()) {
+        pg->m_transferJob = TransferJob::get(url, nullptr, 2);
+    } else {
+        pg->m_transferJob = TransferJob::getIfChanged(url, validators.etag,
+                                                      validators.lastModified, nullptr, 2);
+    }
     pg->m_transferJob->setUserData("priceGuide", QVariant::fromValue(pg));
 
     m_transfer->retrieve(pg->m_transferJob, highPriority);
@@ -1783,7 +2100,12 @@ void BrickLink::Core::priceGuideJobFinished(TransferJob *j, PriceGuide *pg)
     pg->m_transferJob = nullptr;
     pg->m_update_status = UpdateStatus::UpdateFailed;
 
-    if (j->isCompleted()) {
+    if (j->isCompleted() && j->wasNotModifiedSince()) {
+        // our copy is still up-to-date: we only need to remember that we checked
+        pg->m_fetched = QDateTime::currentDateTime();
+        pg->saveToDisk(pg->m_fetched, pg->m_data);
+        pg->m_update_status = UpdateStatus::Ok;
+    } else if (j->isCompleted()) {
         if (pg->m_scrapedHtml)
             pg->m_valid = pg->parseHtml(*j->data(), pg->m_data);
         else
@@ -1792,6 +2114,9 @@ void BrickLink::Core::priceGuideJobFinished(TransferJob *j, PriceGuide *pg)
         if (pg->m_valid) {
             pg->m_fetched = QDateTime::currentDateTime();
             pg->saveToDisk(pg->m_fetched, pg->m_data);
+            m_validatorStore->save(ValidatorStore::Kind::PriceGuide,
+                                   persistentKey(pg->item(), pg->color()),
+                                   { j->etag(), j->lastModified() });
             pg->m_update_status = UpdateStatus::Ok;
         }
     } else if (!j->isAborted()) {
@@ -1810,9 +2135,10 @@ namespace BrickLink {
 class PictureLoaderJob : public QRunnable
 {
 public:
-    explicit PictureLoaderJob(Picture *pic)
+    explicit PictureLoaderJob(Picture *pic, bool thumbnail = true)
         : QRunnable()
         , m_pic(pic)
+        , m_thumbnail(thumbnail)
     {
         pic->m_update_status = UpdateStatus::Loading;
     }
@@ -1828,6 +2154,7 @@ private:
     Q_DISABLE_COPY(PictureLoaderJob)
 
     Picture *m_pic;
+    bool m_thumbnail;
 };
 
 void PictureLoaderJob::run()
@@ -1835,14 +2162,18 @@ void PictureLoaderJob::run()
     if (m_pic) {
         QDateTime fetched;
         QImage image;
-        bool valid = m_pic->loadFromDisk(fetched, image);
+        QByteArray compressed;
+        bool valid = m_pic->loadFromDisk(fetched, image, m_thumbnail, &compressed);
         auto pic = m_pic;
+        bool isThumbnail = m_thumbnail && pic->color();
         QMetaObject::invokeMethod(core(), [=]() {
             pic->m_valid = valid;
             pic->m_update_status = UpdateStatus::Ok;
             if (valid) {
                 pic->m_fetched = fetched;
                 pic->m_image = image;
+                pic->m_isThumbnail = isThumbnail;
+                core()->m_pictureCache->insert(pic, compressed);
             }
             core()->pictureLoaded(pic);
         }, Qt::QueuedConnection);
@@ -1872,7 +2203,7 @@ BrickLink::Picture *BrickLink::Core::picture(const Item *item, const Color *colo
 
     if (!pic) {
         pic = new Picture(item, color);
-        if (!m_pic_cache.insert(key, pic, pic->cost())) {
+        if (!m_pic_cache.insert(key, pic)) {
             qWarning("Can not add picture to cache (cache max/cur: %d/%d, item: %s)",
                      int(m_pic_cache.maxCost()), int(m_pic_cache.totalCost()), item->id().constData());
             return nullptr;
@@ -1881,11 +2212,15 @@ BrickLink::Picture *BrickLink::Core::picture(const Item *item, const Color *colo
     }
 
     if (highPriority) {
-        if (!pic->isValid()) {
-            pic->m_valid = pic->loadFromDisk(pic->m_fetched, pic->m_image);
+        // high priority requests are for detail views: they need the full resolution image
+        if (!pic->isValid() || pic->m_isThumbnail || pic->m_image.isNull()) {
+            QByteArray compressed;
+            pic->m_valid = pic->loadFromDisk(pic->m_fetched, pic->m_image, false, &compressed);
+            pic->m_isThumbnail = false;
             pic->m_update_status = UpdateStatus::Ok;
 
-            m_pic_cache.setObjectCost(key, pic->cost());
+            if (pic->m_valid)
+                m_pictureCache->insert(pic, compressed);
         }
 
         if (updateNeeded(pic->isValid(), pic->lastUpdated(), m_pic_update_iv))
@@ -1917,14 +2252,24 @@ void BrickLink::Core::pictureLoaded(Picture *pic)
         }
         emit pictureUpdated(pic);
         pic->release();
+    }
+}
+
+void BrickLink::Core::restorePicture(Picture *pic)
+{
+    if (m_pictureCache->access(pic) || !pic->m_valid)
+        return;
 
-        m_pic_cache.setObjectCost(Picture::key(pic->item(), pic->color()), pic->cost());
+    // the image was evicted and is not available in memory anymore: reload it in the background
+    if (pic->m_update_status == UpdateStatus::Ok) {
+        pic->addRef();
+        m_diskloadPool.start(new PictureLoaderJob(pic, pic->m_isThumbnail));
     }
 }
 
-QPair<int, int> BrickLink::Core::pictureCacheStats() const
+BrickLink::PictureCache::Stats BrickLink::Core::pictureCacheStats() const
 {
-    return qMakePair(m_pic_cache.totalCost(), m_pic_cache.maxCost());
+    return m_pictureCache->stats();
 }
 
 QPair<int, int> BrickLink::Core::priceGuideCacheStats() const
@@ -1934,8 +2279,15 @@ QPair<int, int> BrickLink::Core::priceGuideCacheStats() const
 
 void BrickLink::Core::updatePicture(Picture *pic, bool highPriority)
 {
-    if (!pic || (pic->m_update_status == UpdateStatus::Updating))
+    if (!pic)
+        return;
+
+    if (pic->m_update_status == UpdateStatus::Updating) {
+        // the user is now waiting for a picture that was queued as a background update
+        if (highPriority && pic->m_transferJob && m_transfer)
+            m_transfer->raisePriority(pic->m_transferJob, TransferJob::HighPriority);
         return;
+    }
 
     if (!m_online || !m_transfer) {
         pic->m_update_status = UpdateStatus::UpdateFailed;
@@ -1965,10 +2317,22 @@ void BrickLink::Core::updatePicture(Picture *pic, bool highPriority)
                 % QLatin1String(pic->item()->id()) % u".png";
     }
 
+    // if we have a valid copy already, the server might be able to just confirm it
+    ValidatorStore::Validators validators;
+    if (pic->isValid()) {
+        validators = m_validatorStore->load(ValidatorStore::Kind::Picture,
+                                            persistentKey(pic->item(), pic->color()));
+    }
+
     //qDebug() << "PIC request started for" << url;
     QSaveFile *f = pic->saveFile();
-    pic->m_transferJob = TransferJob::get(url, f);
+    if (validators.isEmpty())
+        pic->m_transferJob = TransferJob::get(url, f);
+    else
+        pic->m_transferJob = TransferJob::getIfChanged(url, validators.etag, validators.lastModified, f);
     pic->m_transferJob->setUserData("picture", QVariant::fromValue(pic));
+    if (!highPriority)
+        pic->m_transferJob->setPriority(TransferJob::LowPriority); // e.g. a document's thumbnails
     m_transfer->retrieve(pic->m_transferJob, highPriority);
 }
 
@@ -1984,12 +2348,36 @@ void BrickLink::Core::pictureJobFinished(TransferJob *j, Picture *pic)
     pic->m_transferJob = nullptr;
     bool large = (!pic->color());
 
-    if (j->isCompleted() && j->file()) {
+    if (j->isCompleted() && j->wasNotModifiedSince()) {
+        // our copy is still up-to-date (the QSaveFile is just discarded): the validation time
+        // is what we use as 'last updated'. The file's timestamp is only the fallback, because
+        // its precision depends on the file system.
+        const quint64 key = persistentKey(pic->item(), pic->color());
+        pic->m_fetched = QDateTime::currentDateTime();
+
+        auto validators = m_validatorStore->load(ValidatorStore::Kind::Picture, key);
+        validators.validated = pic->m_fetched;
+        m_validatorStore->save(ValidatorStore::Kind::Picture, key, validators);
+
+        QFile f(pic->fileName());
+        if (!f.open(QIODevice::ReadWrite | QIODevice::ExistingOnly)
+                || !f.setFileTime(pic->m_fetched, QFileDevice::FileModificationTime)) {
+            qWarning() << "Could not update the timestamp of" << f.fileName() << ":" << f.errorString();
+        }
+        // the thumbnail is still valid as well, it just needs the new timestamp
+        m_thumbnailPack->setFetched(key, pic->m_fetched);
+        pic->m_update_status = UpdateStatus::Ok;
+
+    } else if (j->isCompleted() && j->file()) {
         static_cast<QSaveFile *>(j->file())->commit();
+        m_thumbnailPack->remove(persistentKey(pic->item(), pic->color()));
+        m_validatorStore->save(ValidatorStore::Kind::Picture, persistentKey(pic->item(), pic->color()),
+                               { j->etag(), j->lastModified(), QDateTime::currentDateTime() });
 
-        // the pic is still ref'ed, so we just forward it to the loader
+        // the pic is still ref'ed, so we just forward it to the loader: we have to decode the
+        // new image anyway, so we keep the full resolution and create a new thumbnail on the way
         pic->m_update_status = UpdateStatus::Loading;
-        m_diskloadPool.start(new PictureLoaderJob(pic));
+        m_diskloadPool.start(new PictureLoaderJob(pic, false));
         return;
 
     } else if (large && (j->responseCode() == 404) && (j->url().path().endsWith(".jpg"_l1))) {
@@ -2008,6 +2396,7 @@ void BrickLink::Core::pictureJobFinished(TransferJob *j, Picture *pic)
             QSaveFile *f = pic->saveFile();
             TransferJob *job = TransferJob::get(url, f);
             job->setUserData("picture", QVariant::fromValue<Picture *>(pic));
+            job->setPriority(j->priority());
             m_transfer->retrieve(job);
             pic->m_transferJob = job;
 
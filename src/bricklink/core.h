@@ -28,7 +28,11 @@
 
 #include "bricklink/global.h"
 #include "bricklink/changelogentry.h"
+#include "bricklink/partcolorcode.h"
+#include "bricklink/inventoryindex.h"
+#include "bricklink/picturecache.h"
 #include "utility/q3cache.h"
+#include "utility/pooledarray.h"
 
 QT_FORWARD_DECLARE_CLASS(QFile)
 QT_FORWARD_DECLARE_CLASS(QSaveFile)
@@ -39,7 +43,15 @@ class TransferJob;
 namespace BrickLink {
 
 class Incomplete;
+class ItemSearchIndex;
+class PriceGuideStore;
+class ThumbnailPack;
+class ValidatorStore;
 
+namespace Database {
+class MappedChunk;
+class MappedChunkBuilder;
+}
 
 class Core : public QObject
 {
@@ -58,8 +70,9 @@ public:
         Version_3,
         Version_4,
         Version_5,
+        Version_6,
 
-        Latest = Version_5
+        Latest = Version_6
     };
 
     QString defaultDatabaseName(DatabaseVersion version = DatabaseVersion::Latest) const;
@@ -99,7 +112,17 @@ public:
 
     const PartColorCode *partColorCode(uint id);
 
+    // A key for item/color combinations in the on-disk caches: unlike the in-memory cache keys,
+    // it doesn't depend on the item index, which changes with every database update.
+    static quint64 persistentKey(const Item *item, const Color *color);
+
+    const ItemSearchIndex *itemSearchIndex() const  { return m_itemSearchIndex; }
+    const InventoryIndex &inventoryIndex() const     { return m_inventoryIndex; }
+
     PriceGuide *priceGuide(const Item *item, const Color *color, bool highPriority = false);
+    // Bulk version of priceGuide(): returns one price guide per pair (nullptr for invalid
+    // pairs), each one already addRef()'ed - the caller has to release() every entry.
+    QVector<PriceGuide *> priceGuides(const QVector<QPair<const Item *, const Color *>> &itemsAndColors);
 
     QSize standardPictureSize() const;
     Picture *picture(const Item *item, const Color *color, bool highPriority = false);
@@ -122,6 +145,7 @@ public:
 
     bool isDatabaseValid() const;
     bool readDatabase(const QString &filename = QString());
+    void unloadDatabase();
     bool writeDatabase(const QString &filename, BrickLink::Core::DatabaseVersion version) const;
 
     enum class ResolveResult { Fail, Direct, ChangeLog };
@@ -161,12 +185,17 @@ private:
 private:
     QString dataFileName(QStringView fileName, const Item *item, const Color *color) const;
 
+    PriceGuideStore *priceGuideStore() const  { return m_pgStore; }
     void updatePriceGuide(BrickLink::PriceGuide *pg, bool highPriority = false);
+    ThumbnailPack *thumbnailPack() const  { return m_thumbnailPack; }
+    ValidatorStore *validatorStore() const  { return m_validatorStore; }
     void updatePicture(BrickLink::Picture *pic, bool highPriority = false);
+    void restorePicture(BrickLink::Picture *pic);
 //    friend void PriceGuide::update(bool);
 //    friend void Picture::update(bool);
     friend class PriceGuide;
     friend class Picture;
+    friend class PictureCache;
 
     void cancelPriceGuideUpdate(BrickLink::PriceGuide *pg);
     void cancelPictureUpdate(BrickLink::Picture *pic);
@@ -175,19 +204,23 @@ private:
 
     static bool updateNeeded(bool valid, const QDateTime &last, int iv);
 
-    static void readColorFromDatabase(Color &col, QDataStream &dataStream, DatabaseVersion v);
+    void buildLookupIndexes();
+
+    static void readColorFromDatabase(Color &col, const Database::MappedChunk &mc, quint32 index);
+    static void writeColorToDatabase(const Color &color, Database::MappedChunkBuilder &mcb);
     static void writeColorToDatabase(const Color &color, QDataStream &dataStream, DatabaseVersion v);
 
-    static void readCategoryFromDatabase(Category &cat, QDataStream &dataStream, DatabaseVersion v);
+    static void readCategoryFromDatabase(Category &cat, const Database::MappedChunk &mc, quint32 index);
+    static void writeCategoryToDatabase(const Category &category, Database::MappedChunkBuilder &mcb);
     static void writeCategoryToDatabase(const Category &category, QDataStream &dataStream, DatabaseVersion v);
 
     static void readItemTypeFromDatabase(ItemType &itt, QDataStream &dataStream, DatabaseVersion v);
     static void writeItemTypeToDatabase(const ItemType &itemType, QDataStream &dataStream, DatabaseVersion v);
 
-    static void readItemFromDatabase(Item &item, QDataStream &dataStream, DatabaseVersion v);
+    static void readItemFromDatabase(Item &item, const Database::MappedChunk &mc, quint32 index);
+    static void writeItemToDatabase(const Item &item, Database::MappedChunkBuilder &mcb);
     static void writeItemToDatabase(const Item &item, QDataStream &dataStream, DatabaseVersion v);
 
-    void readPCCFromDatabase(PartColorCode &pcc, QDataStream &dataStream, Core::DatabaseVersion v) const;
     static void writePCCToDatabase(const PartColorCode &pcc, QDataStream &dataStream, DatabaseVersion v);
 
     void readItemChangeLogFromDatabase(ItemChangeLogEntry &e, QDataStream &dataStream, Core::DatabaseVersion v) const;
@@ -206,7 +239,7 @@ private slots:
     friend class PictureLoaderJob;
 
 public: // semi-public for the QML wrapper
-    QPair<int, int> pictureCacheStats() const;
+    PictureCache::Stats pictureCacheStats() const;
     QPair<int, int> priceGuideCacheStats() const;
 
 private:
@@ -225,7 +258,16 @@ private:
     std::vector<Item>          m_items;
     std::vector<ItemChangeLogEntry>  m_itemChangelog;
     std::vector<ColorChangeLogEntry> m_colorChangelog;
-    std::vector<PartColorCode> m_pccs;
+    PooledArray<PartColorCode> m_pccs;
+    InventoryIndex             m_inventoryIndex;
+
+    // lookup indexes, built when loading the database
+    std::vector<quint32>          m_itemLookup; // open addressing: item index + 1, 0 if empty
+    QHash<QString, const Color *> m_colorNameLookup; // case folded names
+    QHash<int, const Color *>     m_colorLDrawLookup;
+
+    QFile *m_databaseFile = nullptr; // the memory mapped database backing the data above
+    ItemSearchIndex *m_itemSearchIndex = nullptr;
 
     Transfer *                 m_transfer = nullptr;
     Transfer *                 m_authenticatedTransfer = nullptr;
@@ -239,10 +281,15 @@ private:
 
     int                          m_pg_update_iv = 0;
     Q3Cache<quint64, PriceGuide> m_pg_cache;
+    PriceGuideStore *            m_pgStore = nullptr;
 
     int                          m_pic_update_iv = 0;
     QThreadPool                  m_diskloadPool;
     Q3Cache<quint64, Picture>    m_pic_cache;
+    ThumbnailPack *              m_thumbnailPack = nullptr;
+    PictureCache *               m_pictureCache = nullptr;
+
+    ValidatorStore *             m_validatorStore = nullptr; // for pictures and price guides
 
     qreal m_item_image_scale_factor = 1.;
 
@@ -0,0 +1,309 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <vector>
+
+#include <QtCore/QDataStream>
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QSysInfo>
+
+#include "utility/exception.h"
+#include "utility/pooledarray.h"
+
+//
+// Starting with version 6, the 'COL ', 'CAT ', 'ITEM' and 'PCC ' chunks of the database are
+// laid out so that they can be used directly from a read-only memory mapping of the file:
+//
+//   * 32 HEADER (record count, record size and the sizes of the 4 pools)
+//   * RECORD COUNT x RECORD SIZE fixed-size records
+//   * the 64, 32, 16 and 8 bit pools (in that order, so they are all naturally aligned)
+//
+// Strings are stored as NUL terminated UTF-16 (in the 16 bit pool) or Latin1 (in the 8 bit
+// pool), arrays are stored in the pool matching their element size. Records only reference
+// pool data via an offset (in elements, not bytes) and a size.
+// All values are little endian: big endian hosts cannot use this format.
+//
+
+namespace BrickLink {
+
+namespace Database {
+
+struct ChunkHeader
+{
+    quint32 recordCount;
+    quint32 recordSize;
+    quint32 pool64Size;
+    quint32 pool32Size;
+    quint32 pool16Size;
+    quint32 pool8Size;
+    quint32 reserved[2];
+};
+static_assert(sizeof(ChunkHeader) == 32);
+
+struct ColorRecord
+{
+    quint32 id;
+    qint32  ldrawId;
+    quint32 rgba;
+    quint32 type;
+    quint32 flags;   // 0x01: rgba is valid
+    float   popularity;
+    quint16 yearFrom;
+    quint16 yearTo;
+    quint32 nameOffset;
+    quint32 nameSize;
+    quint32 reserved;
+};
+static_assert(sizeof(ColorRecord) == 40);
+
+struct CategoryRecord
+{
+    quint32 id;
+    quint32 nameOffset;
+    quint32 nameSize;
+    quint32 reserved;
+};
+static_assert(sizeof(CategoryRecord) == 16);
+
+struct ItemRecord
+{
+    quint32 nameOffset;
+    quint32 nameSize;
+    quint32 idOffset;
+    quint32 idSize;
+    qint16  itemTypeIndex;
+    qint16  categoryIndex;
+    qint16  defaultColorIndex;
+    qint8   itemTypeId;
+    quint8  year;
+    qint64  lastInventoryUpdate;
+    float   weight;
+    quint32 knownColorsOffset;
+    quint32 knownColorsSize;
+    quint32 appearsInOffset;
+    quint32 appearsInSize;
+    quint32 consistsOfOffset;
+    quint32 consistsOfSize;
+    quint32 reserved;
+};
+static_assert(sizeof(ItemRecord) == 64);
+
+// PartColorCodes and InventoryIndex::Records are stored as-is: they are just POD
+
+
+inline bool isMappingSupported()
+{
+    return (QSysInfo::ByteOrder == QSysInfo::LittleEndian);
+}
+
+class MappedChunk
+{
+public:
+    MappedChunk(const char *data, qint64 size, quint32 recordSize)
+    {
+        if (size < qint64(sizeof(ChunkHeader)))
+            throw Exception("mapped chunk is too small: %1 bytes").arg(size);
+
+        m_header = reinterpret_cast<const ChunkHeader *>(data);
+        if (m_header->recordSize != recordSize) {
+            throw Exception("mapped chunk has an unexpected record size: %1 instead of %2")
+                .arg(m_header->recordSize).arg(recordSize);
+        }
+        qint64 offset = sizeof(ChunkHeader);
+        m_records = data + offset;
+        offset += qint64(m_header->recordCount) * m_header->recordSize;
+        m_pool64 = reinterpret_cast<const quint64 *>(data + offset);
+        offset += qint64(m_header->pool64Size) * 8;
+        m_pool32 = reinterpret_cast<const quint32 *>(data + offset);
+        offset += qint64(m_header->pool32Size) * 4;
+        m_pool16 = reinterpret_cast<const quint16 *>(data + offset);
+        offset += qint64(m_header->pool16Size) * 2;
+        m_pool8 = data + offset;
+        offset += qint64(m_header->pool8Size);
+
+        if (offset > size)
+            throw Exception("mapped chunk is truncated: %1 bytes instead of %2").arg(size).arg(offset);
+    }
+
+    quint32 recordCount() const  { return m_header->recordCount; }
+
+    template <typename R> const R &record(quint32 index) const
+    {
+        Q_ASSERT(index < m_header->recordCount);
+        return *reinterpret_cast<const R *>(m_records + index * m_header->recordSize);
+    }
+
+    template <typename R> const R *records() const
+    {
+        return reinterpret_cast<const R *>(m_records);
+    }
+
+    QString string(quint32 offset, quint32 size) const
+    {
+        check(offset, size + 1, m_header->pool16Size);
+        return QString::fromRawData(reinterpret_cast<const QChar *>(m_pool16 + offset), int(size));
+    }
+
+    QByteArray byteArray(quint32 offset, quint32 size) const
+    {
+        check(offset, size + 1, m_header->pool8Size);
+        return QByteArray::fromRawData(m_pool8 + offset, int(size));
+    }
+
+    template <typename T> PooledArray<T> array(quint32 offset, quint32 size) const
+    {
+        if constexpr (sizeof(T) == 8) {
+            check(offset, size, m_header->pool64Size);
+            return PooledArray<T>::fromRawData(reinterpret_cast<const T *>(m_pool64 + offset), size);
+        } else if constexpr (sizeof(T) == 4) {
+            check(offset, size, m_header->pool32Size);
+            return PooledArray<T>::fromRawData(reinterpret_cast<const T *>(m_pool32 + offset), size);
+        } else if constexpr (sizeof(T) == 2) {
+            check(offset, size, m_header->pool16Size);
+            return PooledArray<T>::fromRawData(reinterpret_cast<const T *>(m_pool16 + offset), size);
+        } else {
+            static_assert(sizeof(T) == 1);
+            check(offset, size, m_header->pool8Size);
+            return PooledArray<T>::fromRawData(reinterpret_cast<const T *>(m_pool8 + offset), size);
+        }
+    }
+
+    template <typename T> PooledArray<T> pool() const
+    {
+        if constexpr (sizeof(T) == 8)
+            return array<T>(0, m_header->pool64Size);
+        else if constexpr (sizeof(T) == 4)
+            return array<T>(0, m_header->pool32Size);
+        else if constexpr (sizeof(T) == 2)
+            return array<T>(0, m_header->pool16Size);
+        else
+            return array<T>(0, m_header->pool8Size);
+    }
+
+private:
+    static void check(quint32 offset, quint32 size, quint32 poolSize)
+    {
+        if ((quint64(offset) + size) > poolSize) {
+            throw Exception("mapped chunk pool access out of bounds: %1 + %2 > %3")
+                .arg(offset).arg(size).arg(poolSize);
+        }
+    }
+
+    const ChunkHeader *m_header;
+    const char *m_records;
+    const quint64 *m_pool64;
+    const quint32 *m_pool32;
+    const quint16 *m_pool16;
+    const char *m_pool8;
+};
+
+class MappedChunkBuilder
+{
+public:
+    template <typename R> R &addRecord()
+    {
+        Q_ASSERT(!m_recordSize || (m_recordSize == sizeof(R)));
+        m_recordSize = sizeof(R);
+        m_records.resize(m_records.size() + sizeof(R), 0);
+        ++m_recordCount;
+        return *reinterpret_cast<R *>(m_records.data() + m_records.size() - sizeof(R));
+    }
+
+    quint32 addString(const QString &str)
+    {
+        auto offset = quint32(m_pool16.size());
+        m_pool16.insert(m_pool16.end(), str.utf16(), str.utf16() + str.size());
+        m_pool16.push_back(0);
+        return offset;
+    }
+
+    quint32 addByteArray(const QByteArray &ba)
+    {
+        auto offset = quint32(m_pool8.size());
+        m_pool8.insert(m_pool8.end(), ba.cbegin(), ba.cend());
+        m_pool8.push_back(0);
+        return offset;
+    }
+
+    template <typename T> quint32 addArray(const T *data, quint32 size)
+    {
+        if constexpr (sizeof(T) == 8)
+            return append(m_pool64, data, size);
+        else if constexpr (sizeof(T) == 4)
+            return append(m_pool32, data, size);
+        else if constexpr (sizeof(T) == 2)
+            return append(m_pool16, data, size);
+        else
+            return append(m_pool8, data, size);
+    }
+
+    template <typename C> quint32 addArray(const C &c)
+    {
+        return addArray(c.data(), quint32(c.size()));
+    }
+
+    bool write(QDataStream &ds, quint32 recordSize) const
+    {
+        if (!isMappingSupported())
+            return false;
+
+        // an empty chunk still needs to know its record size
+        Q_ASSERT(!m_recordSize || (m_recordSize == recordSize));
+
+        ChunkHeader header = { };
+        header.recordCount = m_recordCount;
+        header.recordSize = recordSize;
+        header.pool64Size = quint32(m_pool64.size());
+        header.pool32Size = quint32(m_pool32.size());
+        header.pool16Size = quint32(m_pool16.size());
+        header.pool8Size = quint32(m_pool8.size());
+
+        auto writeRaw = [&ds](const void *data, size_t size) {
+            return !size || (ds.writeRawData(static_cast<const char *>(data), int(size)) == int(size));
+        };
+
+        return writeRaw(&header, sizeof(header))
+                && writeRaw(m_records.data(), m_records.size())
+                && writeRaw(m_pool64.data(), m_pool64.size() * 8)
+                && writeRaw(m_pool32.data(), m_pool32.size() * 4)
+                && writeRaw(m_pool16.data(), m_pool16.size() * 2)
+                && writeRaw(m_pool8.data(), m_pool8.size());
+    }
+
+private:
+    template <typename P, typename T> static quint32 append(std::vector<P> &pool, const T *data,
+                                                            quint32 size)
+    {
+        static_assert(sizeof(P) == sizeof(T));
+        auto offset = quint32(pool.size());
+        pool.resize(pool.size() + size);
+        if (size)
+            memcpy(pool.data() + offset, data, size * sizeof(T));
+        return offset;
+    }
+
+    quint32 m_recordCount = 0;
+    quint32 m_recordSize = 0;
+    std::vector<char> m_records;
+    std::vector<quint64> m_pool64;
+    std::vector<quint32> m_pool32;
+    std::vector<quint16> m_pool16;
+    std::vector<char> m_pool8;
+};
+
+} // namespace Database
+
+} // namespace BrickLink
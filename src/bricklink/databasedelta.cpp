@@ -0,0 +1,295 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QIODevice>
+#include <QtCore/QStringBuilder>
+
+#include "utility/exception.h"
+#include "bricklink/databasedelta.h"
+
+
+static const quint32 DeltaMagic = 0x44445342; // 'BSDD'
+static const quint32 DeltaVersion = 1;
+static const int HashSize = 64; // SHA-512
+
+// the old file is indexed at every KeySize-th position by the KeySize bytes found there: every
+// exact match of at least 2 * KeySize - 1 bytes is guaranteed to be found
+static constexpr qint64 KeySize = 8;
+// there are lots of repetitive byte sequences (e.g. runs of zeros): don't check all of them
+static constexpr int MaxCandidates = 16;
+
+namespace {
+
+struct IndexEntry
+{
+    quint64 key;
+    quint32 offset;
+
+    bool operator<(const IndexEntry &other) const
+    {
+        return (key < other.key) || ((key == other.key) && (offset < other.offset));
+    }
+};
+
+} // namespace
+
+static inline quint64 readKey(const char *p)
+{
+    quint64 key;
+    memcpy(&key, p, sizeof(key));
+    return key;
+}
+
+static qint64 matchLength(const char *a, qint64 aSize, const char *b, qint64 bSize)
+{
+    qint64 size = std::min(aSize, bSize);
+    qint64 i = 0;
+    while ((i < size) && (a[i] == b[i]))
+        ++i;
+    return i;
+}
+
+
+QByteArray BrickLink::DatabaseDelta::hash(QIODevice *device)
+{
+    QCryptographicHash h(QCryptographicHash::Sha512);
+    if (!h.addData(device))
+        return { };
+    return h.result();
+}
+
+QString BrickLink::DatabaseDelta::fileName(const QString &databaseName, const QByteArray &baseHash)
+{
+    return databaseName % u'.' % QString::fromLatin1(baseHash.toHex().left(16)) % u".delta";
+}
+
+void BrickLink::DatabaseDelta::create(const QByteArray &oldData, const QByteArray &newData,
+                                      QIODevice *delta)
+{
+    const char *o = oldData.constData();
+    const char *n = newData.constData();
+    const qint64 oldSize = oldData.size();
+    const qint64 newSize = newData.size();
+
+    if (oldSize > std::numeric_limits<quint32>::max())
+        throw Exception("the old database is too big to create a delta: %1 bytes").arg(oldSize);
+
+    std::vector<IndexEntry> index;
+    index.reserve(size_t(oldSize / KeySize));
+    for (qint64 i = 0; (i + KeySize) <= oldSize; i += KeySize)
+        index.push_back({ readKey(o + i), quint32(i) });
+    std::sort(index.begin(), index.end());
+
+    // find the longest exact match for the data at scan in the old file
+    auto search = [&](qint64 scan, qint64 lastOffset, qint64 &pos) -> qint64 {
+        qint64 bestLength = 0;
+
+        auto check = [&](qint64 candidate) {
+            if ((candidate < 0) || (candidate >= oldSize))
+                return;
+            qint64 length = matchLength(n + scan, newSize - scan, o + candidate, oldSize - candidate);
+            if (length > bestLength) {
+                bestLength = length;
+                pos = candidate;
+            }
+        };
+
+        check(scan + lastOffset); // just continuing the last match is the best case
+
+        if ((scan + KeySize) <= newSize) {
+            auto range = std::equal_range(index.cbegin(), index.cend(),
+                                          IndexEntry { readKey(n + scan), 0 },
+                                          [](const IndexEntry &a, const IndexEntry &b) {
+                return a.key < b.key;
+            });
+            int count = 0;
+            for (auto it = range.first; (it != range.second) && (count < MaxCandidates); ++it, ++count)
+                check(it->offset);
+        }
+        return bestLength;
+    };
+
+    QDataStream ds(delta);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    const QByteArray oldHash = QCryptographicHash::hash(oldData, QCryptographicHash::Sha512);
+    const QByteArray newHash = QCryptographicHash::hash(newData, QCryptographicHash::Sha512);
+
+    ds << DeltaMagic << DeltaVersion << qint64(oldSize) << qint64(newSize);
+    ds.writeRawData(oldHash.constData(), HashSize);
+    ds.writeRawData(newHash.constData(), HashSize);
+
+    QByteArray diff;
+
+    // This is the bsdiff algorithm, but with a simple hash index instead of a suffix array: the
+    // old data is aligned to the new one by exact matches, which are then extended forwards and
+    // backwards as long as at least half of the bytes are still matching.
+    qint64 scan = 0, length = 0, pos = 0;
+    qint64 lastScan = 0, lastPos = 0, lastOffset = 0;
+
+    while (scan < newSize) {
+        qint64 oldScore = 0;
+
+        for (qint64 scsc = scan += length; scan < newSize; ++scan) {
+            length = search(scan, lastOffset, pos);
+
+            for (; scsc < (scan + length); ++scsc) {
+                if (((scsc + lastOffset) < oldSize) && (o[scsc + lastOffset] == n[scsc]))
+                    ++oldScore;
+            }
+            if (((length == oldScore) && length) || (length > (oldScore + KeySize)))
+                break;
+
+            if (((scan + lastOffset) < oldSize) && (o[scan + lastOffset] == n[scan]))
+                --oldScore;
+        }
+
+        if ((length == oldScore) && (scan != newSize))
+            continue;
+
+        // extend the last match forwards ...
+        qint64 lengthForward = 0;
+        for (qint64 i = 0, s = 0, sf = 0; ((lastScan + i) < scan) && ((lastPos + i) < oldSize); ) {
+            if (o[lastPos + i] == n[lastScan + i])
+                ++s;
+            ++i;
+            if ((s * 2 - i) > (sf * 2 - lengthForward)) {
+                sf = s;
+                lengthForward = i;
+            }
+        }
+
+        // ... and the new match backwards
+        qint64 lengthBackward = 0;
+        if (scan < newSize) {
+            for (qint64 i = 1, s = 0, sb = 0; (scan >= (lastScan + i)) && (pos >= i); ++i) {
+                if (o[pos - i] == n[scan - i])
+                    ++s;
+                if ((s * 2 - i) > (sb * 2 - lengthBackward)) {
+                    sb = s;
+                    lengthBackward = i;
+                }
+            }
+        }
+
+        // if they overlap, find the best split
+        if ((lastScan + lengthForward) > (scan - lengthBackward)) {
+            qint64 overlap = (lastScan + lengthForward) - (scan - lengthBackward);
+            qint64 lengthSplit = 0;
+            for (qint64 i = 0, s = 0, ss = 0; i < overlap; ++i) {
+                if (n[lastScan + lengthForward - overlap + i] == o[lastPos + lengthForward - overlap + i])
+                    ++s;
+                if (n[scan - lengthBackward + i] == o[pos - lengthBackward + i])
+                    --s;
+                if (s > ss) {
+                    ss = s;
+                    lengthSplit = i + 1;
+                }
+            }
+            lengthForward += lengthSplit - overlap;
+            lengthBackward -= lengthSplit;
+        }
+
+        const qint64 extraLength = (scan - lengthBackward) - (lastScan + lengthForward);
+        const qint64 seek = (pos - lengthBackward) - (lastPos + lengthForward);
+
+        diff.resize(lengthForward);
+        for (qint64 i = 0; i < lengthForward; ++i)
+            diff[i] = char(n[lastScan + i] - o[lastPos + i]);
+
+        ds << quint32(lengthForward) << quint32(extraLength) << qint64(seek);
+        ds.writeRawData(diff.constData(), int(lengthForward));
+        ds.writeRawData(n + lastScan + lengthForward, int(extraLength));
+
+        if (ds.status() != QDataStream::Ok)
+            throw Exception("could not write the delta: %1").arg(delta->errorString());
+
+        lastScan = scan - lengthBackward;
+        lastPos = pos - lengthBackward;
+        lastOffset = pos - scan;
+    }
+}
+
+QByteArray BrickLink::DatabaseDelta::apply(const QByteArray &oldData, const QByteArray &delta,
+                                           QIODevice *out)
+{
+    QDataStream ds(delta);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    quint32 magic = 0, version = 0;
+    qint64 oldSize = 0, newSize = 0;
+    QByteArray oldHash(HashSize, 0), newHash(HashSize, 0);
+
+    ds >> magic >> version >> oldSize >> newSize;
+    ds.readRawData(oldHash.data(), HashSize);
+    ds.readRawData(newHash.data(), HashSize);
+
+    if ((ds.status() != QDataStream::Ok) || (magic != DeltaMagic))
+        throw Exception("not a database delta");
+    if (version != DeltaVersion)
+        throw Exception("unsupported database delta version: %1").arg(version);
+    if ((oldSize != oldData.size())
+            || (QCryptographicHash::hash(oldData, QCryptographicHash::Sha512) != oldHash)) {
+        throw Exception("the delta does not apply to this database");
+    }
+
+    const char *o = oldData.constData();
+    QCryptographicHash hash(QCryptographicHash::Sha512);
+    QByteArray buffer;
+    qint64 oldPos = 0;
+    qint64 newPos = 0;
+
+    auto write = [&](const QByteArray &data) {
+        hash.addData(data);
+        if (out->write(data) != data.size())
+            throw Exception("could not write the database: %1").arg(out->errorString());
+    };
+
+    while (newPos < newSize) {
+        quint32 diffLength = 0, extraLength = 0;
+        qint64 seek = 0;
+        ds >> diffLength >> extraLength >> seek;
+
+        if ((ds.status() != QDataStream::Ok)
+                || ((newPos + diffLength + extraLength) > newSize)
+                || (oldPos < 0) || ((oldPos + diffLength) > oldSize)) {
+            throw Exception("the delta is corrupt at position %1").arg(newPos);
+        }
+
+        buffer.resize(int(diffLength));
+        if (ds.readRawData(buffer.data(), int(diffLength)) != int(diffLength))
+            throw Exception("the delta is truncated");
+        for (quint32 i = 0; i < diffLength; ++i)
+            buffer[i] = char(buffer[i] + o[oldPos + i]);
+        write(buffer);
+
+        buffer.resize(int(extraLength));
+        if (ds.readRawData(buffer.data(), int(extraLength)) != int(extraLength))
+            throw Exception("the delta is truncated");
+        write(buffer);
+
+        newPos += diffLength + extraLength;
+        oldPos += diffLength + seek;
+    }
+
+    if (hash.result() != newHash)
+        throw Exception("checksum mismatch after applying the delta");
+    return newHash;
+}
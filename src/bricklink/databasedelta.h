@@ -0,0 +1,52 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+QT_FORWARD_DECLARE_CLASS(QIODevice)
+
+
+namespace BrickLink {
+
+// Binary deltas between two consecutive database builds, so that clients don't have to download
+// the complete database every day.
+//
+// A naive block matching doesn't work for our database format: adding a single item shifts
+// all the following strings and arrays in the pools, which in turn changes the pool offsets in
+// all the following records. We use the approach of bsdiff instead: long approximate matches
+// are encoded as bytewise differences to the old file. These are mostly zeros or the same few
+// values over and over again, so the LZMA compression of the published delta takes care of
+// them.
+//
+// The delta file starts with the size and SHA-512 hash of both the old and the new database.
+// It is then a sequence of control records (quint32 diff size, quint32 extra size, qint64 seek
+// in the old file), each followed by its diff and extra bytes.
+// The deltas are published as "<database name>.<first 16 hex digits of the old hash>.delta.lzma"
+// next to the full database.
+
+namespace DatabaseDelta {
+
+QByteArray hash(QIODevice *device);
+QString fileName(const QString &databaseName, const QByteArray &baseHash);
+
+// both functions throw an Exception on errors
+void create(const QByteArray &oldData, const QByteArray &newData, QIODevice *delta);
+// returns the (verified) hash of the new database
+QByteArray apply(const QByteArray &oldData, const QByteArray &delta, QIODevice *out);
+
+} // namespace DatabaseDelta
+
+} // namespace BrickLink
@@ -0,0 +1,117 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include <algorithm>
+
+#include "bricklink/core.h"
+#include "bricklink/item.h"
+#include "bricklink/database_p.h"
+#include "bricklink/inventoryindex.h"
+
+
+namespace BrickLink {
+
+static void sortUnique(std::vector<quint32> &v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+InventoryIndex::InventoryIndex(const std::vector<Item> &items)
+{
+    std::vector<Record> records(items.size());
+    std::vector<quint32> pool;
+    std::vector<std::vector<quint32>> containers(items.size());
+    std::vector<quint32> parts;
+
+    for (quint32 i = 0; i < quint32(items.size()); ++i) {
+        parts.clear();
+        for (const Item::ConsistsOf &co : items[i].consistsOf()) {
+            if (!co.m_extra)
+                parts.push_back(co.m_itemIndex);
+            containers[co.m_itemIndex].push_back(i << 12 | quint32(co.m_colorIndex));
+        }
+        sortUnique(parts);
+
+        records[i].partsOffset = quint32(pool.size());
+        records[i].partsSize = quint32(parts.size());
+        pool.insert(pool.end(), parts.cbegin(), parts.cend());
+    }
+
+    // the containers are already sorted by item index, because we added them in item order
+    for (quint32 i = 0; i < quint32(items.size()); ++i) {
+        auto &c = containers[i];
+        c.erase(std::unique(c.begin(), c.end()), c.end());
+
+        records[i].containersOffset = quint32(pool.size());
+        records[i].containersSize = quint32(c.size());
+        pool.insert(pool.end(), c.cbegin(), c.cend());
+    }
+
+    m_records = records;
+    m_pool = pool;
+}
+
+InventoryIndex::InventoryIndex(const Database::MappedChunk &mc)
+{
+    m_records = PooledArray<Record>::fromRawData(mc.records<Record>(), mc.recordCount());
+    m_pool = mc.pool<quint32>();
+
+    for (const Record &r : m_records) {
+        if ((quint64(r.partsOffset) + r.partsSize > m_pool.size())
+                || (quint64(r.containersOffset) + r.containersSize > m_pool.size())) {
+            throw Exception("inventory index pool access out of bounds");
+        }
+    }
+}
+
+PooledArray<quint32> InventoryIndex::parts(quint32 itemIndex) const
+{
+    if (itemIndex >= m_records.size())
+        return { };
+    const Record &r = m_records[itemIndex];
+    return PooledArray<quint32>::fromRawData(m_pool.constData() + r.partsOffset, r.partsSize);
+}
+
+std::vector<quint32> InventoryIndex::containers(quint32 itemIndex, const Color *color) const
+{
+    std::vector<quint32> result;
+    if (itemIndex >= m_records.size())
+        return result;
+
+    const Record &r = m_records[itemIndex];
+    const quint32 colorIndex = color ? quint32(color - core()->colors().data()) : 0;
+    result.reserve(r.containersSize);
+
+    for (quint32 i = r.containersOffset; i < (r.containersOffset + r.containersSize); ++i) {
+        const quint32 entry = m_pool[i];
+        if (color && ((entry & 0xfff) != colorIndex))
+            continue;
+        if (result.empty() || (result.back() != (entry >> 12)))
+            result.push_back(entry >> 12);
+    }
+    return result;
+}
+
+void InventoryIndex::write(Database::MappedChunkBuilder &mcb) const
+{
+    // the offsets stay valid, because the pool is written as a whole
+    const quint32 poolOffset = mcb.addArray(m_pool);
+    Q_ASSERT(poolOffset == 0);
+    Q_UNUSED(poolOffset)
+
+    for (const Record &r : m_records)
+        mcb.addRecord<Record>() = r;
+}
+
+} // namespace BrickLink
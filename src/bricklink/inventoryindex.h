@@ -0,0 +1,62 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <vector>
+
+#include "bricklink/global.h"
+#include "utility/pooledarray.h"
+
+
+namespace BrickLink {
+
+namespace Database {
+class MappedChunk;
+class MappedChunkBuilder;
+}
+
+// Posting lists for the inventories of all items, in both directions:
+//   * set -> parts: the sorted indexes of all items that appear in an item (without extras)
+//   * part -> sets: the sorted indexes of all items that consist of an item (including extras)
+// This turns the "appears in" and "consists of" filters into simple list intersections instead
+// of having to scan the inventories of all items.
+
+class InventoryIndex
+{
+public:
+    InventoryIndex() = default;
+    InventoryIndex(const std::vector<Item> &items);
+    InventoryIndex(const Database::MappedChunk &mc);
+
+    quint32 itemCount() const  { return m_records.size(); }
+
+    PooledArray<quint32> parts(quint32 itemIndex) const;
+    std::vector<quint32> containers(quint32 itemIndex, const Color *color = nullptr) const;
+
+    void write(Database::MappedChunkBuilder &mcb) const;
+
+    struct Record {
+        quint32 partsOffset;
+        quint32 partsSize;
+        quint32 containersOffset;
+        quint32 containersSize;
+    };
+    static_assert(sizeof(Record) == 16);
+
+private:
+    PooledArray<Record> m_records;  // one per item
+    PooledArray<quint32> m_pool;    // parts: item index / containers: item index << 12 | color index
+};
+
+} // namespace BrickLink
@@ -88,12 +88,14 @@ QString BrickLink::IO::toBrickLinkXML(const LotList &lots)
 }
 
 
-BrickLink::IO::ParseResult BrickLink::IO::fromBrickLinkXML(const QByteArray &data, Hint hint)
+namespace BrickLink {
+namespace IO {
+
+static ParseResult parseBrickLinkXML(QXmlStreamReader &xml, Hint hint)
 {
     //stopwatch loadXMLWatch("Load XML");
 
     ParseResult pr;
-    QXmlStreamReader xml(data);
     QString rootName = "INVENTORY"_l1;
     QHash<QStringView, std::function<void(ParseResult &pr, const QString &value)>> rootTagHash;
 
@@ -281,6 +283,22 @@ BrickLink::IO::ParseResult BrickLink::IO::fromBrickLinkXML(const QByteArray &dat
     }
 }
 
+} // namespace IO
+} // namespace BrickLink
+
+BrickLink::IO::ParseResult BrickLink::IO::fromBrickLinkXML(const QByteArray &data, Hint hint)
+{
+    QXmlStreamReader xml(data);
+    return parseBrickLinkXML(xml, hint);
+}
+
+BrickLink::IO::ParseResult BrickLink::IO::fromBrickLinkXML(QIODevice *device, Hint hint)
+{
+    // the device can be a StreamPipe, in which case we are parsing while the data is arriving
+    QXmlStreamReader xml(device);
+    return parseBrickLinkXML(xml, hint);
+}
+
 #if 0
 BrickLink::IO::ParseResult BrickLink::IO::fromBrickLinkXML(const QByteArray &xml)
 {
@@ -20,6 +20,8 @@
 #include "bricklink/global.h"
 #include "bricklink/lot.h"
 
+QT_FORWARD_DECLARE_CLASS(QIODevice)
+
 namespace BrickLink {
 namespace IO {
 
@@ -80,6 +82,7 @@ enum class Hint {
 
 QString toBrickLinkXML(const LotList &lots);
 ParseResult fromBrickLinkXML(const QByteArray &xml, Hint hint = Hint::Plain);
+ParseResult fromBrickLinkXML(QIODevice *device, Hint hint = Hint::Plain);
 
 } // namespace IO
 } // namespace BrickLink
@@ -34,17 +34,17 @@ void BrickLink::Item::setAppearsIn(const QHash<uint, QVector<QPair<int, uint>>>
 {
     // we are compacting a "hash of a vector of pairs" down to a list of 32bit integers
 
-    m_appears_in.clear();
+    std::vector<AppearsInRecord> appearsIn;
 
     for (auto it = appearHash.cbegin(); it != appearHash.cend(); ++it) {
         const auto &colorVector = it.value();
 
-        m_appears_in.push_back({ it.key() /*colorIndex*/, uint(colorVector.size()) /*vectorSize*/ });
+        appearsIn.push_back({ it.key() /*colorIndex*/, uint(colorVector.size()) /*vectorSize*/ });
 
         for (auto vecIt = colorVector.cbegin(); vecIt != colorVector.cend(); ++vecIt)
-            m_appears_in.push_back({ uint(vecIt->first) /*quantity*/, vecIt->second /*itemIndex*/ });
+            appearsIn.push_back({ uint(vecIt->first) /*quantity*/, vecIt->second /*itemIndex*/ });
     }
-    m_appears_in.shrink_to_fit();
+    m_appears_in = appearsIn;
 
     _dwords_for_appears += int(m_appears_in.size());
 }
@@ -88,11 +88,16 @@ void BrickLink::Item::setConsistsOf(const QVector<BrickLink::Item::ConsistsOf> &
     _qwords_for_consists += m_consists_of.size();
 }
 
-const QVector<BrickLink::Item::ConsistsOf> &BrickLink::Item::consistsOf() const
+const PooledArray<BrickLink::Item::ConsistsOf> &BrickLink::Item::consistsOf() const
 {
     return m_consists_of;
 }
 
+void BrickLink::Item::setKnownColors(const std::vector<quint16> &colorIndexes)
+{
+    m_knownColorIndexes = colorIndexes;
+}
+
 const BrickLink::ItemType *BrickLink::Item::itemType() const
 {
     return (m_itemTypeIndex != -1) ? &core()->itemTypes()[m_itemTypeIndex] : nullptr;
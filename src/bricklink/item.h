@@ -21,6 +21,7 @@
 #include "bricklink/category.h"
 #include "bricklink/color.h"
 #include "bricklink/itemtype.h"
+#include "utility/pooledarray.h"
 
 
 namespace BrickLink {
@@ -76,10 +77,11 @@ public:
 
         friend class TextImport;
         friend class Core;
+        friend class InventoryIndex;
     };
     Q_STATIC_ASSERT(sizeof(ConsistsOf) == 8);
 
-    const QVector<ConsistsOf> &consistsOf() const;
+    const PooledArray<ConsistsOf> &consistsOf() const;
 
     uint index() const;   // only for internal use (picture/priceguide hashes)
 
@@ -97,7 +99,7 @@ private:
     qint64     m_lastInventoryUpdate = -1;
     float      m_weight = 0;
     // 4 bytes padding here
-    std::vector<quint16> m_knownColorIndexes;
+    PooledArray<quint16> m_knownColorIndexes;
 
     struct AppearsInRecord {
 #if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
@@ -110,12 +112,13 @@ private:
     };
     Q_STATIC_ASSERT(sizeof(AppearsInRecord) == 4);
 
-    std::vector<AppearsInRecord> m_appears_in;
-    QVector<ConsistsOf> m_consists_of;
+    PooledArray<AppearsInRecord> m_appears_in;
+    PooledArray<ConsistsOf> m_consists_of;
 
 private:
     void setAppearsIn(const QHash<uint, QVector<QPair<int, uint>>> &appearHash);
     void setConsistsOf(const QVector<ConsistsOf> &items);
+    void setKnownColors(const std::vector<quint16> &colorIndexes);
 
 
     static int compare(const Item **a, const Item **b);
@@ -0,0 +1,164 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+
+#include <QtConcurrentRun>
+
+#include "bricklink/item.h"
+#include "bricklink/itemsearchindex.h"
+
+
+namespace BrickLink {
+
+static constexpr quint32 BucketCount = 1 << 18;
+
+template <typename F>
+class TrigramHasher
+{
+public:
+    TrigramHasher(F func)
+        : m_func(func)
+    { }
+
+    void add(char16_t c)
+    {
+        c = QChar(c).toCaseFolded().unicode();
+        if (m_count >= 2) {
+            quint32 h = (quint32(m_c1) * 0x9e3779b1u) ^ (quint32(m_c2) * 0x85ebca77u)
+                    ^ (quint32(c) * 0xc2b2ae3du);
+            m_func((h ^ (h >> 15)) & (BucketCount - 1));
+        }
+        m_c1 = m_c2;
+        m_c2 = c;
+        ++m_count;
+    }
+
+private:
+    F m_func;
+    char16_t m_c1 = 0;
+    char16_t m_c2 = 0;
+    int m_count = 0;
+};
+
+static void sortUnique(std::vector<quint32> &v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+
+ItemSearchIndex::ItemSearchIndex(const std::vector<Item> &items)
+    : m_items(items)
+{
+    m_builder = QtConcurrent::run([this]() { build(); });
+}
+
+ItemSearchIndex::~ItemSearchIndex()
+{
+    m_builder.waitForFinished();
+}
+
+void ItemSearchIndex::itemBuckets(const Item &item, std::vector<quint32> &buckets)
+{
+    buckets.clear();
+    TrigramHasher th([&buckets](quint32 bucket) { buckets.push_back(bucket); });
+
+    // this has to match the string that ItemModel::filterAccepts() is matching against
+    const QByteArray id = item.id();
+    for (char c : id)
+        th.add(char16_t(uchar(c)));
+    th.add(u' ');
+    const QString name = item.name();
+    for (QChar c : name)
+        th.add(c.unicode());
+
+    sortUnique(buckets);
+}
+
+void ItemSearchIndex::termBuckets(const QString &term, std::vector<quint32> &buckets)
+{
+    TrigramHasher th([&buckets](quint32 bucket) { buckets.push_back(bucket); });
+    for (QChar c : term)
+        th.add(c.unicode());
+}
+
+void ItemSearchIndex::build()
+{
+    // counting sort: count the postings per bucket first, then fill them in item order, so
+    // that each bucket's posting list ends up sorted without sorting it
+
+    std::vector<quint32> offsets(BucketCount + 1, 0);
+    std::vector<quint32> buckets;
+
+    for (const Item &item : m_items) {
+        itemBuckets(item, buckets);
+        for (quint32 bucket : buckets)
+            ++offsets[bucket + 1];
+    }
+    std::partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
+
+    m_postings.resize(offsets.back());
+    std::vector<quint32> fill(offsets.cbegin(), offsets.cend() - 1);
+
+    for (quint32 i = 0; i < m_items.size(); ++i) {
+        itemBuckets(m_items[i], buckets);
+        for (quint32 bucket : buckets)
+            m_postings[fill[bucket]++] = i;
+    }
+    m_offsets = std::move(offsets);
+}
+
+QBitArray ItemSearchIndex::filter(const QStringList &terms) const
+{
+    // never block the caller (usually the GUI thread) on the builder: without the index the
+    // caller just falls back to matching all the items
+    if (!m_builder.isFinished())
+        return { };
+
+    std::vector<quint32> buckets;
+    for (const QString &term : terms)
+        termBuckets(term, buckets);
+    sortUnique(buckets);
+
+    if (buckets.empty() || m_offsets.empty())
+        return { };
+
+    // intersect the posting lists, starting with the shortest one
+    auto listSize = [this](quint32 bucket) { return m_offsets[bucket + 1] - m_offsets[bucket]; };
+    std::sort(buckets.begin(), buckets.end(), [&listSize](quint32 b1, quint32 b2) {
+        return listSize(b1) < listSize(b2);
+    });
+
+    const quint32 *postings = m_postings.data();
+    std::vector<quint32> result(postings + m_offsets[buckets.front()],
+                                postings + m_offsets[buckets.front() + 1]);
+    std::vector<quint32> tmp;
+
+    for (auto it = buckets.cbegin() + 1; (it != buckets.cend()) && !result.empty(); ++it) {
+        tmp.clear();
+        std::set_intersection(result.cbegin(), result.cend(),
+                              postings + m_offsets[*it], postings + m_offsets[*it + 1],
+                              std::back_inserter(tmp));
+        std::swap(result, tmp);
+    }
+
+    QBitArray bits(int(m_items.size()));
+    for (quint32 i : result)
+        bits.setBit(int(i));
+    return bits;
+}
+
+} // namespace BrickLink
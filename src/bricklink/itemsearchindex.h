@@ -0,0 +1,55 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <vector>
+
+#include <QtCore/QBitArray>
+#include <QtCore/QFuture>
+#include <QtCore/QStringList>
+
+#include "bricklink/global.h"
+
+
+namespace BrickLink {
+
+// An inverted trigram index over the case-folded "<id> <name>" strings of all items.
+// Trigrams are hashed into a fixed number of buckets, so a lookup only ever yields candidates:
+// the caller still has to do the exact string match, but only for a tiny subset of all items.
+
+class ItemSearchIndex
+{
+public:
+    // The index is built in a background thread: the items must not change while this
+    // object is alive.
+    ItemSearchIndex(const std::vector<Item> &items);
+    ~ItemSearchIndex();
+
+    // Returns a bit for each item index, set if the item *might* contain all the terms.
+    // A null QBitArray is returned, if none of the terms is long enough to narrow down the search
+    // or if the index is still being built.
+    QBitArray filter(const QStringList &terms) const;
+
+private:
+    void build();
+    static void itemBuckets(const Item &item, std::vector<quint32> &buckets);
+    static void termBuckets(const QString &term, std::vector<quint32> &buckets);
+
+    const std::vector<Item> &m_items;
+    QFuture<void> m_builder;
+    std::vector<quint32> m_offsets;  // bucket -> first index into m_postings
+    std::vector<quint32> m_postings; // item indexes, sorted ascending within each bucket
+};
+
+} // namespace BrickLink
@@ -25,6 +25,7 @@
 #include "bricklink/core.h"
 #include "bricklink/category.h"
 #include "bricklink/item.h"
+#include "bricklink/itemsearchindex.h"
 #include "bricklink/picture.h"
 #include "bricklink/model.h"
 
@@ -591,11 +592,12 @@ void BrickLink::ItemModel::setFilterText(const QString &filter)
 
     m_text_filter = filter;
     m_filter_text.clear();
-    m_filter_appearsIn.clear();
-    m_filter_consistsOf.clear();
     m_filter_ids.second.clear();
     m_filter_ids.first = false;
 
+    QVector<QPair<bool, QPair<const Item *, const Color *>>> filterConsistsOf;
+    QVector<QPair<bool, const Item *>> filterAppearsIn;
+
     const QStringList sl = filter.simplified().split(' '_l1);
 
     QString quoted;
@@ -634,14 +636,14 @@ void BrickLink::ItemModel::setFilterText(const QString &filter)
                 }
 
                 if (auto item = BrickLink::core()->item("MP", str.toLatin1()))
-                    m_filter_consistsOf << qMakePair(negate, qMakePair(item, color));
+                    filterConsistsOf << qMakePair(negate, qMakePair(item, color));
 
             } else if (str.startsWith(s_appearsInPrefix)) {
                 str = str.mid(s_appearsInPrefix.length());
 
                 // appears-in either a minifig or a set
                 if (auto item = BrickLink::core()->item("MS", str.toLatin1()))
-                    m_filter_appearsIn << qMakePair(negate, item);
+                    filterAppearsIn << qMakePair(negate, item);
 
             } else if (str.startsWith(s_idPrefix)) {
                 str = str.mid(s_idPrefix.length());
@@ -669,6 +671,41 @@ void BrickLink::ItemModel::setFilterText(const QString &filter)
         }
     }
 
+    // let the trigram index pre-select the items that can possibly match all the positive
+    // text terms, so that filterAccepts() can skip the expensive string matching for most items
+    QStringList terms;
+    for (const auto &p : qAsConst(m_filter_text)) {
+        if (!p.first)
+            terms << p.second;
+    }
+    const auto *index = BrickLink::core()->itemSearchIndex();
+    m_filter_candidates = index ? index->filter(terms) : QBitArray { };
+
+    // the appears-in and consists-of filters are exact matches on the inventory index's
+    // posting lists, so they can be fully resolved here
+    const int itemCount = int(BrickLink::core()->items().size());
+    const auto &invIndex = BrickLink::core()->inventoryIndex();
+
+    auto restrictTo = [this, itemCount](const auto &itemIndexes, bool negate) {
+        if (m_filter_candidates.isNull())
+            m_filter_candidates.fill(true, itemCount);
+
+        if (negate) {
+            for (quint32 i : itemIndexes)
+                m_filter_candidates.clearBit(int(i));
+        } else {
+            QBitArray bits(itemCount);
+            for (quint32 i : itemIndexes)
+                bits.setBit(int(i));
+            m_filter_candidates &= bits;
+        }
+    };
+
+    for (const auto &a : qAsConst(filterAppearsIn))
+        restrictTo(invIndex.parts(a.second->index()), a.first);
+    for (const auto &c : qAsConst(filterConsistsOf))
+        restrictTo(invIndex.containers(c.second.first->index(), c.second.second), c.first);
+
     invalidateFilter();
 }
 
@@ -704,6 +741,8 @@ bool BrickLink::ItemModel::filterAccepts(const void *pointer) const
         return false;
     else if (m_color_filter && !item->hasKnownColor(m_color_filter))
         return false;
+    else if (!m_filter_candidates.isNull() && !m_filter_candidates.testBit(int(item->index())))
+        return false;
     else {
         const QString matchStr = QLatin1String(item->id()) % u' ' % item->name();
 
@@ -722,34 +761,6 @@ bool BrickLink::ItemModel::filterAccepts(const void *pointer) const
         }
         match = match && (idMatched == !m_filter_ids.first); // found xor negate
 
-        for (const auto &a : m_filter_appearsIn) {
-            bool found = false;
-            const auto appearsvec = item->appearsIn();
-            for (const AppearsInColor &vec : appearsvec) {
-                for (const AppearsInItem &ai : vec) {
-                    if (ai.second == a.second) {
-                        found = true;
-                        break;
-                    }
-                }
-                if (found)
-                    break;
-            }
-            match = match && (found == !a.first); // found xor negate
-        }
-        for (const auto &c : m_filter_consistsOf) {
-            bool found = false;
-            const auto &containslist = item->consistsOf();
-            for (const auto &ci : containslist) {
-                if ((ci.item() == c.second.first)
-                        && (!c.second.second || (ci.color() == c.second.second))) {
-                    found = true;
-                    break;
-                }
-            }
-            match = match && (found == !c.first); // found xor negate
-        }
-
         return match;
     }
 }
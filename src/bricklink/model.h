@@ -15,6 +15,7 @@
 
 #include <QAbstractListModel>
 #include <QSortFilterProxyModel>
+#include <QBitArray>
 
 #include "bricklink/color.h"
 #include "bricklink/itemtype.h"
@@ -173,9 +174,8 @@ private:
     const Color *   m_color_filter = nullptr;
     QString         m_text_filter;
     QVector<QPair<bool, QString>> m_filter_text;
-    QVector<QPair<bool, QPair<const Item *, const Color *>>> m_filter_consistsOf;
-    QVector<QPair<bool, const Item *>> m_filter_appearsIn;
     QPair<bool, QVector<const Item *>> m_filter_ids;
+    QBitArray       m_filter_candidates; // pre-selected via the search and inventory indexes
     bool            m_inv_filter = false;
     static QString  s_consistsOfPrefix;
     static QString  s_appearsInPrefix;
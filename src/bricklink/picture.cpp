@@ -14,10 +14,15 @@
 
 #include <QScopedPointer>
 #include <QFile>
+#include <QThread>
+#include <QCoreApplication>
 
 #include "bricklink/picture.h"
 #include "bricklink/item.h"
 #include "bricklink/core.h"
+#include "bricklink/picturecache.h"
+#include "bricklink/thumbnailpack.h"
+#include "bricklink/validatorstore.h"
 
 
 BrickLink::Picture::Picture(const Item *item, const Color *color)
@@ -32,19 +37,26 @@ BrickLink::Picture::Picture(const Item *item, const Color *color)
 BrickLink::Picture::~Picture()
 {
     cancelUpdate();
+    if (BrickLink::core() && BrickLink::core()->m_pictureCache)
+        BrickLink::core()->m_pictureCache->remove(this);
 }
 
-const QImage BrickLink::Picture::image() const
+const QImage BrickLink::Picture::image()
 {
+    Q_ASSERT(QThread::currentThread() == qApp->thread());
+
+    if (m_valid && BrickLink::core())
+        BrickLink::core()->restorePicture(this);
     return m_image;
 }
 
-int BrickLink::Picture::cost() const
+QString BrickLink::Picture::fileName() const
 {
-    if (m_image.isNull())
-        return 640*480*4 / 1024;      // ~ 640*480 32bpp
-    else
-        return m_image.sizeInBytes() / 1024;
+    bool large = (!m_color);
+    bool hasColors = m_item->itemType()->hasColors();
+
+    return core()->dataFileName(large ? u"large.jpg" : u"normal.png", m_item,
+                                (!large && hasColors) ? m_color : nullptr);
 }
 
 QFile *BrickLink::Picture::readFile() const
@@ -65,11 +77,20 @@ QSaveFile *BrickLink::Picture::saveFile() const
                                 (!large && hasColors) ? m_color : nullptr);
 }
 
-bool BrickLink::Picture::loadFromDisk(QDateTime &fetched, QImage &image)
+bool BrickLink::Picture::loadFromDisk(QDateTime &fetched, QImage &image, bool thumbnail,
+                                      QByteArray *compressed)
 {
     if (!m_item)
         return false;
 
+    // only the normal (colored) pictures are available as thumbnails
+    ThumbnailPack *pack = m_color ? core()->thumbnailPack() : nullptr;
+    const quint64 packKey = Core::persistentKey(m_item, m_color);
+    const QSize thumbnailSize = core()->standardPictureSize();
+
+    if (thumbnail && pack && pack->load(packKey, thumbnailSize, fetched, image))
+        return true;
+
     QScopedPointer<QFile> f(readFile());
 
     bool isValid = false;
@@ -88,8 +109,24 @@ bool BrickLink::Picture::loadFromDisk(QDateTime &fetched, QImage &image)
                 isValid = image.loadFromData(ba, "JPG");
             if (!isValid)
                 isValid = image.loadFromData(ba);
+            if (isValid && compressed)
+                *compressed = ba;
+        }
+        // prefer the exact time of the last download or revalidation over the file's timestamp
+        const auto validators = core()->validatorStore()->load(ValidatorStore::Kind::Picture,
+                                                               packKey);
+        fetched = validators.validated.isValid() ? validators.validated
+                                                 : f->fileTime(QFileDevice::FileModificationTime);
+    }
+
+    if (isValid && pack) {
+        if (thumbnail) {
+            image = pack->scaled(image, thumbnailSize);
+            pack->save(packKey, thumbnailSize, fetched, image);
+        } else if (!pack->contains(packKey, thumbnailSize, fetched)) {
+            // don't re-create an up-to-date thumbnail on every full resolution load
+            pack->save(packKey, thumbnailSize, fetched, pack->scaled(image, thumbnailSize));
         }
-        fetched = f->fileTime(QFileDevice::FileModificationTime);
     }
     return isValid;
 }
@@ -42,9 +42,8 @@ public:
     bool isValid() const              { return m_valid; }
     UpdateStatus updateStatus() const { return m_update_status; }
 
-    const QImage image() const;
-
-    int cost() const;
+    // main thread only: this marks the picture as recently used in the PictureCache
+    const QImage image();
 
     Picture(std::nullptr_t) : Picture(nullptr, nullptr) { } // for scripting only!
     ~Picture() override;
@@ -57,22 +56,26 @@ private:
 
     bool          m_valid;
     bool          m_updateAfterLoad;
-    // 2 bytes padding here
+    bool          m_isThumbnail = false; // the image has been scaled down to the standard size
+    // 1 byte padding here
     UpdateStatus  m_update_status;
 
     TransferJob * m_transferJob = nullptr;
 
-    QImage        m_image;
+    QImage        m_image; // might get evicted by the PictureCache
 
 private:
     Picture(const Item *item, const Color *color);
 
+    QString fileName() const;
     QFile *readFile() const;
     QSaveFile *saveFile() const;
-    bool loadFromDisk(QDateTime &fetched, QImage &image);
+    bool loadFromDisk(QDateTime &fetched, QImage &image, bool thumbnail = false,
+                      QByteArray *compressed = nullptr);
 
     friend class Core;
     friend class PictureLoaderJob;
+    friend class PictureCache;
 };
 
 } // namespace BrickLink
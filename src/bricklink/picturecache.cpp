@@ -0,0 +1,124 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include "bricklink/core.h"
+#include "bricklink/picture.h"
+#include "bricklink/thumbnailpack.h"
+#include "bricklink/picturecache.h"
+
+
+BrickLink::PictureCache::PictureCache(qint64 hotBudget, qint64 warmBudget)
+    : m_hotBudget(hotBudget)
+    , m_warm(int(warmBudget / 1024))
+{ }
+
+BrickLink::PictureCache::~PictureCache()
+{
+    clear();
+}
+
+BrickLink::PictureCache::Stats BrickLink::PictureCache::stats() const
+{
+    return { m_hotBytes, m_hotBudget, qint64(m_warm.totalCost()) * 1024,
+             qint64(m_warm.maxCost()) * 1024, m_hits, m_warmHits, m_misses, m_evictions };
+}
+
+void BrickLink::PictureCache::insert(Picture *pic, const QByteArray &compressed)
+{
+    remove(pic);
+
+    if (const qint64 bytes = pic->m_image.sizeInBytes()) {
+        m_lru.push_front(pic);
+        m_hot.insert(pic, { m_lru.begin(), bytes });
+        m_hotBytes += bytes;
+    }
+    if (!compressed.isEmpty()) {
+        m_warm.insert(Picture::key(pic->item(), pic->color()), new QByteArray(compressed),
+                      int(compressed.size() / 1024 + 1));
+    }
+    trim();
+}
+
+void BrickLink::PictureCache::remove(Picture *pic)
+{
+    auto it = m_hot.find(pic);
+    if (it != m_hot.end()) {
+        m_hotBytes -= it->bytes;
+        m_lru.erase(it->lruIt);
+        m_hot.erase(it);
+    }
+}
+
+void BrickLink::PictureCache::clear()
+{
+    m_lru.clear();
+    m_hot.clear();
+    m_hotBytes = 0;
+    m_warm.clear();
+}
+
+bool BrickLink::PictureCache::access(Picture *pic)
+{
+    auto it = m_hot.find(pic);
+    if (it != m_hot.end()) {
+        ++m_hits;
+        m_lru.splice(m_lru.begin(), m_lru, it->lruIt);
+        return true;
+    }
+    if (restore(pic)) {
+        ++m_warmHits;
+        insert(pic);
+        return true;
+    }
+    ++m_misses;
+    return false;
+}
+
+bool BrickLink::PictureCache::restore(Picture *pic)
+{
+    QImage img;
+
+    // thumbnails can be re-mapped from the pack, which is as fast as it gets
+    if (pic->m_isThumbnail && pic->color()) {
+        QDateTime fetched;
+        if (core()->thumbnailPack()->load(Core::persistentKey(pic->item(), pic->color()),
+                                          core()->standardPictureSize(), fetched, img)) {
+            pic->m_image = img;
+            return true;
+        }
+    }
+    if (const QByteArray *ba = m_warm.object(Picture::key(pic->item(), pic->color()))) {
+        if (img.loadFromData(*ba)) {
+            if (pic->m_isThumbnail)
+                img = core()->thumbnailPack()->scaled(img, core()->standardPictureSize());
+            pic->m_image = img;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BrickLink::PictureCache::trim()
+{
+    // the most recently used image always stays, even if it alone is over budget
+    while ((m_hotBytes > m_hotBudget) && (m_lru.size() > 1)) {
+        Picture *victim = m_lru.back();
+        auto it = m_hot.find(victim);
+        m_hotBytes -= it->bytes;
+        m_hot.erase(it);
+        m_lru.pop_back();
+
+        victim->m_image = QImage();
+        ++m_evictions;
+    }
+}
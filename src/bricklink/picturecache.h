@@ -0,0 +1,82 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <list>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+
+#include "bricklink/global.h"
+
+
+namespace BrickLink {
+
+// The memory management for the decoded picture images, in two tiers:
+//  * hot: the decoded QImages of the Picture objects, in LRU order. This tier has a strict byte
+//         budget: the images of the least recently used pictures are dropped, even if the
+//         Picture objects themselves are still referenced.
+//  * warm: the compressed image file data, so that re-decoding an evicted image doesn't need
+//          any disk access.
+// Dropped images are restored transparently when Picture::image() is called.
+// Only to be used from the main thread.
+
+class PictureCache
+{
+public:
+    PictureCache(qint64 hotBudget, qint64 warmBudget);
+    ~PictureCache();
+
+    struct Stats {
+        qint64  hotBytes;
+        qint64  hotBudget;
+        qint64  warmBytes;
+        qint64  warmBudget;
+        quint64 hits;       // image was still decoded
+        quint64 warmHits;   // image was re-decoded from memory
+        quint64 misses;     // image had to be re-loaded from disk
+        quint64 evictions;  // images dropped from the hot tier
+    };
+    Stats stats() const;
+
+    void insert(Picture *pic, const QByteArray &compressed = { });
+    void remove(Picture *pic);
+    void clear();
+
+    // Returns false, if the image could not be restored synchronously and has to be re-loaded
+    bool access(Picture *pic);
+
+private:
+    void trim();
+    bool restore(Picture *pic);
+
+    struct HotEntry {
+        std::list<Picture *>::iterator lruIt;
+        qint64 bytes;
+    };
+    std::list<Picture *> m_lru; // most recently used first
+    QHash<Picture *, HotEntry> m_hot;
+    qint64 m_hotBytes = 0;
+    qint64 m_hotBudget;
+
+    QCache<quint64, QByteArray> m_warm; // cost in KB
+
+    quint64 m_hits = 0;
+    quint64 m_warmHits = 0;
+    quint64 m_misses = 0;
+    quint64 m_evictions = 0;
+};
+
+} // namespace BrickLink
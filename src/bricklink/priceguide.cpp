@@ -15,11 +15,11 @@
 #include <QtCore/QScopedPointer>
 #include <QtCore/QLocale>
 #include <QtCore/QFile>
-#include <QtCore/QSaveFile>
 #include <QtCore/QTextStream>
 #include <QtCore/QRegularExpression>
 
 #include "bricklink/priceguide.h"
+#include "bricklink/priceguidestore.h"
 #include "bricklink/core.h"
 #include "bricklink/item.h"
 #include "bricklink/color.h"
@@ -44,27 +44,7 @@ BrickLink::PriceGuide::~PriceGuide()
 
 void BrickLink::PriceGuide::saveToDisk(const QDateTime &fetched, const Data &data)
 {
-    QScopedPointer<QSaveFile> f(core()->dataSaveFile(u"priceguide.txt", m_item, m_color));
-
-    if (f && f->isOpen()) {
-        QTextStream ts(f.data());
-
-        ts << "# Price Guide for part #" << m_item->id() << " (" << m_item->name() << "), color #" << m_color->id() << " (" << m_color->name() << ")\n";
-        ts << "# last update: " << fetched.toString() << "\n#\n";
-
-        for (int ti = 0; ti < int(Time::Count); ti++) {
-            for (int ci = 0; ci < int(Condition::Count); ci++) {
-                ts << (ti == int(Time::PastSix) ? 'O' : 'I') << '\t' << (ci == int(Condition::New) ? 'N' : 'U') << '\t'
-                   << data.lots[ti][ci] << '\t'
-                   << data.quantities[ti][ci] << '\t'
-                   << QString::number(data.prices[ti][ci][int(Price::Lowest)], 'f', 3) << '\t'
-                   << QString::number(data.prices[ti][ci][int(Price::Average)], 'f', 3) << '\t'
-                   << QString::number(data.prices[ti][ci][int(Price::WAverage)], 'f', 3) << '\t'
-                   << QString::number(data.prices[ti][ci][int(Price::Highest)], 'f', 3) << '\n';
-            }
-        }
-        f->commit();
-    }
+    core()->priceGuideStore()->save(Core::persistentKey(m_item, m_color), fetched, data);
 }
 
 bool BrickLink::PriceGuide::loadFromDisk(QDateTime &fetched, Data &data) const
@@ -72,11 +52,19 @@ bool BrickLink::PriceGuide::loadFromDisk(QDateTime &fetched, Data &data) const
     if (!m_item || !m_color)
         return false;
 
+    auto store = core()->priceGuideStore();
+    const quint64 key = Core::persistentKey(m_item, m_color);
+
+    if (store->load(key, fetched, data))
+        return true;
+
+    // fall back to the per-item text files written by older versions and move them over
     QScopedPointer<QFile> f(core()->dataReadFile(u"priceguide.txt", m_item, m_color));
 
     if (f && f->isOpen()) {
         if (parse(f->readAll(), data)) {
             fetched = f->fileTime(QFileDevice::FileModificationTime);
+            store->save(key, fetched, data);
             return true;
         }
     }
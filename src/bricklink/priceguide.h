@@ -75,6 +75,7 @@ private:
 
     friend class Core;
     friend class PriceGuideLoaderJob;
+    friend class PriceGuideStore;
 };
 
 } // namespace BrickLink
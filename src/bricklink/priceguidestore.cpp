@@ -0,0 +1,43 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include "bricklink/priceguidestore.h"
+
+
+static const quint32 PriceGuideStoreMagic = 0x47505342; // 'BSPG'
+static const quint32 PriceGuideStoreVersion = 1;
+
+
+BrickLink::PriceGuideStore::PriceGuideStore(const QString &fileName)
+    : m_records(fileName, "PriceGuideStore", PriceGuideStoreMagic, PriceGuideStoreVersion)
+{ }
+
+bool BrickLink::PriceGuideStore::load(quint64 key, QDateTime &fetched, PriceGuide::Data &data)
+{
+    Record r;
+    if (!m_records.load(key, r))
+        return false;
+
+    fetched = QDateTime::fromMSecsSinceEpoch(r.fetched);
+    data = r.data;
+    return true;
+}
+
+bool BrickLink::PriceGuideStore::save(quint64 key, const QDateTime &fetched, const PriceGuide::Data &data)
+{
+    Record r;
+    r.key = key;
+    r.fetched = fetched.toMSecsSinceEpoch();
+    r.data = data;
+    return m_records.save(r);
+}
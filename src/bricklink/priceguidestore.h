@@ -0,0 +1,49 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include "bricklink/priceguide.h"
+#include "utility/recordfile.h"
+
+
+namespace BrickLink {
+
+// A single, append-only file of fixed-size price guide records, replacing the old per-item
+// and color priceguide.txt files. Updating a price guide appends a new record; the in-memory
+// index always points to the newest one.
+// All functions are thread-safe.
+
+class PriceGuideStore
+{
+public:
+    PriceGuideStore(const QString &fileName);
+
+    // use Core::persistentKey(): the in-memory cache keys change with every database update
+    bool load(quint64 key, QDateTime &fetched, PriceGuide::Data &data);
+    bool save(quint64 key, const QDateTime &fetched, const PriceGuide::Data &data);
+
+private:
+    struct Record {
+        quint64 key;
+        qint64 fetched; // msecs since epoch
+        PriceGuide::Data data;
+
+        quint64 indexKey() const  { return key; }
+    };
+    static_assert(sizeof(Record) == 176);
+
+    RecordFile<Record, quint64> m_records;
+};
+
+} // namespace BrickLink
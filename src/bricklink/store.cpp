@@ -14,8 +14,10 @@
 
 #include <QUrl>
 #include <QUrlQuery>
+#include <QtConcurrentRun>
 
 #include "utility/utility.h"
+#include "utility/streampipe.h"
 #include "utility/transfer.h"
 #include "utility/exception.h"
 #include "bricklink/core.h"
@@ -26,6 +28,8 @@
 BrickLink::Store::Store(QObject *parent)
     : QObject(parent)
 {
+    m_parserPool.setMaxThreadCount(1);
+
     connect(core(), &Core::authenticatedTransferStarted,
             this, [this](TransferJob *job) {
         if ((m_updateStatus == UpdateStatus::Updating) && (m_job == job))
@@ -39,20 +43,27 @@ BrickLink::Store::Store(QObject *parent)
     connect(core(), &Core::authenticatedTransferFinished,
             this, [this](TransferJob *job) {
         if ((m_updateStatus == UpdateStatus::Updating) && (m_job == job)) {
-            bool success = job->isCompleted() && (job->responseCode() == 200) && job->data();
+            bool success = job->isCompleted() && (job->responseCode() == 200);
             QString message;
-            if (success) {
-                try {
-                    auto result = IO::fromBrickLinkXML(*job->data(), IO::Hint::Store);
-                    m_lots = result.takeLots();
-                    m_currencyCode = result.currencyCode();
-                    m_valid = true;
-                } catch (const Exception &e) {
-                    success = false;
-                    message = tr("Failed to import the store inventory") % u": " % e.error();
-                }
-            } else {
+
+            // most of the XML has been parsed already, we just have to wait for the rest
+            auto *pipe = static_cast<StreamPipe *>(job->file());
+            if (success)
+                pipe->closeWriteChannel();
+            else
+                pipe->abort(job->errorString());
+            auto parsed = m_parser.result();
+
+            if (!success) {
                 message = tr("Failed to download the store inventory") % u": " % job->errorString();
+                qDeleteAll(parsed.lots);
+            } else if (!parsed.error.isEmpty()) {
+                success = false;
+                message = tr("Failed to import the store inventory") % u": " % parsed.error;
+            } else {
+                m_lots = parsed.lots;
+                m_currencyCode = parsed.currencyCode;
+                m_valid = true;
             }
             m_updateStatus = success ? UpdateStatus::Ok : UpdateStatus::UpdateFailed;
             emit updateFinished(success, message);
@@ -63,6 +74,11 @@ BrickLink::Store::Store(QObject *parent)
 
 BrickLink::Store::~Store()
 {
+    // the parser thread is still blocked on the job's pipe
+    if (m_job && m_parser.isRunning()) {
+        static_cast<StreamPipe *>(m_job->file())->abort({ });
+        qDeleteAll(m_parser.result().lots);
+    }
     qDeleteAll(m_lots);
 }
 
@@ -90,7 +106,23 @@ bool BrickLink::Store::startUpdate()
     query.addQueryItem("invDesc"_l1,       ""_l1);
     url.setQuery(query);
 
-    m_job = TransferJob::post(url);
+    // the inventory can be huge: parse it while it is downloading, instead of buffering it
+    auto *pipe = new StreamPipe();
+    m_parser = QtConcurrent::run(&m_parserPool, [pipe]() {
+        ParsedInventory parsed;
+        try {
+            auto result = IO::fromBrickLinkXML(pipe, IO::Hint::Store);
+            parsed.lots = result.takeLots();
+            parsed.currencyCode = result.currencyCode();
+        } catch (const Exception &e) {
+            parsed.error = e.error();
+            // nobody is reading anymore, so just drop the rest of the download
+            pipe->abort(e.error());
+        }
+        return parsed;
+    });
+
+    m_job = TransferJob::post(url, pipe);
     core()->retrieveAuthenticated(m_job);
     return true;
 }
@@ -15,6 +15,8 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QDateTime>
+#include <QtCore/QFuture>
+#include <QtCore/QThreadPool>
 
 #include "global.h"
 #include "lot.h"
@@ -56,6 +58,15 @@ private:
     bool m_valid = false;
     BrickLink::UpdateStatus m_updateStatus = BrickLink::UpdateStatus::UpdateFailed;
     TransferJob *m_job = nullptr;
+
+    struct ParsedInventory
+    {
+        LotList lots;
+        QString currencyCode;
+        QString error;
+    };
+    QFuture<ParsedInventory> m_parser; // runs while the inventory is being downloaded
+    QThreadPool m_parserPool; // the parser blocks while waiting for data: not in the global pool
     LotList m_lots;
     QDateTime m_lastUpdated;
     QString m_currencyCode;
@@ -13,12 +13,16 @@
 */
 #include <cstdlib>
 #include <ctime>
+#include <iterator>
 
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QTextStream>
 #include <QtCore/QtDebug>
 #include <QtCore/QTimeZone>
+#include <QtCore/QFuture>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "utility/exception.h"
 #include "utility/xmlhelpers.h"
@@ -80,11 +84,38 @@ bool BrickLink::TextImport::import(const QString &path)
         // itemtypes
         readItemTypes(path % u"itemtypes.xml");
 
-        // speed up loading (exactly 137522 items on 16.06.2020)
-        m_items.reserve(200000);
+        // the item files are independent of each other, so they can be parsed in parallel
+        std::vector<std::vector<Item>> itemsPerType(m_item_types.size());
+        std::vector<QString> errorsPerType(m_item_types.size());
+        QVector<QFuture<void>> futures;
+
+        for (uint i = 0; i < m_item_types.size(); ++i) {
+            futures << QtConcurrent::run([this, i, &path, &itemsPerType, &errorsPerType]() {
+                ItemType *itt = &m_item_types[i];
+                try {
+                    itemsPerType[i] = readItems(path % u"items_" % QLatin1Char(itt->m_id) % u".xml", itt);
+                } catch (const Exception &e) {
+                    errorsPerType[i] = e.error();
+                }
+            });
+        }
+        for (auto &future : futures)
+            future.waitForFinished();
+        for (const auto &error : errorsPerType) {
+            if (!error.isEmpty())
+                throw Exception(error);
+        }
 
-        for (ItemType &itt : m_item_types)
-            readItems(path % u"items_" % QLatin1Char(itt.m_id) % u".xml", &itt);
+        size_t itemCount = 0;
+        for (const auto &items : itemsPerType)
+            itemCount += items.size();
+        m_items.reserve(itemCount);
+        for (auto &items : itemsPerType)
+            std::move(items.begin(), items.end(), std::back_inserter(m_items));
+
+        std::sort(m_items.begin(), m_items.end(), [](const auto &item1, const auto &item2) {
+            return Item::lessThan(item1, std::make_pair(item2.itemTypeId(), item2.id()));
+        });
 
         readPartColorCodes(path % u"part_color_codes.xml");
         readInventoryList(path % u"btinvlist.csv");
@@ -101,7 +132,7 @@ bool BrickLink::TextImport::import(const QString &path)
 void BrickLink::TextImport::readColors(const QString &path)
 {
     XmlHelpers::ParseXML p(path, "CATALOG", "ITEM");
-    p.parse([this, &p](QDomElement e) {
+    p.parseStream([this, &p](const XmlHelpers::ParseXML::Fields &e) {
         Color col;
         uint colid = p.elementText(e, "COLOR").toUInt();
 
@@ -150,7 +181,7 @@ void BrickLink::TextImport::readColors(const QString &path)
 void BrickLink::TextImport::readCategories(const QString &path)
 {
     XmlHelpers::ParseXML p(path, "CATALOG", "ITEM");
-    p.parse([this, &p](QDomElement e) {
+    p.parseStream([this, &p](const XmlHelpers::ParseXML::Fields &e) {
         Category cat;
         uint catid = p.elementText(e, "CATEGORY").toUInt();
 
@@ -169,7 +200,7 @@ void BrickLink::TextImport::readCategories(const QString &path)
 void BrickLink::TextImport::readItemTypes(const QString &path)
 {
     XmlHelpers::ParseXML p(path, "CATALOG", "ITEM");
-    p.parse([this, &p](QDomElement e) {
+    p.parseStream([this, &p](const XmlHelpers::ParseXML::Fields &e) {
         ItemType itt;
         char c = XmlHelpers::firstCharInString(p.elementText(e, "ITEMTYPE"));
 
@@ -194,14 +225,17 @@ void BrickLink::TextImport::readItemTypes(const QString &path)
     });
 }
 
-void BrickLink::TextImport::readItems(const QString &path, BrickLink::ItemType *itt)
+std::vector<BrickLink::Item> BrickLink::TextImport::readItems(const QString &path,
+                                                           BrickLink::ItemType *itt) const
 {
+    std::vector<Item> items;
+
     XmlHelpers::ParseXML p(path, "CATALOG", "ITEM");
-    p.parse([this, &p, itt](QDomElement e) {
+    p.parseStream([this, &p, itt, &items](const XmlHelpers::ParseXML::Fields &e) {
         Item item;
         item.m_id = p.elementText(e, "ITEMID").toLatin1();
         item.m_name = p.elementText(e, "ITEMNAME");
-        item.m_itemTypeIndex = (itt - m_item_types.data());
+        item.m_itemTypeIndex = qint16(itt - m_item_types.data());
         item.m_itemTypeId = itt->id();
 
         uint catId = p.elementText(e, "CATEGORY").toUInt();
@@ -232,18 +266,15 @@ void BrickLink::TextImport::readItems(const QString &path, BrickLink::ItemType *
             item.m_defaultColorIndex = -1;
         }
 
-        m_items.push_back(item);
-    });
-
-    std::sort(m_items.begin(), m_items.end(), [](const auto &item1, const auto &item2) {
-        return Item::lessThan(item1, std::make_pair(item2.itemTypeId(), item2.id()));
+        items.push_back(item);
     });
+    return items;
 }
 
 void BrickLink::TextImport::readPartColorCodes(const QString &path)
 {
     XmlHelpers::ParseXML p(path, "CODES", "ITEM");
-    p.parse([this, &p](QDomElement e) {
+    p.parseStream([this, &p](const XmlHelpers::ParseXML::Fields &e) {
         char itemTypeId = XmlHelpers::firstCharInString(p.elementText(e, "ITEMTYPE"));
         const QByteArray itemId = p.elementText(e, "ITEMID").toLatin1();
         const QString colorName = p.elementText(e, "COLOR");
@@ -286,28 +317,58 @@ void BrickLink::TextImport::readPartColorCodes(const QString &path)
 
 bool BrickLink::TextImport::importInventories(std::vector<bool> &processedInvs)
 {
+    struct InventoryJob {
+        uint itemIndex;
+        bool ok;
+        QVector<Item::ConsistsOf> inventory;
+    };
+    QVector<InventoryJob> jobs;
+
     for (uint i = 0; i < m_items.size(); ++i) {
         if (processedInvs[i]) // already yanked
             continue;
 
-        if (!m_items[i].hasInventory() || readInventory(&m_items[i]))
+        if (!m_items[i].hasInventory())
             processedInvs[i] = true;
+        else
+            jobs.append({ i, false, { } });
+    }
+
+    // parsing is done in parallel, with each job filling its own buffer. The results are
+    // merged afterwards in item order, so the output doesn't depend on the thread scheduling
+    QtConcurrent::blockingMap(jobs, [this](InventoryJob &job) {
+        job.ok = readInventory(&m_items[job.itemIndex], job.inventory);
+    });
+
+    for (const InventoryJob &job : qAsConst(jobs)) {
+        if (!job.ok)
+            continue;
+
+        for (const Item::ConsistsOf &co : job.inventory) {
+            addToKnownColors(co.m_itemIndex, co.m_colorIndex);
+
+            if (!co.m_extra) {
+                auto &vec = m_appears_in_hash[co.m_itemIndex][co.m_colorIndex];
+                vec.append(qMakePair(co.quantity(), job.itemIndex));
+            }
+        }
+        // the hash owns the items now
+        m_consists_of_hash.insert(job.itemIndex, job.inventory);
+        processedInvs[job.itemIndex] = true;
     }
     return true;
 }
 
-bool BrickLink::TextImport::readInventory(const Item *item)
+bool BrickLink::TextImport::readInventory(const Item *item, QVector<Item::ConsistsOf> &inventory) const
 {
     std::unique_ptr<QFile> f(BrickLink::core()->dataReadFile(u"inventory.xml", item));
 
     if (!f || !f->isOpen() || (f->fileTime(QFileDevice::FileModificationTime) < item->inventoryUpdated()))
         return false;
 
-    QVector<Item::ConsistsOf> inventory;
-
     try {
         XmlHelpers::ParseXML p(f.release(), "INVENTORY", "ITEM");
-        p.parse([this, &p, &inventory](QDomElement e) {
+        p.parseStream([this, &p, &inventory](const XmlHelpers::ParseXML::Fields &e) {
             char itemTypeId = XmlHelpers::firstCharInString(p.elementText(e, "ITEMTYPE"));
             const QByteArray itemId = p.elementText(e, "ITEMID").toLatin1();
             uint colorId = p.elementText(e, "COLOR").toUInt();
@@ -333,23 +394,11 @@ bool BrickLink::TextImport::readInventory(const Item *item)
             co.m_cpart = counterPart;
 
             inventory.append(co);
-
-            addToKnownColors(itemIndex, colorIndex);
         });
-
-        uint itemIndex = item - items().data();;
-
-        for (const Item::ConsistsOf &co : qAsConst(inventory)) {
-            if (!co.m_extra) {
-                auto &vec = m_appears_in_hash[co.m_itemIndex][co.m_colorIndex];
-                vec.append(qMakePair(co.quantity(), itemIndex));
-            }
-        }
-        // the hash owns the items now
-        m_consists_of_hash.insert(itemIndex, inventory);
         return true;
 
     } catch (const Exception &) {
+        inventory.clear();
         return false;
     }
 }
@@ -513,10 +562,13 @@ void BrickLink::TextImport::exportTo(Core *bl)
     std::swap(bl->m_item_types, m_item_types);
     std::swap(bl->m_categories, m_categories);
     std::swap(bl->m_items, m_items);
-    std::swap(bl->m_pccs, m_pccs);
+    bl->m_pccs = m_pccs;
     std::swap(bl->m_itemChangelog, m_itemChangelog);
     std::swap(bl->m_colorChangelog, m_colorChangelog);
 
+    for (uint i = 0; i < m_known_colors.size(); ++i)
+        bl->m_items[i].setKnownColors(m_known_colors[i]);
+
     for (auto it = m_consists_of_hash.cbegin(); it != m_consists_of_hash.cend(); ++it) {
         Item &item = bl->m_items[it.key()];
         item.setConsistsOf(it.value());
@@ -526,6 +578,8 @@ void BrickLink::TextImport::exportTo(Core *bl)
         Item &item = bl->m_items[it.key()];
         item.setAppearsIn(it.value());
     }
+
+    bl->m_inventoryIndex = InventoryIndex(bl->m_items);
 }
 
 void BrickLink::TextImport::calculateColorPopularity()
@@ -545,10 +599,12 @@ void BrickLink::TextImport::calculateColorPopularity()
 
 void BrickLink::TextImport::addToKnownColors(int itemIndex, int colorIndex)
 {
-    Item &item = m_items[itemIndex];
-    auto it = std::lower_bound(item.m_knownColorIndexes.begin(), item.m_knownColorIndexes.end(),
-                               colorIndex);
-    if ((it == item.m_knownColorIndexes.end()) || (*it != colorIndex))
-        item.m_knownColorIndexes.insert(it, colorIndex);
+    if (m_known_colors.size() < m_items.size())
+        m_known_colors.resize(m_items.size());
+
+    auto &knownColors = m_known_colors[itemIndex];
+    auto it = std::lower_bound(knownColors.begin(), knownColors.end(), colorIndex);
+    if ((it == knownColors.end()) || (*it != colorIndex))
+        knownColors.insert(it, quint16(colorIndex));
 }
 
@@ -44,9 +44,9 @@ private:
     void readColors(const QString &path);
     void readCategories(const QString &path);
     void readItemTypes(const QString &path);
-    void readItems(const QString &path, ItemType *itt);
+    std::vector<Item> readItems(const QString &path, ItemType *itt) const;
     void readPartColorCodes(const QString &path);
-    bool readInventory(const Item *item);
+    bool readInventory(const Item *item, QVector<Item::ConsistsOf> &inventory) const;
     void readLDrawColors(const QString &path);
     void readInventoryList(const QString &path);
     void readChangeLog(const QString &path);
@@ -71,6 +71,8 @@ private:
     QHash<uint, QHash<uint, QVector<QPair<int, uint>>>> m_appears_in_hash;
     // item-idx -> { vector < consists-of > }
     QHash<uint, QVector<Item::ConsistsOf>>   m_consists_of_hash;
+    // item-idx -> { sorted vector < color-idx > }
+    std::vector<std::vector<quint16>> m_known_colors;
 };
 
 } // namespace BrickLink
@@ -0,0 +1,495 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <QtCore/QSaveFile>
+#include <QtCore/QDebug>
+
+#include "bricklink/thumbnailpack.h"
+
+
+static const quint32 ThumbnailPackMagic = 0x50545342; // 'BSTP'
+static const quint32 ThumbnailPackVersion = 1;
+
+// no need to grow beyond this: the in-memory picture cache is way smaller anyway
+static const qint64 MaxPackSize = 512 * 1024 * 1024;
+// if compacting fails, the pack keeps on growing up to this size and gets cleaned up on the
+// next start
+static const qint64 HardMaxPackSize = 2 * MaxPackSize;
+
+
+BrickLink::ThumbnailPack::ThumbnailPack(const QString &fileName, qreal devicePixelRatio)
+    : m_fileName(fileName)
+    , m_file(new QFile(fileName))
+    , m_dpr(devicePixelRatio > 0 ? devicePixelRatio : 1)
+    , m_mappedImages(new QAtomicInt(0))
+{ }
+
+BrickLink::ThumbnailPack::~ThumbnailPack()
+{
+    // the mappings are released when the files are closed
+    m_file->close();
+}
+
+qreal BrickLink::ThumbnailPack::devicePixelRatio() const
+{
+    return m_dpr.load();
+}
+
+void BrickLink::ThumbnailPack::setDevicePixelRatio(qreal dpr)
+{
+    // the existing thumbnails for the old ratio are just misses from now on and get replaced
+    m_dpr.store(dpr > 0 ? dpr : 1);
+}
+
+QSize BrickLink::ThumbnailPack::pixelSize(const QSize &size) const
+{
+    return (QSizeF(size) * m_dpr.load()).toSize();
+}
+
+QImage BrickLink::ThumbnailPack::scaled(const QImage &image, const QSize &size) const
+{
+    const QSize s = pixelSize(size);
+    QImage img = image;
+    if ((img.width() > s.width()) || (img.height() > s.height()))
+        img = img.scaled(s, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+qint64 BrickLink::ThumbnailPack::entrySize(const EntryHeader &eh)
+{
+    // keep all the entries 16 byte aligned
+    return (qint64(sizeof(EntryHeader)) + eh.dataSize + 15) & ~qint64(15);
+}
+
+void BrickLink::ThumbnailPack::releaseMappedImage(void *mappedImages)
+{
+    static_cast<QAtomicInt *>(mappedImages)->deref();
+}
+
+bool BrickLink::ThumbnailPack::readEntryHeaderAt(qint64 offset, EntryHeader &eh)
+{
+    // all entries found while indexing are completely inside the mapped area
+    if (m_map && (offset < m_mappedSize)) {
+        eh = *reinterpret_cast<const EntryHeader *>(m_map + offset);
+        return true;
+    }
+    return m_file->seek(offset)
+            && (m_file->read(reinterpret_cast<char *>(&eh), sizeof(eh)) == qint64(sizeof(eh)));
+}
+
+bool BrickLink::ThumbnailPack::readEntryHeader(quint64 key, qint64 &offset, EntryHeader &eh)
+{
+    auto it = m_index.constFind(key);
+    if (it == m_index.cend())
+        return false;
+
+    offset = it.value();
+    return readEntryHeaderAt(offset, eh) && (eh.key == key) && eh.dataSize;
+}
+
+bool BrickLink::ThumbnailPack::load(quint64 key, const QSize &size, QDateTime &fetched, QImage &image)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!open())
+        return false;
+    releaseRetiredFiles();
+
+    qint64 offset;
+    EntryHeader eh;
+    if (!readEntryHeader(key, offset, eh)
+            || (QSize(eh.thumbnailWidth, eh.thumbnailHeight) != pixelSize(size))) {
+        return false;
+    }
+
+    if (m_map && (offset < m_mappedSize)) {
+        // read-only QImage on top of the mapped pixels: this is not a copy
+        m_mappedImages->ref();
+        image = QImage(m_map + offset + sizeof(EntryHeader), eh.width, eh.height,
+                       int(eh.bytesPerLine), QImage::Format_ARGB32_Premultiplied,
+                       releaseMappedImage, m_mappedImages.get());
+    } else {
+        // this entry was appended after mapping the file: the file is positioned at its data
+        QImage img(eh.width, eh.height, QImage::Format_ARGB32_Premultiplied);
+        if ((img.bytesPerLine() != int(eh.bytesPerLine)) || (img.sizeInBytes() != qsizetype(eh.dataSize))
+                || (m_file->read(reinterpret_cast<char *>(img.bits()), eh.dataSize) != qint64(eh.dataSize))) {
+            return false;
+        }
+        image = img;
+    }
+    fetched = QDateTime::fromMSecsSinceEpoch(eh.fetched);
+    return true;
+}
+
+bool BrickLink::ThumbnailPack::contains(quint64 key, const QSize &size, const QDateTime &fetched)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!open())
+        return false;
+
+    qint64 offset;
+    EntryHeader eh;
+    return readEntryHeader(key, offset, eh)
+            && (QSize(eh.thumbnailWidth, eh.thumbnailHeight) == pixelSize(size))
+            && (eh.fetched == fetched.toMSecsSinceEpoch());
+}
+
+void BrickLink::ThumbnailPack::save(quint64 key, const QSize &size, const QDateTime &fetched,
+                                    const QImage &image)
+{
+    if (image.isNull() || (image.format() != QImage::Format_ARGB32_Premultiplied))
+        return;
+
+    QMutexLocker locker(&m_mutex);
+
+    if (!open())
+        return;
+    releaseRetiredFiles();
+
+    EntryHeader eh = { };
+    eh.key = key;
+    eh.fetched = fetched.toMSecsSinceEpoch();
+    eh.thumbnailWidth = quint16(pixelSize(size).width());
+    eh.thumbnailHeight = quint16(pixelSize(size).height());
+    eh.width = quint16(image.width());
+    eh.height = quint16(image.height());
+    eh.bytesPerLine = quint32(image.bytesPerLine());
+    eh.dataSize = quint32(image.sizeInBytes());
+
+    const qint64 size16 = entrySize(eh);
+
+    if ((m_fileSize + size16) > MaxPackSize) {
+        // make room by evicting the oldest thumbnails
+        if (!compact(MaxPackSize / 2) && !m_file->isOpen())
+            return;
+        if ((m_fileSize + size16) > HardMaxPackSize)
+            return;
+    }
+    if (append(eh, image.constBits()))
+        m_liveSize += size16;
+}
+
+void BrickLink::ThumbnailPack::remove(quint64 key)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!open() || !m_index.contains(key))
+        return;
+
+    qint64 offset;
+    EntryHeader eh;
+    if (readEntryHeader(key, offset, eh))
+        m_liveSize -= entrySize(eh);
+
+    // append an empty entry, so that the removal survives a restart
+    EntryHeader removed = { };
+    removed.key = key;
+    append(removed, nullptr);
+    m_index.remove(key);
+}
+
+void BrickLink::ThumbnailPack::setFetched(quint64 key, const QDateTime &fetched)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!open())
+        return;
+
+    qint64 offset;
+    EntryHeader eh;
+    if (!readEntryHeader(key, offset, eh))
+        return;
+
+    // the picture itself is unchanged, so just update the entry in place: the shared mapping
+    // picks up the new value as well
+    const qint64 fetchedMSecs = fetched.toMSecsSinceEpoch();
+    if (!m_file->seek(offset + qint64(offsetof(EntryHeader, fetched)))
+            || (m_file->write(reinterpret_cast<const char *>(&fetchedMSecs), sizeof(fetchedMSecs))
+                != qint64(sizeof(fetchedMSecs)))) {
+        qWarning() << "ThumbnailPack: could not update" << m_file->fileName() << ":"
+                   << m_file->errorString();
+    }
+}
+
+bool BrickLink::ThumbnailPack::append(const EntryHeader &eh, const uchar *data)
+{
+    const qint64 offset = m_fileSize;
+    const qint64 size16 = entrySize(eh);
+    QByteArray padding(int(size16 - qint64(sizeof(EntryHeader)) - eh.dataSize), 0);
+
+    if (!m_file->seek(offset)
+            || (m_file->write(reinterpret_cast<const char *>(&eh), sizeof(eh)) != qint64(sizeof(eh)))
+            || (m_file->write(reinterpret_cast<const char *>(data), eh.dataSize) != qint64(eh.dataSize))
+            || (m_file->write(padding) != padding.size())) {
+        qWarning() << "ThumbnailPack: could not append to" << m_file->fileName() << ":"
+                   << m_file->errorString();
+        m_file->resize(offset); // do not leave a partial entry behind
+        return false;
+    }
+    m_fileSize = offset + size16;
+    m_index.insert(eh.key, offset);
+    return true;
+}
+
+bool BrickLink::ThumbnailPack::open()
+{
+    if (m_opened)
+        return m_file->isOpen();
+    m_opened = true;
+
+    adoptCompactedFile();
+
+    if (!m_file->open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        qWarning() << "ThumbnailPack: could not open" << m_file->fileName() << ":"
+                   << m_file->errorString();
+        return false;
+    }
+
+    Header header;
+    if ((m_file->read(reinterpret_cast<char *>(&header), sizeof(header)) != qint64(sizeof(header)))
+            || (header.magic != ThumbnailPackMagic)
+            || (header.version != ThumbnailPackVersion)) {
+        return reset();
+    }
+    if (!mapAndIndex())
+        return reset();
+
+    // get rid of superseded entries, if they are taking up most of the space, and make room
+    // for this session's new thumbnails, if the pack is getting too big
+    if ((((m_fileSize - m_liveSize) > 16 * 1024 * 1024) && ((m_fileSize - m_liveSize) > m_liveSize))
+            || (m_liveSize > (MaxPackSize / 2))) {
+        if (!compact(MaxPackSize / 2))
+            return reset();
+    }
+    return true;
+}
+
+void BrickLink::ThumbnailPack::adoptCompactedFile()
+{
+    // the last session might have compacted the pack into the second file: nothing is mapped
+    // yet, so the newer of the two can now be moved into place
+    const QString compactedFileName = m_fileName + ".new"_l1;
+    if (!QFile::exists(compactedFileName))
+        return;
+
+    auto generation = [](const QString &fileName) -> qint64 {
+        QFile f(fileName);
+        Header header;
+        if (!f.open(QIODevice::ReadOnly)
+                || (f.read(reinterpret_cast<char *>(&header), sizeof(header)) != qint64(sizeof(header)))
+                || (header.magic != ThumbnailPackMagic)
+                || (header.version != ThumbnailPackVersion)) {
+            return -1;
+        }
+        return header.generation;
+    };
+
+    if (generation(compactedFileName) > generation(m_fileName)) {
+        QFile::remove(m_fileName);
+        if (!QFile::rename(compactedFileName, m_fileName))
+            qWarning() << "ThumbnailPack: could not replace" << m_fileName;
+    } else {
+        QFile::remove(compactedFileName);
+    }
+}
+
+void BrickLink::ThumbnailPack::releaseRetiredFiles()
+{
+    for (auto it = m_retiredFiles.begin(); it != m_retiredFiles.end(); ) {
+        if (it->mappedImages->loadAcquire()) {
+            ++it;
+            continue;
+        }
+        const QString fileName = it->file->fileName();
+        it->file->close(); // releases the mapping
+        // the current file might have been compacted into this file's name again
+        if (fileName != m_file->fileName())
+            QFile::remove(fileName);
+        it = m_retiredFiles.erase(it);
+    }
+}
+
+bool BrickLink::ThumbnailPack::reset()
+{
+    // only called when there are no QImages referencing the mapping
+    if (m_map) {
+        m_file->unmap(const_cast<uchar *>(m_map));
+        m_map = nullptr;
+    }
+    m_mappedSize = 0;
+    m_index.clear();
+    m_liveSize = 0;
+
+    Header header = { ThumbnailPackMagic, ThumbnailPackVersion, ++m_generation, 0 };
+
+    if (!m_file->isOpen() || !m_file->resize(0) || !m_file->seek(0)
+            || (m_file->write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header)))) {
+        qWarning() << "ThumbnailPack: could not initialize" << m_file->fileName() << ":"
+                   << m_file->errorString();
+        m_file->close();
+        return false;
+    }
+    m_fileSize = sizeof(header);
+    return true;
+}
+
+bool BrickLink::ThumbnailPack::mapAndIndex()
+{
+    m_index.clear();
+    m_liveSize = 0;
+    m_fileSize = m_file->size();
+    m_map = m_file->map(0, m_fileSize);
+    if (!m_map)
+        return false;
+    m_mappedSize = m_fileSize;
+    m_generation = reinterpret_cast<const Header *>(m_map)->generation;
+
+    QHash<quint64, qint64> sizes;
+    qint64 offset = sizeof(Header);
+
+    while ((offset + qint64(sizeof(EntryHeader))) <= m_mappedSize) {
+        const auto &eh = *reinterpret_cast<const EntryHeader *>(m_map + offset);
+        const qint64 size = entrySize(eh);
+
+        if ((offset + size) > m_mappedSize)
+            break;
+        if (quint64(eh.height) * eh.bytesPerLine != eh.dataSize)
+            break;
+
+        m_liveSize -= sizes.value(eh.key);
+        if (eh.dataSize) {
+            m_liveSize += size;
+            sizes.insert(eh.key, size);
+            m_index.insert(eh.key, offset);
+        } else {
+            sizes.remove(eh.key);
+            m_index.remove(eh.key);
+        }
+        offset += size;
+    }
+
+    // a partial entry at the end is the result of an interrupted write
+    if (offset != m_fileSize) {
+        m_file->unmap(const_cast<uchar *>(m_map));
+        m_map = nullptr;
+        if (!m_file->resize(offset))
+            return false;
+        m_fileSize = offset;
+        m_map = m_file->map(0, m_fileSize);
+        if (!m_map)
+            return false;
+        m_mappedSize = m_fileSize;
+    }
+    return true;
+}
+
+bool BrickLink::ThumbnailPack::compact(qint64 maxLiveSize)
+{
+    struct Entry {
+        qint64 offset;
+        qint64 size;
+        qint64 fetched;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(size_t(m_index.size()));
+    for (auto it = m_index.cbegin(); it != m_index.cend(); ++it) {
+        EntryHeader eh;
+        if (!readEntryHeaderAt(it.value(), eh))
+            return false;
+        entries.push_back({ it.value(), entrySize(eh), eh.fetched });
+    }
+
+    // evict the thumbnails that have been fetched the longest time ago
+    std::sort(entries.begin(), entries.end(), [](const Entry &e1, const Entry &e2) {
+        return e1.fetched > e2.fetched;
+    });
+    qint64 liveSize = 0;
+    auto keepEnd = entries.begin();
+    while ((keepEnd != entries.end()) && ((liveSize + keepEnd->size) <= maxLiveSize))
+        liveSize += (keepEnd++)->size;
+    entries.erase(keepEnd, entries.end());
+
+    // keep the original file order
+    std::sort(entries.begin(), entries.end(), [](const Entry &e1, const Entry &e2) {
+        return e1.offset < e2.offset;
+    });
+
+    // The file can only be replaced, if no QImage is referencing its mapping anymore. Otherwise
+    // we compact into the second file and switch over to that one, while the current file
+    // stays mapped until the last of these QImages is gone.
+    const bool inPlace = (m_mappedImages->loadAcquire() == 0);
+    const QString compactedFileName = inPlace ? m_file->fileName()
+            : ((m_file->fileName() == m_fileName) ? (m_fileName + ".new"_l1) : m_fileName);
+
+    QSaveFile sf(compactedFileName);
+    if (!sf.open(QIODevice::WriteOnly))
+        return false;
+
+    Header header = { ThumbnailPackMagic, ThumbnailPackVersion, m_generation + 1, 0 };
+    bool ok = (sf.write(reinterpret_cast<const char *>(&header), sizeof(header)) == qint64(sizeof(header)));
+
+    for (auto it = entries.cbegin(); ok && (it != entries.cend()); ++it) {
+        if ((it->offset + it->size) <= m_mappedSize) {
+            ok = (sf.write(reinterpret_cast<const char *>(m_map + it->offset), it->size) == it->size);
+        } else {
+            // appended after the file has been mapped
+            ok = m_file->seek(it->offset);
+            if (ok) {
+                const QByteArray entry = m_file->read(it->size);
+                ok = (entry.size() == it->size) && (sf.write(entry) == it->size);
+            }
+        }
+    }
+    if (!ok)
+        return false;
+
+    if (inPlace) {
+        m_file->unmap(const_cast<uchar *>(m_map)); // Windows can not replace mapped files
+        m_map = nullptr;
+        m_mappedSize = 0;
+        m_file->close();
+
+        bool committed = sf.commit();
+
+        if (!m_file->open(QIODevice::ReadWrite | QIODevice::Unbuffered))
+            return false;
+        if (!committed)
+            qWarning() << "ThumbnailPack: could not compact" << m_file->fileName();
+    } else {
+        if (!sf.commit()) {
+            qWarning() << "ThumbnailPack: could not compact into" << compactedFileName;
+            return false;
+        }
+        m_retiredFiles.push_back({ std::move(m_file), std::move(m_mappedImages) });
+        m_map = nullptr;
+        m_mappedSize = 0;
+
+        m_file.reset(new QFile(compactedFileName));
+        m_mappedImages.reset(new QAtomicInt(0));
+        if (!m_file->open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+            qWarning() << "ThumbnailPack: could not open" << m_file->fileName() << ":"
+                       << m_file->errorString();
+            return false;
+        }
+    }
+    if (!mapAndIndex()) {
+        reset();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+
+
+namespace BrickLink {
+
+// A single, append-only file of already decoded and scaled down item pictures in
+// ARGB32_Premultiplied format. The file is memory mapped, so loading a thumbnail is just
+// wrapping a QImage around the mapped pixels: no file I/O and no PNG decoding.
+// Thumbnails that were added after the file has been mapped are read conventionally until the
+// next start. Superseded entries are dropped by compacting the file when it is opened. If the
+// pack grows too big, it is compacted right away and the thumbnails that were fetched the
+// longest time ago are evicted. As long as there are QImages referencing the old mapping, the
+// compacted entries are written to a second file and the pack switches over to it.
+// The sizes in the API are logical sizes: the thumbnails themselves are stored in device pixels
+// for the current device pixel ratio, so that they stay sharp on high-dpi screens.
+// All functions are thread-safe.
+
+class ThumbnailPack
+{
+public:
+    ThumbnailPack(const QString &fileName, qreal devicePixelRatio = 1);
+    ~ThumbnailPack();
+
+    qreal devicePixelRatio() const;
+    void setDevicePixelRatio(qreal dpr);
+
+    bool load(quint64 key, const QSize &size, QDateTime &fetched, QImage &image);
+    bool contains(quint64 key, const QSize &size, const QDateTime &fetched);
+    void save(quint64 key, const QSize &size, const QDateTime &fetched, const QImage &image);
+    void remove(quint64 key);
+    void setFetched(quint64 key, const QDateTime &fetched);
+
+    QImage scaled(const QImage &image, const QSize &size) const;
+
+private:
+    struct Header {
+        quint32 magic;
+        quint32 version;
+        quint32 generation; // incremented by every compaction
+        quint32 reserved;
+    };
+
+    struct EntryHeader {
+        quint64 key;
+        qint64  fetched; // msecs since epoch
+        quint16 thumbnailWidth;  // the requested size in device pixels ...
+        quint16 thumbnailHeight;
+        quint16 width;           // ... and the actual image size (aspect ratio is kept)
+        quint16 height;
+        quint32 bytesPerLine;
+        quint32 dataSize;        // 0 for a removed entry
+    };
+    static_assert(sizeof(EntryHeader) == 32);
+
+    // a file that has been replaced by compacting, but that is still mapped
+    struct RetiredFile {
+        std::unique_ptr<QFile> file;
+        std::unique_ptr<QAtomicInt> mappedImages;
+    };
+
+    bool open();
+    void adoptCompactedFile();
+    void releaseRetiredFiles();
+    bool reset();
+    bool mapAndIndex();
+    bool compact(qint64 maxLiveSize);
+    bool append(const EntryHeader &eh, const uchar *data);
+    bool readEntryHeader(quint64 key, qint64 &offset, EntryHeader &eh);
+    bool readEntryHeaderAt(qint64 offset, EntryHeader &eh);
+    QSize pixelSize(const QSize &size) const;
+    static qint64 entrySize(const EntryHeader &eh);
+    static void releaseMappedImage(void *mappedImages);
+
+    QMutex m_mutex;
+    const QString m_fileName;
+    std::unique_ptr<QFile> m_file; // either m_fileName or the compacted file
+    bool m_opened = false;
+    quint32 m_generation = 0;
+    std::atomic<qreal> m_dpr;
+    const uchar *m_map = nullptr;
+    qint64 m_mappedSize = 0;
+    qint64 m_fileSize = 0;
+    qint64 m_liveSize = 0;
+    QHash<quint64, qint64> m_index; // key -> file offset of the newest entry
+    std::unique_ptr<QAtomicInt> m_mappedImages; // QImages currently referencing the mapping
+    std::vector<RetiredFile> m_retiredFiles;
+};
+
+} // namespace BrickLink
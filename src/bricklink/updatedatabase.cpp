@@ -12,13 +12,21 @@
 ** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
 */
 
+#include <memory>
+
 #include <QSaveFile>
 #include <QFile>
+#include <QBuffer>
 #include <QDateTime>
 #include <QStringBuilder>
 #include <QFileInfo>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
 
 #include "bricklink/core.h"
+#include "bricklink/databasedelta.h"
+#include "utility/exception.h"
 #include "utility/utility.h"
 #include "lzma/bs_lzma.h"
 #include "version.h"
@@ -38,6 +46,45 @@ bool UpdateDatabase::start(bool force)
 {
     BrickLink::core()->cancelTransfers();
 
+    m_force = force;
+    m_canceled = false;
+    m_deltasApplied = 0;
+
+    // try the (much smaller) deltas first and only fall back to the full download if there are
+    // none for our database. A forced update only skips the date check for the full download: if
+    // the local database is damaged, its hash doesn't match any published delta anyway.
+    QString localfile = BrickLink::core()->dataPath() % BrickLink::core()->defaultDatabaseName();
+    if ((QFile::exists(localfile) && startDelta()) || startFull(force)) {
+        emit started();
+        return true;
+    }
+    return false;
+}
+
+void UpdateDatabase::watchJob(TransferJob *job, const std::function<void()> &finishedHandler)
+{
+    // every job gets its own context, so that its connections go away together with the job
+    auto context = new QObject(this);
+
+    connect(&m_trans, &Transfer::progress, context,
+            [this, job](TransferJob *j, int done, int total) {
+        if (j != job)
+            return;
+        emit progress(done, total);
+    });
+    connect(&m_trans, &Transfer::finished, context,
+            [this, job, context, finishedHandler](TransferJob *j) {
+        if (j != job)
+            return;
+
+        disconnect(&m_trans, nullptr, context, nullptr);
+        context->deleteLater();
+        finishedHandler();
+    });
+}
+
+bool UpdateDatabase::startFull(bool force)
+{
     QString dbName = BrickLink::core()->defaultDatabaseName();
     QString remotefile = BRICKSTORE_DATABASE_URL ""_l1 % dbName % u".lzma";
     QString localfile = BrickLink::core()->dataPath() % dbName;
@@ -62,23 +109,7 @@ bool UpdateDatabase::start(bool force)
         return false;
     }
 
-    connect(&m_trans, &Transfer::started,
-            [this, job](TransferJob *j) {
-        if (j != job)
-            return;
-        emit started();
-    });
-    connect(&m_trans, &Transfer::progress,
-            [this, job](TransferJob *j, int done, int total) {
-        if (j != job)
-            return;
-        emit progress(done, total);
-    });
-    connect(&m_trans, &Transfer::finished,
-            [this, job, hhc, file](TransferJob *j) {
-        if (j != job)
-            return;
-
+    watchJob(job, [this, job, hhc, file]() {
         hhc->close(); // does not close/commit the QSaveFile
         hhc->deleteLater();
 
@@ -86,23 +117,166 @@ bool UpdateDatabase::start(bool force)
             emit finished(false, tr("Failed to download and decompress the database") % u": "
                           % job->errorString());
         } else if (job->wasNotModifiedSince()) {
-            emit finished(true, tr("Already up-to-date."));
+            if (m_deltasApplied)
+                emit finished(true, { });
+            else
+                emit finished(true, tr("Already up-to-date."));
         } else if (!hhc->hasValidChecksum()) {
             emit finished(false, tr("Checksum mismatch after decompression"));
-        } else if (!file->commit()) {
-            emit finished(false, tr("Could not save the database") % u": "
-                          % file->errorString());
+        } else {
+            // the old database is still memory mapped, which would prevent the commit on Windows
+            BrickLink::core()->unloadDatabase();
+
+            if (!file->commit()) {
+                emit finished(false, tr("Could not save the database") % u": "
+                              % file->errorString());
+                BrickLink::core()->readDatabase();
+            } else if (!BrickLink::core()->readDatabase(file->fileName())) {
+                emit finished(false, tr("Could not load the new database."));
+            } else {
+                emit finished(true, { });
+            }
+        }
+    });
+    return true;
+}
+
+bool UpdateDatabase::startDelta(const QByteArray &hash)
+{
+    if (!hash.isEmpty())
+        return downloadDelta(hash);
+
+    // hashing the database takes a while, so it is done in the background
+    QString localfile = BrickLink::core()->dataPath() % BrickLink::core()->defaultDatabaseName();
+    if (!QFile::exists(localfile))
+        return false;
+
+    auto watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+        watcher->deleteLater();
+        const QByteArray hash = watcher->result();
+
+        if (m_canceled)
+            emit finished(false, tr("Failed to download and decompress the database"));
+        else if (hash.isEmpty() || !downloadDelta(hash))
+            fallbackToFull();
+    });
+    watcher->setFuture(QtConcurrent::run([localfile]() {
+        QFile f(localfile);
+        return f.open(QIODevice::ReadOnly) ? BrickLink::DatabaseDelta::hash(&f) : QByteArray { };
+    }));
+    return true;
+}
+
+bool UpdateDatabase::downloadDelta(const QByteArray &hash)
+{
+    QString dbName = BrickLink::core()->defaultDatabaseName();
+    QString remotefile = BRICKSTORE_DATABASE_URL ""_l1
+            % BrickLink::DatabaseDelta::fileName(dbName, hash) % u".lzma";
+
+    // deltas are small enough to be kept in memory
+    auto buffer = new QBuffer();
+    auto lzma = new LZMA::DecompressFilter(buffer);
+    buffer->setParent(lzma);
+
+    TransferJob *job = nullptr;
+    if (lzma->open(QIODevice::WriteOnly)) {
+        job = TransferJob::get(QUrl(remotefile), lzma);
+        m_trans.retrieve(job);
+    }
+    if (!job) {
+        delete lzma;
+        return false;
+    }
+
+    watchJob(job, [this, job, lzma, buffer]() {
+        lzma->close();
+        lzma->deleteLater(); // together with the buffer
+
+        if (job->isAborted()) {
+            emit finished(false, tr("Failed to download and decompress the database") % u": "
+                          % job->errorString());
+        } else if (!job->isCompleted() || (job->responseCode() != 200)
+                   || !applyDelta(buffer->data())) {
+            fallbackToFull();
+        }
+    });
+    return true;
+}
+
+bool UpdateDatabase::applyDelta(const QByteArray &delta)
+{
+    QString localfile = BrickLink::core()->dataPath() % BrickLink::core()->defaultDatabaseName();
+
+    // the worker thread might outlive this object, if the update is canceled
+    auto file = std::make_shared<QSaveFile>(localfile);
+    if (!file->open(QIODevice::WriteOnly))
+        return false;
+
+    // reading, verifying and patching the database takes a while, so it is done in the background
+    auto watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, file]() {
+        watcher->deleteLater();
+        const QByteArray newHash = watcher->result();
+
+        if (m_canceled) {
+            emit finished(false, tr("Failed to download and decompress the database"));
+            return; // the QSaveFile is discarded without a commit
+        }
+        if (newHash.isEmpty()) {
+            fallbackToFull();
+            return;
+        }
+
+        // the old database is still memory mapped, which would prevent the commit on Windows
+        BrickLink::core()->unloadDatabase();
+
+        if (!file->commit()) {
+            qWarning() << "Could not save the database:" << file->errorString();
+            BrickLink::core()->readDatabase();
+            fallbackToFull();
         } else if (!BrickLink::core()->readDatabase(file->fileName())) {
-            emit finished(false, tr("Could not load the new database."));
+            // the database on disk is the broken one now and the date of the unloaded one is
+            // stale: only a forced full download can fix that
+            qWarning() << "Could not load the patched database";
+            if (!startFull(true))
+                emit finished(false, tr("Could not load the new database."));
         } else {
-            emit finished(true, { });
+            ++m_deltasApplied;
+
+            // there might be another delta from this build to an even newer one
+            if (!startDelta(newHash))
+                fallbackToFull();
         }
     });
+    watcher->setFuture(QtConcurrent::run([localfile, delta, file]() {
+        QFile oldFile(localfile);
+        if (!oldFile.open(QIODevice::ReadOnly))
+            return QByteArray { };
+        const QByteArray oldData = oldFile.readAll();
+        oldFile.close();
+
+        try {
+            return BrickLink::DatabaseDelta::apply(oldData, delta, file.get());
+        } catch (const Exception &e) {
+            qWarning() << "Could not apply the database delta:" << e.error();
+            return QByteArray { };
+        }
+    }));
     return true;
 }
 
+void UpdateDatabase::fallbackToFull()
+{
+    // no (more) deltas for this build or the delta could not be applied: a final check
+    // for a newer full database also catches builds that were published without a delta
+    if (!startFull(m_force && !m_deltasApplied))
+        emit finished(false, tr("Failed to download and decompress the database"));
+}
+
 void UpdateDatabase::cancel()
 {
+    m_canceled = true;
     m_trans.abortAllJobs();
 }
 
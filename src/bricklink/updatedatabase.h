@@ -13,6 +13,8 @@
 */
 #pragma once
 
+#include <functional>
+
 #include <QObject>
 #include "utility/transfer.h"
 
@@ -22,7 +24,7 @@ class UpdateDatabase : public QObject
     Q_OBJECT
 public:
     UpdateDatabase(QObject *parent = nullptr);
-    bool start(); // no force
+    bool start(); // forced: always checks for a newer database
     bool start(bool force);
     void cancel();
 
@@ -32,5 +34,15 @@ signals:
     void finished(bool success, const QString &error);
 
 private:
+    bool startFull(bool force);
+    bool startDelta(const QByteArray &hash = { });
+    bool downloadDelta(const QByteArray &hash);
+    bool applyDelta(const QByteArray &delta);
+    void fallbackToFull();
+    void watchJob(TransferJob *job, const std::function<void()> &finishedHandler);
+
     Transfer m_trans;
+    bool m_force = false;
+    bool m_canceled = false;
+    int m_deltasApplied = 0;
 };
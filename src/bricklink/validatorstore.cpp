@@ -0,0 +1,61 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include <cstring>
+
+#include "bricklink/validatorstore.h"
+
+
+static const quint32 ValidatorStoreMagic = 0x56485342; // 'BSHV'
+static const quint32 ValidatorStoreVersion = 2;
+
+
+BrickLink::ValidatorStore::ValidatorStore(const QString &fileName)
+    : m_records(fileName, "ValidatorStore", ValidatorStoreMagic, ValidatorStoreVersion)
+{ }
+
+BrickLink::ValidatorStore::Validators BrickLink::ValidatorStore::load(Kind kind, quint64 key)
+{
+    Record r;
+    if (!m_records.load({ quint8(kind), key }, r) || (r.etagSize > sizeof(r.etag)))
+        return { };
+
+    Validators v;
+    v.etag = QByteArray(r.etag, r.etagSize);
+    if (r.lastModified)
+        v.lastModified = QDateTime::fromMSecsSinceEpoch(r.lastModified, Qt::UTC);
+    if (r.validated)
+        v.validated = QDateTime::fromMSecsSinceEpoch(r.validated);
+    return v;
+}
+
+bool BrickLink::ValidatorStore::save(Kind kind, quint64 key, const Validators &validators)
+{
+    // nothing to supersede and nothing to remember
+    if (validators.isEmpty() && !validators.validated.isValid()
+            && !m_records.contains({ quint8(kind), key }))
+        return true;
+
+    Record r = { };
+    r.key = key;
+    r.kind = quint8(kind);
+    if (validators.lastModified.isValid())
+        r.lastModified = validators.lastModified.toMSecsSinceEpoch();
+    if (validators.validated.isValid())
+        r.validated = validators.validated.toMSecsSinceEpoch();
+    if (validators.etag.size() <= int(sizeof(r.etag))) {
+        r.etagSize = quint8(validators.etag.size());
+        memcpy(r.etag, validators.etag.constData(), r.etagSize);
+    }
+    return m_records.save(r);
+}
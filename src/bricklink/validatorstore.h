@@ -0,0 +1,72 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QPair>
+
+#include "utility/recordfile.h"
+
+
+namespace BrickLink {
+
+// The HTTP validators (ETag and Last-Modified) of the downloaded pictures and price guides,
+// so that refreshing them can be done with conditional requests, plus the time our copy was
+// last downloaded or confirmed by the server. Just like the PriceGuideStore, this is a single,
+// append-only file of fixed-size records.
+// All functions are thread-safe.
+
+class ValidatorStore
+{
+public:
+    enum class Kind : quint8 {
+        Picture = 1,
+        PriceGuide = 2,
+    };
+
+    struct Validators
+    {
+        QByteArray etag;
+        QDateTime lastModified;
+        QDateTime validated; // not a validator: when our copy was last known to be up-to-date
+
+        bool isEmpty() const  { return etag.isEmpty() && !lastModified.isValid(); }
+    };
+
+    ValidatorStore(const QString &fileName);
+
+    // use Core::persistentKey(): the in-memory cache keys change with every database update
+    Validators load(Kind kind, quint64 key);
+    bool save(Kind kind, quint64 key, const Validators &validators);
+
+private:
+    typedef QPair<quint8, quint64> IndexKey;
+
+    struct Record {
+        quint64 key;
+        qint64 lastModified; // msecs since epoch, 0 if there is none
+        qint64 validated;    // msecs since epoch, 0 if unknown
+        quint8 kind;
+        quint8 etagSize;
+        char etag[38];       // longer ETags are not stored: we fall back to Last-Modified
+
+        IndexKey indexKey() const  { return { kind, key }; }
+    };
+    static_assert(sizeof(Record) == 64);
+
+    RecordFile<Record, IndexKey> m_records;
+};
+
+} // namespace BrickLink
@@ -868,8 +868,18 @@ void Document::setPriceToGuide(BrickLink::Time time, BrickLink::Price price, boo
     m_setToPG->price = price;
     m_setToPG->currencyRate = Currency::inst()->rate(m_model->currencyCode());
 
-    for (Lot *item : sel) {
-        BrickLink::PriceGuide *pg = BrickLink::core()->priceGuide(item->item(), item->color());
+    // request all the price guides in one go: this deduplicates them and loads the ones not
+    // in the cache yet in a few large batches
+    QVector<QPair<const BrickLink::Item *, const BrickLink::Color *>> itemsAndColors;
+    itemsAndColors.reserve(sel.size());
+    for (const Lot *item : sel)
+        itemsAndColors.append(qMakePair(item->item(), item->color()));
+
+    const auto pgs = BrickLink::core()->priceGuides(itemsAndColors);
+
+    for (int i = 0; i < sel.size(); ++i) {
+        Lot *item = sel.at(i);
+        BrickLink::PriceGuide *pg = pgs.at(i);
 
         if (pg && (forceUpdate || !pg->isValid())
                 && (pg->updateStatus() != BrickLink::UpdateStatus::Updating)) {
@@ -878,8 +888,8 @@ void Document::setPriceToGuide(BrickLink::Time time, BrickLink::Price price, boo
 
         if (pg && ((pg->updateStatus() == BrickLink::UpdateStatus::Loading)
                    || (pg->updateStatus() == BrickLink::UpdateStatus::Updating))) {
-            m_setToPG->priceGuides.insert(pg, item);
-            pg->addRef();
+            m_setToPG->priceGuides.insert(pg, item); // keeps the reference from priceGuides()
+            continue;
 
         } else if (pg && pg->isValid()) {
             double price = pg->price(m_setToPG->time, item->condition(), m_setToPG->price)
@@ -902,6 +912,8 @@ void Document::setPriceToGuide(BrickLink::Time time, BrickLink::Price price, boo
             ++m_setToPG->doneCount;
             emit blockingOperationProgress(m_setToPG->doneCount, m_setToPG->totalCount);
         }
+        if (pg)
+            pg->release();
     }
 
     setBlockingOperationTitle(tr("Downloading price guide data from BrickLink"));
@@ -1663,58 +1675,50 @@ void Document::subtractItems(const LotList &subLots)
 {
     if (subLots.isEmpty())
         return;
-    const LotList &lots = model()->lots();
 
-    std::vector<std::pair<Lot *, Lot>> changes;
-    changes.reserve(subLots.size() * 2); // just a guestimate
-    LotList newLots;
+    // all the document lots that could be merged with a given item and color, in document order
+    QHash<QPair<const BrickLink::Item *, const BrickLink::Color *>, LotList> lotsByItemAndColor;
+    for (Lot *lot : model()->lots()) {
+        if (!lot->isIncomplete())
+            lotsByItemAndColor[qMakePair(lot->item(), lot->color())].append(lot);
+    }
 
-    model()->beginMacro();
+    // the quantities are subtracted from the pending values in the transaction
+    DocumentModel::Transaction transaction(model());
 
     for (const Lot *subLot : subLots) {
         int qty = subLot->quantity();
         if (!subLot->item() || !subLot->color() || !qty)
             continue;
 
-        bool hadMatch = false;
+        Lot *lastMatch = nullptr;
 
-        for (Lot *lot : lots) {
+        const auto matches = lotsByItemAndColor.value(qMakePair(subLot->item(), subLot->color()));
+        for (Lot *lot : matches) {
             if (!DocumentModel::canLotsBeMerged(*lot, *subLot))
                 continue;
 
-            Lot newItem = *lot;
-            auto change = std::find_if(changes.begin(), changes.end(), [=](const auto &c) {
-                return c.first == lot;
-            });
-            Lot &newItemRef = (change == changes.end()) ? newItem : change->second;
-            int qtyInItem = newItemRef.quantity();
+            Lot newItem = transaction.lot(lot);
+            int qtyInItem = newItem.quantity();
 
             if (qtyInItem >= qty) {
-                newItemRef.setQuantity(qtyInItem - qty);
+                newItem.setQuantity(qtyInItem - qty);
                 qty = 0;
             } else {
-                newItemRef.setQuantity(0);
+                newItem.setQuantity(0);
                 qty -= qtyInItem;
             }
-
-            // make sure that this is the last entry in changes, so we can reference it
-            // easily below, if a qty is left
-            if (&newItemRef == &newItem) {
-                changes.emplace_back(lot, newItem);
-            } else {
-                auto last = std::prev(changes.end());
-                if (last != change)
-                    std::swap(*change, *last);
-            }
-            hadMatch = true;
+            transaction.changeLot(lot, newItem);
+            lastMatch = lot;
 
             if (qty == 0)
                 break;
         }
         if (qty) {   // still a qty left
-            if (hadMatch) {
-                Lot &lastChange = changes.back().second;
+            if (lastMatch) {
+                Lot lastChange = transaction.lot(lastMatch);
                 lastChange.setQuantity(lastChange.quantity() - qty);
+                transaction.changeLot(lastMatch, lastChange);
             } else {
                 auto newLot = new Lot();
                 newLot->setItem(subLot->item());
@@ -1723,16 +1727,12 @@ void Document::subtractItems(const LotList &subLots)
                 newLot->setSubCondition(subLot->subCondition());
                 newLot->setQuantity(-qty);
 
-                newLots << newLot;
+                transaction.appendLot(std::move(newLot));
             }
         }
     }
 
-    if (!changes.empty())
-        model()->changeLots(changes);
-    if (!newLots.empty())
-        model()->appendLots(std::move(newLots));
-    model()->endMacro(tr("Subtracted %n item(s)", nullptr, int(subLots.size())));
+    transaction.commit(tr("Subtracted %n item(s)", nullptr, int(subLots.size())));
 }
 
 void Document::gotoNextErrorOrDifference(bool difference)
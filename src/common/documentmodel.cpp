@@ -13,22 +13,23 @@
 */
 #include <utility>
 #include <algorithm>
-#if defined(BS_HAS_PARALLEL_STL) && __has_include(<execution>)
-#  include <execution>
-#  if (__cpp_lib_execution >= 201603) && (__cpp_lib_parallel_algorithm >= 201603)
-#    define AM_SORT_PARALLEL
-#  endif
-#endif
+#include <iterator>
+#include <numeric>
+#include <tuple>
+#include <cstring>
 
 #include <QCoreApplication>
 #include <QCursor>
 #include <QFileInfo>
 #include <QDir>
 #include <QTimer>
+#include <QThread>
 #include <QStringBuilder>
 #include <QtConcurrentFilter>
+#include <QtConcurrentMap>
 #include <QtAlgorithms>
 #include <QStringListModel>
+#include <QCollator>
 
 #if defined(MODELTEST)
 #  include <QAbstractItemModelTester>
@@ -152,6 +153,401 @@ private:
 };
 
 
+// Removes the entries at the given positions in one pass (negative positions are ignored)
+static void removeLotsAt(LotList &list, const QVector<int> &positions)
+{
+    std::vector<bool> removed(size_t(list.size()), false);
+    for (int pos : positions) {
+        if (pos >= 0)
+            removed[size_t(pos)] = true;
+    }
+    int to = 0;
+    for (int from = 0; from < list.size(); ++from) {
+        if (!removed[size_t(from)])
+            list[to++] = list.at(from);
+    }
+    list.resize(to);
+}
+
+// Inserts the lots in one pass, so that they end up at the given positions afterwards
+// (negative positions are ignored)
+static void insertLotsAt(LotList &list, const LotList &lots, const QVector<int> &positions)
+{
+    QVector<QPair<int, Lot *>> inserts;
+    inserts.reserve(lots.size());
+    for (int i = 0; i < lots.size(); ++i) {
+        if (positions.at(i) >= 0)
+            inserts.append(qMakePair(positions.at(i), lots.at(i)));
+    }
+    if (inserts.isEmpty())
+        return;
+    std::sort(inserts.begin(), inserts.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+
+    LotList result;
+    result.reserve(list.size() + inserts.size());
+    auto it = inserts.cbegin();
+    int from = 0;
+    while ((from < list.size()) || (it != inserts.cend())) {
+        if ((it != inserts.cend()) && ((it->first <= result.size()) || (from == list.size())))
+            result.append((it++)->second);
+        else
+            result.append(list.at(from++));
+    }
+    list = result;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+
+// Sorting via compare functions is slow: every single comparison would have to compute the
+// values of both lots (often strings) for each sort column. Instead, the sort keys of all lots
+// are extracted once per sort into one contiguous array per column. The comparisons then
+// only work on indexes into these arrays.
+
+class LotSortKeys
+{
+public:
+    LotSortKeys(const DocumentModel *model, const QVector<QPair<int, Qt::SortOrder>> &columns,
+                const LotList &lots);
+
+    int compare(int i1, int i2) const;
+
+private:
+    struct Keys {
+        DocumentModel::SortKeyType type;
+        bool descending;
+        std::vector<qint64> ints;
+        std::vector<double> doubles;
+        std::vector<QString> strings;
+        std::vector<QCollatorSortKey> collatorKeys;
+    };
+    std::vector<Keys> m_keys;
+};
+
+LotSortKeys::LotSortKeys(const DocumentModel *model,
+                         const QVector<QPair<int, Qt::SortOrder>> &columns, const LotList &lots)
+{
+    using SKT = DocumentModel::SortKeyType;
+    QCollator collator;
+    const size_t n = size_t(lots.size());
+
+    for (const auto &sc : columns) {
+        const auto &c = model->m_columns.value(sc.first);
+        if (c.sortKeyType == SKT::None)
+            continue;
+
+        Keys k { c.sortKeyType, (sc.second == Qt::DescendingOrder), { }, { }, { }, { } };
+
+        if (c.intSortKeyFn) {
+            k.ints.reserve(n);
+            for (const Lot *lot : lots)
+                k.ints.push_back(c.intSortKeyFn(lot));
+        }
+        if ((c.sortKeyType == SKT::Double) && c.doubleSortKeyFn) {
+            k.doubles.reserve(n);
+            for (const Lot *lot : lots)
+                k.doubles.push_back(c.doubleSortKeyFn(lot));
+        } else if ((c.sortKeyType == SKT::LocaleAwareString) && c.stringSortKeyFn) {
+            k.collatorKeys.reserve(n);
+            for (const Lot *lot : lots)
+                k.collatorKeys.push_back(collator.sortKey(c.stringSortKeyFn(lot)));
+        } else if (c.stringSortKeyFn) {
+            k.strings.reserve(n);
+            for (const Lot *lot : lots)
+                k.strings.push_back(c.stringSortKeyFn(lot));
+        }
+        m_keys.push_back(std::move(k));
+    }
+}
+
+static int intCompare(qint64 q1, qint64 q2)
+{
+    return (q1 == q2) ? 0 : ((q1 < q2) ? -1 : 1);
+}
+
+static int doubleCompare(double d1, double d2)
+{
+    return fuzzyCompare(d1, d2) ? 0 : ((d1 < d2) ? -1 : 1);
+}
+
+static bool isUnsorted(const QVector<QPair<int, Qt::SortOrder>> &columns)
+{
+    // sorting by column -1 means: keep the order of m_lots
+    return (columns.size() == 1) && (columns.at(0).first == -1);
+}
+
+static QVector<QPair<int, Qt::SortOrder>>
+deterministicSortColumns(const QVector<QPair<int, Qt::SortOrder>> &columns)
+{
+    // the Index column as a last resort makes sure that no two lots ever compare equal
+    auto columnsPlusIndex = columns;
+    columnsPlusIndex.append(qMakePair(int(DocumentModel::Index),
+                                      columns.isEmpty() ? Qt::AscendingOrder
+                                                        : columns.constFirst().second));
+    return columnsPlusIndex;
+}
+
+int LotSortKeys::compare(int i1, int i2) const
+{
+    using SKT = DocumentModel::SortKeyType;
+
+    for (const Keys &k : m_keys) {
+        int r = 0;
+
+        switch (k.type) {
+        case SKT::Integer:
+            break; // handled below
+        case SKT::Double:
+            r = doubleCompare(k.doubles[size_t(i1)], k.doubles[size_t(i2)]);
+            break;
+        case SKT::String:
+            r = k.strings[size_t(i1)].compare(k.strings[size_t(i2)]);
+            break;
+        case SKT::NaturalString:
+            r = Utility::naturalCompare(k.strings[size_t(i1)], k.strings[size_t(i2)]);
+            break;
+        case SKT::LocaleAwareString:
+            r = k.collatorKeys[size_t(i1)].compare(k.collatorKeys[size_t(i2)]);
+            break;
+        case SKT::None:
+            break;
+        }
+        if (!r && !k.ints.empty())
+            r = intCompare(k.ints[size_t(i1)], k.ints[size_t(i2)]);
+        if (r)
+            return k.descending ? -r : r;
+    }
+    return 0;
+}
+
+
+// When only a few lots changed, they can be repositioned via binary searches. That is just
+// O(log n) comparisons per lot, so computing the keys on the fly is a lot cheaper than
+// extracting them for all the lots via LotSortKeys.
+
+class LotComparator
+{
+public:
+    LotComparator(const DocumentModel *model, const QVector<QPair<int, Qt::SortOrder>> &columns);
+
+    int compare(const Lot *l1, const Lot *l2) const;
+
+private:
+    std::vector<std::pair<const DocumentModel::Column *, bool>> m_columns; // column, descending
+    QCollator m_collator;
+};
+
+LotComparator::LotComparator(const DocumentModel *model,
+                             const QVector<QPair<int, Qt::SortOrder>> &columns)
+{
+    for (const auto &sc : columns) {
+        auto it = model->m_columns.constFind(sc.first);
+        if ((it != model->m_columns.cend()) && (it->sortKeyType != DocumentModel::SortKeyType::None))
+            m_columns.emplace_back(&(*it), (sc.second == Qt::DescendingOrder));
+    }
+}
+
+int LotComparator::compare(const Lot *l1, const Lot *l2) const
+{
+    using SKT = DocumentModel::SortKeyType;
+
+    for (const auto &[c, descending] : m_columns) {
+        int r = 0;
+
+        switch (c->sortKeyType) {
+        case SKT::Integer:
+            break; // handled below
+        case SKT::Double:
+            r = doubleCompare(c->doubleSortKeyFn(l1), c->doubleSortKeyFn(l2));
+            break;
+        case SKT::String:
+            r = c->stringSortKeyFn(l1).compare(c->stringSortKeyFn(l2));
+            break;
+        case SKT::NaturalString:
+            r = Utility::naturalCompare(c->stringSortKeyFn(l1), c->stringSortKeyFn(l2));
+            break;
+        case SKT::LocaleAwareString:
+            r = m_collator.compare(c->stringSortKeyFn(l1), c->stringSortKeyFn(l2));
+            break;
+        case SKT::None:
+            break;
+        }
+        if (!r && c->intSortKeyFn)
+            r = intCompare(c->intSortKeyFn(l1), c->intSortKeyFn(l2));
+        if (r)
+            return descending ? -r : r;
+    }
+    return 0;
+}
+
+
+// Filtering via dataForFilterRole() is slow as well: each term creates QVariants for its
+// column and an "Any" term even does that for every single column, only to then compare the
+// strings case insensitively. Instead, the filter is compiled into a list of terms once per
+// filter run: numeric columns are matched against their sort keys directly, while the string
+// columns referenced by "Any" terms are case folded and joined into one haystack, which is
+// cached per lot for as long as such a filter is active. A plain "Any contains" term then is a
+// single QStringView::contains() call.
+
+static const QChar HaystackSeparator = QChar(0x1f); // ASCII unit separator
+
+class LotFilterProgram
+{
+public:
+    LotFilterProgram(const DocumentModel *model, const QVector<Filter> &filter);
+
+    bool usesHaystacks() const  { return !m_haystackColumns.isEmpty(); }
+    const QVector<int> &haystackColumns() const  { return m_haystackColumns; }
+    bool usesIndex() const      { return m_usesIndex; }
+    bool accepts(const Lot *lot) const;
+
+    QString haystack(const Lot *lot) const;
+
+private:
+    static bool isHaystackColumn(const DocumentModel *model, int col);
+    static bool isRelational(Filter::Comparison comparison);
+    bool matchesColumn(const Filter &f, const Lot *lot, int col) const;
+    bool matchesHaystack(const Filter &f, const QString &needle, const Lot *lot) const;
+
+    struct Term {
+        Filter filter;
+        QVector<int> columns;   // matched one by one
+        bool haystack;          // all other columns are matched via the haystack
+        QString needle;         // the case folded expression, for a plain contains() check
+    };
+    const DocumentModel *m_model;
+    QVector<Term> m_terms;
+    QVector<int> m_haystackColumns;
+    bool m_usesIndex = false;
+};
+
+LotFilterProgram::LotFilterProgram(const DocumentModel *model, const QVector<Filter> &filter)
+    : m_model(model)
+{
+    m_terms.reserve(filter.size());
+
+    for (const Filter &f : filter) {
+        Term t { f, { }, false, { } };
+
+        if ((f.field() < 0) && isRelational(f.comparison())) {
+            // only columns with int or double filter data can match these, but some of these
+            // are not numericFilter columns: check all of them one by one, as before
+            for (int col = 0; col < model->columnCount(); ++col)
+                t.columns.append(col);
+        } else if (f.field() < 0) {
+            for (int col = 0; col < model->columnCount(); ++col) {
+                if (!isHaystackColumn(model, col))
+                    t.columns.append(col);
+                else if (m_haystackColumns.isEmpty() || (m_haystackColumns.constLast() < col))
+                    m_haystackColumns.append(col);
+            }
+            t.haystack = true;
+            if ((f.comparison() == Filter::Matches) && !f.isWildcard())
+                t.needle = f.caseFoldedExpression();
+        } else {
+            t.columns.append(f.field());
+        }
+        if (t.columns.contains(DocumentModel::Index))
+            m_usesIndex = true;
+        m_terms.append(t);
+    }
+}
+
+bool LotFilterProgram::isHaystackColumn(const DocumentModel *model, int col)
+{
+    // the Index column changes all the time, so we can't cache it
+    if (col == DocumentModel::Index)
+        return false;
+    // non-filterable columns never match anything, so there's no need to copy them
+    auto it = model->m_columns.constFind(col);
+    return (it != model->m_columns.cend()) && it->filterable && !it->numericFilter;
+}
+
+bool LotFilterProgram::isRelational(Filter::Comparison comparison)
+{
+    switch (comparison) {
+    case Filter::Less:
+    case Filter::LessEqual:
+    case Filter::Greater:
+    case Filter::GreaterEqual:
+        return true;
+    default:
+        return false;
+    }
+}
+
+QString LotFilterProgram::haystack(const Lot *lot) const
+{
+    QString h(HaystackSeparator);
+
+    for (int col : m_haystackColumns) {
+        h.append(m_model->dataForFilterRole(lot, static_cast<DocumentModel::Field>(col))
+                 .toString().toCaseFolded());
+        h.append(HaystackSeparator);
+    }
+    return h;
+}
+
+bool LotFilterProgram::accepts(const Lot *lot) const
+{
+    bool result = false;
+    Filter::Combination nextcomb = Filter::Or;
+
+    for (const Term &t : m_terms) {
+        // the terms are combined strictly from left to right, so we can skip the ones that
+        // cannot change the result anymore
+        if ((nextcomb == Filter::And) ? result : !result) {
+            bool localresult = false;
+            for (int col : t.columns) {
+                if ((localresult = matchesColumn(t.filter, lot, col)))
+                    break;
+            }
+            if (!localresult && t.haystack)
+                localresult = matchesHaystack(t.filter, t.needle, lot);
+            result = localresult;
+        }
+        nextcomb = t.filter.combination();
+    }
+    return result;
+}
+
+bool LotFilterProgram::matchesColumn(const Filter &f, const Lot *lot, int col) const
+{
+    auto it = m_model->m_columns.constFind(col);
+    if ((it != m_model->m_columns.cend()) && it->numericFilter) {
+        if (it->sortKeyType == DocumentModel::SortKeyType::Double)
+            return f.matchesDouble(it->doubleSortKeyFn(lot));
+        else
+            return f.matchesInt(it->intSortKeyFn(lot));
+    }
+    return f.matches(m_model->dataForFilterRole(lot, static_cast<DocumentModel::Field>(col)));
+}
+
+bool LotFilterProgram::matchesHaystack(const Filter &f, const QString &needle, const Lot *lot) const
+{
+    // lots that were changed after the last filter run are not in the cache
+    auto it = m_model->m_filterHaystacks.constFind(lot);
+    const QString h = (it != m_model->m_filterHaystacks.cend()) ? *it : haystack(lot);
+    const QStringView hv(h);
+
+    if (!needle.isNull())
+        return hv.contains(needle);
+
+    for (qsizetype from = 1; from < hv.size(); ) {
+        qsizetype to = hv.indexOf(HaystackSeparator, from);
+        if (f.matchesCaseFolded(hv.mid(from, to - from)))
+            return true;
+        from = to + 1;
+    }
+    return false;
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
@@ -164,6 +560,7 @@ enum {
     CID_ResetDifferenceMode,
     CID_Sort,
     CID_Filter,
+    CID_Batch,
 
     // values starting at 0x00010000 are reserved for the view
 };
@@ -171,8 +568,9 @@ enum {
 
 AddRemoveCmd::AddRemoveCmd(Type t, DocumentModel *model, const QVector<int> &positions,
                            const QVector<int> &sortedPositions,
-                           const QVector<int> &filteredPositions, const LotList &lots)
-    : QUndoCommand(genDesc(t == Add, qMax(lots.count(), positions.count())))
+                           const QVector<int> &filteredPositions, const LotList &lots,
+                           QUndoCommand *parent)
+    : QUndoCommand(genDesc(t == Add, qMax(lots.count(), positions.count())), parent)
     , m_model(model)
     , m_positions(positions)
     , m_sortedPositions(sortedPositions)
@@ -238,18 +636,215 @@ QString AddRemoveCmd::genDesc(bool is_add, int count)
 ///////////////////////////////////////////////////////////////////////
 
 
+LotDeltas::LotDeltas(const std::vector<std::pair<Lot *, Lot>> &changes)
+{
+    m_lots.reserve(changes.size());
+
+    for (const auto &change : changes) {
+        m_lots.push_back(change.first);
+        add(change.first, *change.first, change.second);
+    }
+    std::sort(m_lots.begin(), m_lots.end());
+    m_lots.erase(std::unique(m_lots.begin(), m_lots.end()), m_lots.end());
+
+    std::stable_sort(m_entries.begin(), m_entries.end(), [](const Entry &e1, const Entry &e2) {
+        return std::tie(e1.lot, e1.field) < std::tie(e2.lot, e2.field);
+    });
+}
+
+void LotDeltas::add(Lot *lot, const Lot &from, const Lot &to)
+{
+    auto packed = [&](Field f, quint64 v1, quint64 v2) {
+        if (v1 != v2)
+            m_entries.push_back({ lot, v1, v2, f });
+    };
+    auto packedDouble = [&](Field f, double d1, double d2) {
+        // compare the bits: we need to restore the exact values
+        quint64 v1, v2;
+        memcpy(&v1, &d1, sizeof(v1));
+        memcpy(&v2, &d2, sizeof(v2));
+        packed(f, v1, v2);
+    };
+    auto outOfLine = [&](Field f, const auto &v1, const auto &v2) {
+        if (v1 != v2)
+            m_entries.push_back({ lot, addValue(QVariant::fromValue(v1)), addValue(QVariant::fromValue(v2)), f });
+    };
+
+    packed(Field::Item, quintptr(from.item()), quintptr(to.item()));
+    packed(Field::Color, quintptr(from.color()), quintptr(to.color()));
+    packed(Field::Status, quint64(from.status()), quint64(to.status()));
+    packed(Field::Condition, quint64(from.condition()), quint64(to.condition()));
+    packed(Field::SubCondition, quint64(from.subCondition()), quint64(to.subCondition()));
+    packed(Field::Retain, from.retain(), to.retain());
+    packed(Field::Stockroom, quint64(from.stockroom()), quint64(to.stockroom()));
+    packed(Field::Alternate, from.alternate(), to.alternate());
+    packed(Field::AlternateId, from.alternateId(), to.alternateId());
+    packed(Field::CounterPart, from.counterPart(), to.counterPart());
+    packed(Field::LotId, from.lotId(), to.lotId());
+    packed(Field::Quantity, quint64(from.quantity()), quint64(to.quantity()));
+    packed(Field::BulkQuantity, quint64(from.bulkQuantity()), quint64(to.bulkQuantity()));
+    packed(Field::TierQuantity0, quint64(from.tierQuantity(0)), quint64(to.tierQuantity(0)));
+    packed(Field::TierQuantity1, quint64(from.tierQuantity(1)), quint64(to.tierQuantity(1)));
+    packed(Field::TierQuantity2, quint64(from.tierQuantity(2)), quint64(to.tierQuantity(2)));
+    packed(Field::Sale, quint64(from.sale()), quint64(to.sale()));
+    packedDouble(Field::Price, from.price(), to.price());
+    packedDouble(Field::Cost, from.cost(), to.cost());
+    packedDouble(Field::TierPrice0, from.tierPrice(0), to.tierPrice(0));
+    packedDouble(Field::TierPrice1, from.tierPrice(1), to.tierPrice(1));
+    packedDouble(Field::TierPrice2, from.tierPrice(2), to.tierPrice(2));
+    packedDouble(Field::Weight, from.hasCustomWeight() ? from.weight() : 0,
+                 to.hasCustomWeight() ? to.weight() : 0);
+
+    outOfLine(Field::Reserved, from.reserved(), to.reserved());
+    outOfLine(Field::Comments, from.comments(), to.comments());
+    outOfLine(Field::Remarks, from.remarks(), to.remarks());
+    outOfLine(Field::MarkerText, from.markerText(), to.markerText());
+    outOfLine(Field::MarkerColor, from.markerColor(), to.markerColor());
+    outOfLine(Field::DateAdded, from.dateAdded(), to.dateAdded());
+    outOfLine(Field::DateLastSold, from.dateLastSold(), to.dateLastSold());
+
+    const auto *inc1 = from.isIncomplete();
+    const auto *inc2 = to.isIncomplete();
+    // changing the item or color may reset the incomplete data, so we have to restore it
+    bool itemOrColorChanged = (from.item() != to.item()) || (from.color() != to.color());
+
+    if ((inc1 || inc2) && (itemOrColorChanged || !inc1 || !inc2 || !(*inc1 == *inc2))) {
+        using IncPtr = QSharedPointer<const BrickLink::Incomplete>;
+        m_entries.push_back({ lot, addIncomplete(IncPtr(inc1 ? new BrickLink::Incomplete(*inc1) : nullptr)),
+                              addIncomplete(IncPtr(inc2 ? new BrickLink::Incomplete(*inc2) : nullptr)),
+                              Field::Incomplete });
+    }
+}
+
+quint64 LotDeltas::addValue(const QVariant &v)
+{
+    m_values.push_back(v);
+    return m_values.size() - 1;
+}
+
+quint64 LotDeltas::addIncomplete(const QSharedPointer<const BrickLink::Incomplete> &inc)
+{
+    m_incompletes.push_back(inc);
+    return m_incompletes.size() - 1;
+}
+
+quint64 LotDeltas::rebase(const LotDeltas &other, Field field, quint64 v)
+{
+    if (field == Field::Incomplete)
+        return addIncomplete(other.m_incompletes.at(v));
+    else if (field >= Field::Reserved)
+        return addValue(other.m_values.at(v));
+    else
+        return v;
+}
+
+void LotDeltas::merge(const LotDeltas &later)
+{
+    // the merged delta goes from our "from" state to the "to" state of the later one
+    std::vector<Entry> merged;
+    merged.reserve(m_entries.size() + later.m_entries.size());
+
+    auto it1 = m_entries.cbegin();
+    auto it2 = later.m_entries.cbegin();
+
+    while ((it1 != m_entries.cend()) || (it2 != later.m_entries.cend())) {
+        if ((it2 == later.m_entries.cend())
+                || ((it1 != m_entries.cend())
+                    && (std::tie(it1->lot, it1->field) < std::tie(it2->lot, it2->field)))) {
+            merged.push_back(*it1++);
+        } else if ((it1 == m_entries.cend())
+                   || (std::tie(it2->lot, it2->field) < std::tie(it1->lot, it1->field))) {
+            merged.push_back({ it2->lot, rebase(later, it2->field, it2->from),
+                               rebase(later, it2->field, it2->to), it2->field });
+            ++it2;
+        } else {
+            merged.push_back({ it1->lot, it1->from, rebase(later, it2->field, it2->to), it1->field });
+            ++it1;
+            ++it2;
+        }
+    }
+    m_entries = std::move(merged);
+
+    std::vector<Lot *> lots;
+    lots.reserve(m_lots.size() + later.m_lots.size());
+    std::set_union(m_lots.cbegin(), m_lots.cend(), later.m_lots.cbegin(), later.m_lots.cend(),
+                   std::back_inserter(lots));
+    m_lots = std::move(lots);
+}
+
+void LotDeltas::apply(bool undo) const
+{
+    for (const Entry &e : m_entries)
+        set(e.lot, e.field, undo ? e.from : e.to);
+}
+
+LotList LotDeltas::changedLots() const
+{
+    LotList lots;
+    for (const Entry &e : m_entries) {
+        if (lots.isEmpty() || (lots.constLast() != e.lot))
+            lots.append(e.lot);
+    }
+    return lots;
+}
+
+void LotDeltas::set(Lot *lot, Field field, quint64 v) const
+{
+    auto toDouble = [](quint64 v) {
+        double d;
+        memcpy(&d, &v, sizeof(d));
+        return d;
+    };
+
+    switch (field) {
+    case Field::Item:          lot->setItem(reinterpret_cast<const BrickLink::Item *>(v)); break;
+    case Field::Color:         lot->setColor(reinterpret_cast<const BrickLink::Color *>(v)); break;
+    case Field::Status:        lot->setStatus(BrickLink::Status(v)); break;
+    case Field::Condition:     lot->setCondition(BrickLink::Condition(v)); break;
+    case Field::SubCondition:  lot->setSubCondition(BrickLink::SubCondition(v)); break;
+    case Field::Retain:        lot->setRetain(v); break;
+    case Field::Stockroom:     lot->setStockroom(BrickLink::Stockroom(v)); break;
+    case Field::Alternate:     lot->setAlternate(v); break;
+    case Field::AlternateId:   lot->setAlternateId(uint(v)); break;
+    case Field::CounterPart:   lot->setCounterPart(v); break;
+    case Field::LotId:         lot->setLotId(uint(v)); break;
+    case Field::Quantity:      lot->setQuantity(int(v)); break;
+    case Field::BulkQuantity:  lot->setBulkQuantity(int(v)); break;
+    case Field::TierQuantity0: lot->setTierQuantity(0, int(v)); break;
+    case Field::TierQuantity1: lot->setTierQuantity(1, int(v)); break;
+    case Field::TierQuantity2: lot->setTierQuantity(2, int(v)); break;
+    case Field::Sale:          lot->setSale(int(v)); break;
+    case Field::Price:         lot->setPrice(toDouble(v)); break;
+    case Field::Cost:          lot->setCost(toDouble(v)); break;
+    case Field::TierPrice0:    lot->setTierPrice(0, toDouble(v)); break;
+    case Field::TierPrice1:    lot->setTierPrice(1, toDouble(v)); break;
+    case Field::TierPrice2:    lot->setTierPrice(2, toDouble(v)); break;
+    case Field::Weight:        lot->setWeight(toDouble(v)); break;
+    case Field::Reserved:      lot->setReserved(m_values.at(v).toString()); break;
+    case Field::Comments:      lot->setComments(m_values.at(v).toString()); break;
+    case Field::Remarks:       lot->setRemarks(m_values.at(v).toString()); break;
+    case Field::MarkerText:    lot->setMarkerText(m_values.at(v).toString()); break;
+    case Field::MarkerColor:   lot->setMarkerColor(m_values.at(v).value<QColor>()); break;
+    case Field::DateAdded:     lot->setDateAdded(m_values.at(v).toDateTime()); break;
+    case Field::DateLastSold:  lot->setDateLastSold(m_values.at(v).toDateTime()); break;
+    case Field::Incomplete: {
+        const auto &inc = m_incompletes.at(v);
+        lot->setIncomplete(inc ? new BrickLink::Incomplete(*inc) : nullptr);
+        break;
+    }
+    }
+}
+
+
 QTimer *ChangeCmd::s_eventLoopCounter = nullptr;
 
-ChangeCmd::ChangeCmd(DocumentModel *model, const std::vector<std::pair<Lot *, Lot>> &changes, DocumentModel::Field hint)
-    : QUndoCommand()
+ChangeCmd::ChangeCmd(DocumentModel *model, const std::vector<std::pair<Lot *, Lot>> &changes,
+                     DocumentModel::Field hint, QUndoCommand *parent)
+    : QUndoCommand(parent)
     , m_model(model)
     , m_hint(hint)
     , m_changes(changes)
 {
-    std::sort(m_changes.begin(), m_changes.end(), [](const auto &a, const auto &b) {
-        return a.first < b.first;
-    });
-
     if (!s_eventLoopCounter) {
         s_eventLoopCounter = new QTimer(QCoreApplication::instance());
         s_eventLoopCounter->setProperty("loopCount", uint(0));
@@ -271,7 +866,7 @@ void ChangeCmd::updateText()
 {
     //: Generic undo/redo text for table edits: %1 == column name (e.g. "Price")
     setText(QCoreApplication::translate("ChangeCmd", "Modified %1 on %Ln item(s)", nullptr,
-                                        int(m_changes.size()))
+                                        m_changes.lotCount())
             //: Generic undo/redo text for table edits: if more than one column was edited at once
             .arg((m_hint < DocumentModel::FieldCount) ? m_model->headerData(m_hint, Qt::Horizontal).toString()
                                                  : QCoreApplication::translate("ChangeCmd", "multiple fields")));
@@ -287,14 +882,7 @@ bool ChangeCmd::mergeWith(const QUndoCommand *other)
     if (other->id() == id()) {
         auto *otherChange = static_cast<const ChangeCmd *>(other);
         if ((m_loopCount == otherChange->m_loopCount) && (m_hint == otherChange->m_hint)) {
-            std::copy_if(otherChange->m_changes.cbegin(), otherChange->m_changes.cend(),
-                         std::back_inserter(m_changes), [this](const auto &change) {
-                return !std::binary_search(m_changes.begin(), m_changes.end(),
-                                           std::make_pair(change.first, Lot()),
-                                           [](const auto &a, const auto &b) {
-                    return a.first < b.first;
-                });
-            });
+            m_changes.merge(otherChange->m_changes);
             updateText();
             return true;
         }
@@ -304,12 +892,43 @@ bool ChangeCmd::mergeWith(const QUndoCommand *other)
 
 void ChangeCmd::redo()
 {
-    m_model->changeLotsDirect(m_changes);
+    m_model->changeLotsDirect(m_changes, false);
 }
 
 void ChangeCmd::undo()
 {
-    redo();
+    m_model->changeLotsDirect(m_changes, true);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+
+BatchCmd::BatchCmd(DocumentModel *model, const QString &text)
+    : QUndoCommand(text)
+    , m_model(model)
+{ }
+
+int BatchCmd::id() const
+{
+    return CID_Batch;
+}
+
+void BatchCmd::redo()
+{
+    // all the child commands share one single layout change
+    m_model->beginLayoutChange();
+    QUndoCommand::redo();
+    m_model->endLayoutChange();
+}
+
+void BatchCmd::undo()
+{
+    m_model->beginLayoutChange();
+    QUndoCommand::undo();
+    m_model->endLayoutChange();
 }
 
 
@@ -467,54 +1086,96 @@ void FilterCmd::undo()
 DocumentModel::Statistics::Statistics(const DocumentModel *model, const LotList &list,
                                       bool ignoreExcluded, bool ignorePriceAndQuantityErrors)
 {
-    m_lots = 0;
-    m_items = 0;
-    m_val = m_minval = m_cost = 0.;
-    m_weight = .0;
-    m_errors = 0;
-    m_differences = 0;
-    m_incomplete = 0;
-    bool weight_missing = false;
-
-    for (const Lot *lot : list) {
-        if (ignoreExcluded && (lot->status() == BrickLink::Status::Exclude))
-            continue;
+    auto addRange = [=, &list](Statistics &stat, int from, int to) {
+        for (int i = from; i < to; ++i) {
+            const Lot *lot = list.at(i);
+            if (!ignoreExcluded || (lot->status() != BrickLink::Status::Exclude))
+                stat.add(model, lot, ignorePriceAndQuantityErrors);
+        }
+    };
 
-        ++m_lots;
+    // small lists are not worth the overhead of a parallel reduction
+    static constexpr int ChunkSize = 4096;
 
-        int qty = lot->quantity();
-        double price = lot->price();
+    if (list.size() <= ChunkSize) {
+        addRange(*this, 0, list.size());
+    } else {
+        QVector<int> chunks;
+        for (int i = 0; i < list.size(); i += ChunkSize)
+            chunks << i;
+
+        // an ordered reduce keeps the floating point sums reproducible
+        *this = QtConcurrent::blockingMappedReduced<Statistics>(chunks, [=, &list](int from) {
+            Statistics stat;
+            addRange(stat, from, qMin(from + ChunkSize, list.size()));
+            return stat;
+        }, [](Statistics &result, const Statistics &stat) {
+            result += stat;
+        }, QtConcurrent::OrderedReduce);
+    }
+    m_ccode = model->currencyCode();
+}
 
-        m_val += (qty * price);
-        m_cost += (qty * lot->cost());
+double DocumentModel::Statistics::weight() const
+{
+    // a negative weight signals that the weight of at least one lot is unknown
+    if (m_weightMissing)
+        return qFuzzyIsNull(m_weight) ? -std::numeric_limits<double>::min() : -m_weight;
+    else
+        return qMax(0., m_weight); // don't let rounding errors from removed lots show up
+}
 
-        for (int i = 0; i < 3; i++) {
-            if (lot->tierQuantity(i) && !qFuzzyIsNull(lot->tierPrice(i)))
-                price = lot->tierPrice(i);
-        }
-        m_minval += (qty * price * (1.0 - double(lot->sale()) / 100.0));
-        m_items += qty;
+DocumentModel::Statistics &DocumentModel::Statistics::operator+=(const Statistics &other)
+{
+    m_lots += other.m_lots;
+    m_items += other.m_items;
+    m_val += other.m_val;
+    m_minval += other.m_minval;
+    m_cost += other.m_cost;
+    m_weight += other.m_weight;
+    m_weightMissing += other.m_weightMissing;
+    m_errors += other.m_errors;
+    m_differences += other.m_differences;
+    m_incomplete += other.m_incomplete;
+    return *this;
+}
 
-        if (lot->totalWeight() > 0)
-            m_weight += lot->totalWeight();
-        else
-            weight_missing = true;
+void DocumentModel::Statistics::add(const DocumentModel *model, const Lot *lot,
+                                    bool ignorePriceAndQuantityErrors, int sign)
+{
+    // sign is -1 to remove a lot that was added before
 
-        auto flags = model->lotFlags(lot);
-        if (flags.first) {
-            if (ignorePriceAndQuantityErrors)
-                flags.first &= ((1ULL << PartNo) | (1ULL <<Color));
-            m_errors += qPopulationCount(flags.first);
-        }
-        if (flags.second)
-            m_differences += qPopulationCount(flags.second);
+    m_lots += sign;
 
-        if (lot->isIncomplete())
-            m_incomplete++;
+    int qty = lot->quantity();
+    double price = lot->price();
+
+    m_val += sign * (qty * price);
+    m_cost += sign * (qty * lot->cost());
+
+    for (int i = 0; i < 3; i++) {
+        if (lot->tierQuantity(i) && !qFuzzyIsNull(lot->tierPrice(i)))
+            price = lot->tierPrice(i);
     }
-    if (weight_missing)
-        m_weight = qFuzzyIsNull(m_weight) ? -std::numeric_limits<double>::min() : -m_weight;
-    m_ccode = model->currencyCode();
+    m_minval += sign * (qty * price * (1.0 - double(lot->sale()) / 100.0));
+    m_items += sign * qty;
+
+    if (lot->totalWeight() > 0)
+        m_weight += sign * lot->totalWeight();
+    else
+        m_weightMissing += sign;
+
+    auto flags = model->storedLotFlags(lot);
+    if (flags.first) {
+        if (ignorePriceAndQuantityErrors)
+            flags.first &= ((1ULL << PartNo) | (1ULL <<Color));
+        m_errors += sign * int(qPopulationCount(flags.first));
+    }
+    if (flags.second)
+        m_differences += sign * int(qPopulationCount(flags.second));
+
+    if (lot->isIncomplete())
+        m_incomplete += sign;
 }
 
 
@@ -659,9 +1320,30 @@ const LotList &DocumentModel::filteredLots() const
     return m_filteredLots;
 }
 
+int DocumentModel::lotIndex(const Lot *lot) const
+{
+    return lotPosition(lot).index;
+}
+
 DocumentModel::Statistics DocumentModel::statistics(const LotList &list, bool ignoreExcluded,
                                                     bool ignorePriceAndQuantityErrors) const
 {
+    // the statistics for the whole document don't need to be calculated from scratch
+    if ((&list == &m_lots) && !ignorePriceAndQuantityErrors) {
+        updateStatistics();
+
+        Statistics stat = m_includedStatistics;
+        if (!ignoreExcluded)
+            stat += m_excludedStatistics;
+        stat.m_ccode = currencyCode();
+        return stat;
+    }
+
+    // the pending flags have to be calculated here: the Statistics use multiple threads
+    if (!m_lotFlagsPending.isEmpty()) {
+        for (const Lot *lot : list)
+            lotFlags(lot);
+    }
     return Statistics(this, list, ignoreExcluded, ignorePriceAndQuantityErrors);
 }
 
@@ -704,9 +1386,10 @@ void DocumentModel::insertLotsAfter(const Lot *afterLot, LotList &&lots)
     if (lots.empty())
         return;
 
-    int afterPos = m_lots.indexOf(const_cast<Lot *>(afterLot)) + 1;
-    int afterSortedPos = m_sortedLots.indexOf(const_cast<Lot *>(afterLot)) + 1;
-    int afterFilteredPos = m_filteredLots.indexOf(const_cast<Lot *>(afterLot)) + 1;
+    const auto afterLotPos = lotPosition(afterLot);
+    int afterPos = afterLotPos.index + 1;
+    int afterSortedPos = afterLotPos.sortedIndex + 1;
+    int afterFilteredPos = afterLotPos.filteredIndex + 1;
 
     Q_ASSERT((afterPos > 0) && (afterSortedPos > 0));
     if (afterFilteredPos == 0)
@@ -745,6 +1428,187 @@ void DocumentModel::changeLots(const std::vector<std::pair<Lot *, Lot>> &changes
         m_undo->push(new ChangeCmd(this, changes, hint));
 }
 
+DocumentModel::Transaction::Transaction(DocumentModel *model)
+    : m_model(model)
+{ }
+
+DocumentModel::Transaction::~Transaction()
+{
+    // the lots that were never committed are still owned by us
+    for (const Lot *lot : qAsConst(m_addedLots))
+        delete lot;
+}
+
+void DocumentModel::Transaction::appendLot(Lot * &&lot)
+{
+    m_appendedLots.append(lot);
+    m_addedLots.insert(lot);
+    lot = nullptr;
+}
+
+void DocumentModel::Transaction::insertLotsAfter(const Lot *afterLot, LotList &&lots)
+{
+    if (lots.isEmpty())
+        return;
+
+    for (const Lot *lot : qAsConst(lots))
+        m_addedLots.insert(lot);
+
+    // we can only insert after lots that are already part of the document
+    if (isAdded(afterLot) || (m_model->lotPosition(afterLot).index < 0))
+        m_appendedLots.append(lots);
+    else
+        m_insertedLots.emplace_back(afterLot, lots);
+    lots.clear();
+}
+
+void DocumentModel::Transaction::removeLot(Lot *lot)
+{
+    if (m_addedLots.remove(lot)) {
+        m_appendedLots.removeOne(lot);
+        for (auto &inserted : m_insertedLots)
+            inserted.second.removeOne(lot);
+        delete lot;
+    } else if (!m_removed.contains(lot)) {
+        m_changes.remove(lot);
+        m_removed.insert(lot);
+        m_removedLots.append(lot);
+    }
+}
+
+void DocumentModel::Transaction::changeLot(Lot *lot, const Lot &value)
+{
+    if (isAdded(lot))
+        *lot = value; // not part of the document yet, so there's nothing to undo
+    else if (!isRemoved(lot))
+        m_changes.insert(lot, value);
+}
+
+const Lot &DocumentModel::Transaction::lot(Lot *lot) const
+{
+    auto it = m_changes.constFind(lot);
+    return (it != m_changes.cend()) ? *it : *lot;
+}
+
+bool DocumentModel::Transaction::isChanged(const Lot *lot) const
+{
+    return m_changes.contains(const_cast<Lot *>(lot));
+}
+
+bool DocumentModel::Transaction::isAdded(const Lot *lot) const
+{
+    return m_addedLots.contains(lot);
+}
+
+bool DocumentModel::Transaction::isRemoved(const Lot *lot) const
+{
+    return m_removed.contains(lot);
+}
+
+LotList DocumentModel::Transaction::addedLots() const
+{
+    LotList lots;
+    lots.reserve(m_addedLots.size());
+    for (const auto &inserted : m_insertedLots)
+        lots.append(inserted.second);
+    lots.append(m_appendedLots);
+    return lots;
+}
+
+bool DocumentModel::Transaction::isEmpty() const
+{
+    return m_addedLots.isEmpty() && m_removed.isEmpty() && m_changes.isEmpty();
+}
+
+void DocumentModel::Transaction::commit(const QString &label)
+{
+    if (isEmpty())
+        return;
+
+    auto *batchCmd = new BatchCmd(m_model, label);
+
+    // The order of the child commands is important: removing lots doesn't change the order of
+    // the remaining ones, so the insert positions can be calculated upfront. The changes have
+    // to come last, because they may re-sort the changed lots.
+
+    if (!m_removedLots.isEmpty())
+        new AddRemoveCmd(AddRemoveCmd::Remove, m_model, { }, { }, { }, m_removedLots, batchCmd);
+
+    if (!m_insertedLots.empty()) {
+        // the positions of the removed lots in m_lots, m_sortedLots and m_filteredLots
+        std::vector<int> removed[3];
+        for (const Lot *lot : qAsConst(m_removedLots)) {
+            const auto lp = m_model->lotPosition(lot);
+            removed[0].push_back(lp.index);
+            removed[1].push_back(lp.sortedIndex);
+            if (lp.filteredIndex >= 0)
+                removed[2].push_back(lp.filteredIndex);
+        }
+        for (auto &r : removed)
+            std::sort(r.begin(), r.end());
+
+        // a position before the removal -> the same position after the removal
+        auto afterRemoval = [](const std::vector<int> &r, int pos) {
+            return pos - int(std::lower_bound(r.cbegin(), r.cend(), pos) - r.cbegin());
+        };
+
+        LotList lots;
+        QVector<int> insertAt[3];
+        for (const auto &inserted : m_insertedLots) {
+            const auto lp = m_model->lotPosition(inserted.first);
+            const int pos[3] = {
+                afterRemoval(removed[0], lp.index + 1),
+                afterRemoval(removed[1], lp.sortedIndex + 1),
+                (lp.filteredIndex < 0) ? (m_model->m_filteredLots.size() - int(removed[2].size()))
+                                       : afterRemoval(removed[2], lp.filteredIndex + 1)
+            };
+            for (Lot *lot : inserted.second) {
+                lots.append(lot);
+                for (int i = 0; i < 3; ++i)
+                    insertAt[i].append(pos[i]);
+            }
+        }
+
+        // insertLotsDirect() wants the final positions: every lot is shifted by the lots that
+        // are inserted in front of it
+        auto finalPositions = [](const QVector<int> &insertAt) {
+            QVector<int> order(insertAt.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&insertAt](int i1, int i2) {
+                return insertAt.at(i1) < insertAt.at(i2);
+            });
+            QVector<int> positions(insertAt.size());
+            for (int rank = 0; rank < order.size(); ++rank)
+                positions[order.at(rank)] = insertAt.at(order.at(rank)) + rank;
+            return positions;
+        };
+
+        new AddRemoveCmd(AddRemoveCmd::Add, m_model, finalPositions(insertAt[0]),
+                         finalPositions(insertAt[1]), finalPositions(insertAt[2]), lots, batchCmd);
+    }
+
+    if (!m_appendedLots.isEmpty())
+        new AddRemoveCmd(AddRemoveCmd::Add, m_model, { }, { }, { }, m_appendedLots, batchCmd);
+
+    if (!m_changes.isEmpty()) {
+        std::vector<std::pair<Lot *, Lot>> changes;
+        changes.reserve(size_t(m_changes.size()));
+        for (auto it = m_changes.cbegin(); it != m_changes.cend(); ++it)
+            changes.emplace_back(it.key(), it.value());
+        new ChangeCmd(m_model, changes, DocumentModel::FieldCount, batchCmd);
+    }
+
+    // the added lots are owned by the undo commands now
+    m_appendedLots.clear();
+    m_insertedLots.clear();
+    m_addedLots.clear();
+    m_removedLots.clear();
+    m_removed.clear();
+    m_changes.clear();
+
+    m_model->m_undo->push(batchCmd);
+}
+
 void DocumentModel::setLotsDirect(const LotList &lots)
 {
     if (lots.empty())
@@ -756,48 +1620,54 @@ void DocumentModel::setLotsDirect(const LotList &lots)
 void DocumentModel::insertLotsDirect(const LotList &lots, QVector<int> &positions,
                                      QVector<int> &sortedPositions, QVector<int> &filteredPositions)
 {
-    auto pos = positions.constBegin();
-    auto sortedPos = sortedPositions.constBegin();
-    auto filteredPos = filteredPositions.constBegin();
     bool isAppend = positions.isEmpty();
 
     Q_ASSERT((positions.size() == sortedPositions.size())
              && (positions.size() == filteredPositions.size()));
     Q_ASSERT(isAppend != (positions.size() == lots.size()));
 
-    emit layoutAboutToBeChanged({ }, VerticalSortHint);
-    QModelIndexList before = persistentIndexList();
+    beginLayoutChange();
 
-    for (Lot *lot : qAsConst(lots)) {
-        if (!isAppend) {
-            m_lots.insert(*pos++, lot);
-            m_sortedLots.insert(*sortedPos++, lot);
-            m_filteredLots.insert(*filteredPos++, lot);
-        } else {
-            m_lots.append(lot);
-            m_sortedLots.append(lot);
-            m_filteredLots.append(lot);
-        }
+    // the positions are the final ones after the insert, so we can do it in one pass
+    if (!isAppend) {
+        insertLotsAt(m_lots, lots, positions);
+        insertLotsAt(m_sortedLots, lots, sortedPositions);
+        insertLotsAt(m_filteredLots, lots, filteredPositions);
+    } else {
+        m_lots.append(lots);
+        m_sortedLots.append(lots);
+        m_filteredLots.append(lots);
+    }
+    invalidateLotPositions();
 
+    for (Lot *lot : qAsConst(lots)) {
         // this is really a new lot, not just a redo - start with no differences
         if (!m_differenceBase.contains(lot))
             m_differenceBase.insert(lot, *lot);
+        m_filterHaystacks.remove(lot);
 
         updateLotFlags(lot);
+        addLotStatistics(lot);
+    }
+
+    // new lots are merged into the current sort order and filter, while re-inserted lots
+    // already went back to their old positions
+    if (isAppend) {
+        LotList sortedLots, filteredLots;
+        if (mergeSortFilterOrder(lots, sortedLots, filteredLots)) {
+            m_sortedLots = sortedLots;
+            m_filteredLots = filteredLots;
+            invalidateLotPositions();
+        }
     }
 
-    QModelIndexList after;
-    foreach (const QModelIndex &idx, before)
-        after.append(index(lot(idx), idx.column()));
-    changePersistentIndexList(before, after);
-    emit layoutChanged({ }, VerticalSortHint);
+    endLayoutChange();
 
     emit lotCountChanged(m_lots.count());
     emitStatisticsChanged();
 
-    if (isSorted())
-        emit isSortedChanged(m_isSorted = false);
-    if (isFiltered())
+    // the sort order is kept, but re-inserted lots shift the Index column of the lots after them
+    if (!isAppend && isFiltered() && m_filterProgram && m_filterProgram->usesIndex())
         emit isFilteredChanged(m_isFiltered = false);
 }
 
@@ -808,60 +1678,59 @@ void DocumentModel::removeLotsDirect(const LotList &lots, QVector<int> &position
     sortedPositions.resize(lots.count());
     filteredPositions.resize(lots.count());
 
-    emit layoutAboutToBeChanged({ }, VerticalSortHint);
-    QModelIndexList before = persistentIndexList();
-
-    for (int i = lots.count() - 1; i >= 0; --i) {
-        Lot *lot = lots.at(i);
-        int idx = m_lots.indexOf(lot);
-        int sortIdx = m_sortedLots.indexOf(lot);
-        int filterIdx = m_filteredLots.indexOf(lot);
-        Q_ASSERT(idx >= 0 && sortIdx >= 0);
-        positions[i] = idx;
-        sortedPositions[i] = sortIdx;
-        filteredPositions[i] = filterIdx;
-        m_lots.removeAt(idx);
-        m_sortedLots.removeAt(sortIdx);
-        m_filteredLots.removeAt(filterIdx);
-    }
-
-    QModelIndexList after;
-    foreach (const QModelIndex &idx, before)
-        after.append(index(lot(idx), idx.column()));
-    changePersistentIndexList(before, after);
-    emit layoutChanged({ }, VerticalSortHint);
+    beginLayoutChange();
+
+    // record the positions before removing anything: re-inserting the lots at exactly these
+    // positions will restore the original state
+    for (int i = 0; i < lots.count(); ++i) {
+        const auto lp = lotPosition(lots.at(i));
+        Q_ASSERT(lp.index >= 0 && lp.sortedIndex >= 0);
+        positions[i] = lp.index;
+        sortedPositions[i] = lp.sortedIndex;
+        filteredPositions[i] = lp.filteredIndex;
+        m_filterHaystacks.remove(lots.at(i));
+        m_lotFlagsPending.remove(lots.at(i));
+        removeLotStatistics(lots.at(i));
+    }
+    removeLotsAt(m_lots, positions);
+    removeLotsAt(m_sortedLots, sortedPositions);
+    removeLotsAt(m_filteredLots, filteredPositions);
+    invalidateLotPositions();
+
+    endLayoutChange();
 
     emit lotCountChanged(m_lots.count());
     emitStatisticsChanged();
 
-    //TODO: we should remember and re-apply the isSorted/isFiltered state
-    if (isSorted())
-        emit isSortedChanged(m_isSorted = false);
-    if (isFiltered())
+    // the sort order is kept, but removing lots shifts the Index column of the lots after them
+    if (isFiltered() && m_filterProgram && m_filterProgram->usesIndex())
         emit isFilteredChanged(m_isFiltered = false);
 }
 
-void DocumentModel::changeLotsDirect(std::vector<std::pair<Lot *, Lot>> &changes)
+void DocumentModel::changeLotsDirect(const LotDeltas &changes, bool undo)
 {
-    Q_ASSERT(!changes.empty());
+    const LotList lots = changes.changedLots();
+    if (lots.isEmpty())
+        return;
 
-    for (auto &change : changes) {
-        Lot *lot = change.first;
-        std::swap(*lot, change.second);
+    for (const Lot *lot : lots)
+        removeLotStatistics(lot);
+
+    changes.apply(undo);
+
+    for (Lot *lot : lots) {
+        m_filterHaystacks.remove(lot);
 
         QModelIndex idx1 = index(lot, 0);
         QModelIndex idx2 = idx1.siblingAtColumn(columnCount() - 1);
         updateLotFlags(lot);
+        addLotStatistics(lot);
         emitDataChanged(idx1, idx2);
     }
 
     emitStatisticsChanged();
 
-    //TODO: we should remember and re-apply the isSorted/isFiltered state
-    if (isSorted())
-        emit isSortedChanged(m_isSorted = false);
-    if (isFiltered())
-        emit isFilteredChanged(m_isFiltered = false);
+    updateSortFilterOrder(lots);
 }
 
 void DocumentModel::changeCurrencyDirect(const QString &ccode, qreal crate, double *&prices)
@@ -901,18 +1770,70 @@ void DocumentModel::changeCurrencyDirect(const QString &ccode, qreal crate, doub
             prices = nullptr;
         }
 
+        invalidateStatistics();
         emitDataChanged();
         emitStatisticsChanged();
 
-        //TODO: we should remember and re-apply the isSorted/isFiltered state
-        if (isSorted())
-            emit isSortedChanged(m_isSorted = false);
-        if (isFiltered())
-            emit isFilteredChanged(m_isFiltered = false);
+        updateSortFilterOrder(m_lots);
     }
     emit currencyCodeChanged(currencyCode());
 }
 
+void DocumentModel::beginLayoutChange()
+{
+    if (m_layoutChangeLevel++ == 0) {
+        emit layoutAboutToBeChanged({ }, VerticalSortHint);
+        m_persistentIndexesBeforeLayoutChange = persistentIndexList();
+    }
+}
+
+void DocumentModel::endLayoutChange()
+{
+    Q_ASSERT(m_layoutChangeLevel > 0);
+    if (--m_layoutChangeLevel == 0) {
+        const QModelIndexList before = m_persistentIndexesBeforeLayoutChange;
+        m_persistentIndexesBeforeLayoutChange.clear();
+
+        QModelIndexList after;
+        after.reserve(before.size());
+        for (const QModelIndex &idx : before)
+            after.append(index(lot(idx), idx.column()));
+        changePersistentIndexList(before, after);
+        emit layoutChanged({ }, VerticalSortHint);
+    }
+}
+
+DocumentModel::LotPosition DocumentModel::lotPosition(const Lot *lot) const
+{
+    if (!m_lotPositionsValid)
+        updateLotPositions();
+    return m_lotPositions.value(lot);
+}
+
+void DocumentModel::updateLotPositions() const
+{
+    // this has to be done before handing lotPosition() lookups to other threads
+    Q_ASSERT(QThread::currentThread() == thread());
+
+    if (m_lotPositionsValid)
+        return;
+
+    m_lotPositions.clear();
+    m_lotPositions.reserve(m_lots.size());
+    for (int i = 0; i < m_lots.size(); ++i)
+        m_lotPositions[m_lots.at(i)].index = i;
+    for (int i = 0; i < m_sortedLots.size(); ++i)
+        m_lotPositions[m_sortedLots.at(i)].sortedIndex = i;
+    for (int i = 0; i < m_filteredLots.size(); ++i)
+        m_lotPositions[m_filteredLots.at(i)].filteredIndex = i;
+    m_lotPositionsValid = true;
+}
+
+void DocumentModel::invalidateLotPositions()
+{
+    m_lotPositionsValid = false;
+}
+
 void DocumentModel::emitDataChanged(const QModelIndex &tl, const QModelIndex &br)
 {
     if (!m_delayedEmitOfDataChanged) {
@@ -969,10 +1890,121 @@ void DocumentModel::emitStatisticsChanged()
     m_delayedEmitOfStatisticsChanged->start();
 }
 
+void DocumentModel::updateStatistics() const
+{
+    if (m_statisticsValid)
+        return;
+
+    LotList included, excluded;
+    std::partition_copy(m_lots.cbegin(), m_lots.cend(), std::back_inserter(excluded),
+                        std::back_inserter(included), [](const Lot *lot) {
+        return (lot->status() == BrickLink::Status::Exclude);
+    });
+    m_includedStatistics = Statistics(this, included, false);
+    m_excludedStatistics = Statistics(this, excluded, false);
+    m_statisticsValid = true;
+}
+
+void DocumentModel::invalidateStatistics()
+{
+    m_statisticsValid = false;
+}
+
+void DocumentModel::addLotStatistics(const Lot *lot)
+{
+    if (m_statisticsValid) {
+        auto &stat = (lot->status() == BrickLink::Status::Exclude) ? m_excludedStatistics
+                                                                    : m_includedStatistics;
+        stat.add(this, lot, false);
+    }
+}
+
+void DocumentModel::removeLotStatistics(const Lot *lot)
+{
+    if (m_statisticsValid) {
+        auto &stat = (lot->status() == BrickLink::Status::Exclude) ? m_excludedStatistics
+                                                                    : m_includedStatistics;
+        stat.add(this, lot, false, -1);
+    }
+}
+
+// The typed equivalent of comparing dataForEditRole() of a lot and its difference base for
+// all the fields that are relevant in difference mode
+static quint64 differenceFlags(const Lot *lot, const Lot *base)
+{
+    quint64 flags = 0;
+    auto check = [&flags](DocumentModel::Field f, bool differs) {
+        if (differs)
+            flags |= (1ULL << f);
+    };
+
+    // incomplete lots have no item, but still an id
+    bool sameItem = lot->item() && (lot->item() == base->item());
+
+    check(DocumentModel::PartNo,    !sameItem && (lot->itemId() != base->itemId()));
+    check(DocumentModel::Condition, lot->condition() != base->condition());
+    check(DocumentModel::Color,     lot->color() != base->color());
+    check(DocumentModel::Quantity,  lot->quantity() != base->quantity());
+    check(DocumentModel::Price,     lot->price() != base->price());
+    check(DocumentModel::Cost,      lot->cost() != base->cost());
+    check(DocumentModel::Bulk,      lot->bulkQuantity() != base->bulkQuantity());
+    check(DocumentModel::Sale,      lot->sale() != base->sale());
+    check(DocumentModel::Comments,  lot->comments() != base->comments());
+    check(DocumentModel::Remarks,   lot->remarks() != base->remarks());
+    check(DocumentModel::TierQ1,    lot->tierQuantity(0) != base->tierQuantity(0));
+    check(DocumentModel::TierP1,    lot->tierPrice(0) != base->tierPrice(0));
+    check(DocumentModel::TierQ2,    lot->tierQuantity(1) != base->tierQuantity(1));
+    check(DocumentModel::TierP2,    lot->tierPrice(1) != base->tierPrice(1));
+    check(DocumentModel::TierQ3,    lot->tierQuantity(2) != base->tierQuantity(2));
+    check(DocumentModel::TierP3,    lot->tierPrice(2) != base->tierPrice(2));
+    check(DocumentModel::Retain,    lot->retain() != base->retain());
+    check(DocumentModel::Stockroom, lot->stockroom() != base->stockroom());
+    check(DocumentModel::Reserved,  lot->reserved() != base->reserved());
+
+    return flags;
+}
+
 void DocumentModel::updateLotFlags(const Lot *lot)
+{
+    // The flags are calculated lazily: either on demand when they are needed (e.g. for painting
+    // the visible rows), or in batches whenever the event loop is idle.
+    m_lotFlagsPending.insert(lot);
+
+    if (!m_lotFlagsTimer) {
+        m_lotFlagsTimer = new QTimer(this);
+        m_lotFlagsTimer->setSingleShot(true);
+        m_lotFlagsTimer->setInterval(0);
+
+        connect(m_lotFlagsTimer, &QTimer::timeout,
+                this, &DocumentModel::calculatePendingLotFlags);
+    }
+    if (!m_lotFlagsTimer->isActive())
+        m_lotFlagsTimer->start();
+}
+
+void DocumentModel::calculatePendingLotFlags()
+{
+    static constexpr int BatchSize = 1000;
+
+    int count = 0;
+    for (auto it = m_lotFlagsPending.begin(); (it != m_lotFlagsPending.end()) && (count < BatchSize); ++count) {
+        const Lot *lot = *it;
+        it = m_lotFlagsPending.erase(it);
+
+        if (calculateLotFlags(lot)) {
+            // the visible rows were already painted with the on-demand flags
+            QModelIndex idx1 = index(lot, 0);
+            if (idx1.isValid())
+                emitDataChanged(idx1, idx1.siblingAtColumn(columnCount() - 1));
+        }
+    }
+    if (!m_lotFlagsPending.isEmpty())
+        m_lotFlagsTimer->start();
+}
+
+bool DocumentModel::calculateLotFlags(const Lot *lot)
 {
     quint64 errors = 0;
-    quint64 updated = 0;
 
     if (!lot->item())
         errors |= (1ULL << PartNo);
@@ -995,36 +2027,11 @@ void DocumentModel::updateLotFlags(const Lot *lot)
     if (lot->status() == BrickLink::Status::Exclude)
         errors = 0;
 
-    if (auto base = differenceBaseLot(lot)) {
-        static const quint64 ignoreMask = 0ULL
-                | (1ULL << Index)
-                | (1ULL << Status)
-                | (1ULL << Picture)
-                | (1ULL << Description)
-                | (1ULL << QuantityOrig)
-                | (1ULL << QuantityDiff)
-                | (1ULL << PriceOrig)
-                | (1ULL << PriceDiff)
-                | (1ULL << Total)
-                | (1ULL << Category)
-                | (1ULL << ItemType)
-                | (1ULL << LotId)
-                | (1ULL << Weight)
-                | (1ULL << YearReleased)
-                | (1ULL << Marker)
-                | (1ULL << DateAdded)
-                | (1ULL << DateLastSold);
-
-        for (Field f = Index; f != FieldCount; f = Field(f + 1)) {
-            quint64 fmask = (1ULL << f);
-            if (fmask & ignoreMask)
-                continue;
-            if (dataForEditRole(lot, f) != dataForEditRole(base, f))
-                updated |= fmask;
-        }
-    }
+    quint64 updated = 0;
+    if (auto base = differenceBaseLot(lot))
+        updated = differenceFlags(lot, base);
 
-    setLotFlags(lot, errors, updated);
+    return setLotFlags(lot, errors, updated);
 }
 
 void DocumentModel::resetDifferenceMode(const LotList &lotList)
@@ -1039,7 +2046,12 @@ void DocumentModel::resetDifferenceModeDirect(QHash<const Lot *, Lot> &differenc
     for (const auto *lot : qAsConst(m_lots))
         updateLotFlags(lot);
 
+    // the error and difference counts depend on the difference base
+    invalidateStatistics();
     emitDataChanged();
+    emitStatisticsChanged();
+
+    updateSortFilterOrder(m_lots);
 }
 
 const Lot *DocumentModel::differenceBaseLot(const Lot *lot) const
@@ -1207,11 +2219,22 @@ void DocumentModel::updateModified()
 void DocumentModel::setLotFlagsMask(QPair<quint64, quint64> flagsMask)
 {
     m_lotFlagsMask = flagsMask;
+    invalidateStatistics();
     emitStatisticsChanged();
     emitDataChanged();
 }
 
 QPair<quint64, quint64> DocumentModel::lotFlags(const Lot *lot) const
+{
+    if (!m_lotFlagsPending.isEmpty() && m_lotFlagsPending.contains(lot)) {
+        auto *that = const_cast<DocumentModel *>(this);
+        that->m_lotFlagsPending.remove(lot);
+        that->calculateLotFlags(lot);
+    }
+    return storedLotFlags(lot);
+}
+
+QPair<quint64, quint64> DocumentModel::storedLotFlags(const Lot *lot) const
 {
     auto flags = m_lotFlags.value(lot, { });
     flags.first &= m_lotFlagsMask.first;
@@ -1219,13 +2242,23 @@ QPair<quint64, quint64> DocumentModel::lotFlags(const Lot *lot) const
     return flags;
 }
 
-void DocumentModel::setLotFlags(const Lot *lot, quint64 errors, quint64 updated)
+bool DocumentModel::setLotFlags(const Lot *lot, quint64 errors, quint64 updated)
 {
     if (!lot)
-        return;
+        return false;
 
     auto oldFlags = m_lotFlags.value(lot, { });
     if (oldFlags.first != errors || oldFlags.second != updated) {
+        // the statistics were calculated with the old flags
+        if (m_statisticsValid) {
+            auto &stat = (lot->status() == BrickLink::Status::Exclude) ? m_excludedStatistics
+                                                                        : m_includedStatistics;
+            stat.m_errors += int(qPopulationCount(errors & m_lotFlagsMask.first))
+                    - int(qPopulationCount(oldFlags.first & m_lotFlagsMask.first));
+            stat.m_differences += int(qPopulationCount(updated & m_lotFlagsMask.second))
+                    - int(qPopulationCount(oldFlags.second & m_lotFlagsMask.second));
+        }
+
         if (errors || updated)
             m_lotFlags.insert(lot, qMakePair(errors, updated));
         else
@@ -1233,7 +2266,9 @@ void DocumentModel::setLotFlags(const Lot *lot, quint64 errors, quint64 updated)
 
         emit lotFlagsChanged(lot);
         emitStatisticsChanged();
+        return true;
     }
+    return false;
 }
 
 
@@ -1260,7 +2295,7 @@ Lot *DocumentModel::lot(const QModelIndex &idx) const
 
 QModelIndex DocumentModel::index(const Lot *lot, int column) const
 {
-    int row = m_filteredLots.indexOf(const_cast<Lot *>(lot));
+    int row = lotPosition(lot).filteredIndex;
     if (row >= 0)
         return createIndex(row, column, const_cast<Lot *>(lot));
     return { };
@@ -1366,7 +2401,10 @@ QVariant DocumentModel::dataForDisplayRole(const Lot *lot, Field f) const
 
 QVariant DocumentModel::dataForFilterRole(const Lot *lot, Field f) const
 {
-    const auto &c = m_columns.value(f);
+    auto it = m_columns.constFind(f);
+    if (it == m_columns.cend())
+        return { };
+    const auto &c = *it;
     if (!c.filterable)
         return { };
     else if (c.filterFn) {
@@ -1406,21 +2444,6 @@ void DocumentModel::initializeColumns()
     if (!m_columns.isEmpty())
         return;
 
-    static auto boolCompare = [](bool b1, bool b2) -> int {
-        return (b1 ? 1 : 0) - (b2 ? 1 : 0);
-    };
-    static auto uintCompare = [](uint u1, uint u2) -> int {
-        return (u1 == u2) ? 0 : ((u1 < u2) ? -1 : 1);
-    };
-    static auto doubleCompare = [](double d1, double d2) -> int {
-        return fuzzyCompare(d1, d2) ? 0 : ((d1 < d2) ? -1 : 1);
-    };
-    static auto dateTimeCompare = [](const QDateTime &dt1, const QDateTime &dt2) -> int {
-        qint64 se1 = dt1.toSecsSinceEpoch();
-        qint64 se2 = dt2.toSecsSinceEpoch();
-        return (se1 == se2) ? 0 : ((se1 < se2) ? -1 : 1);
-    };
-
     auto C = [this](Field f, const Column &c) { m_columns.insert(f, c); };
 
     C(Index, Column {
@@ -1430,15 +2453,14 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Index"),
           .displayFn = [&](const Lot *lot) {
               if (m_fakeIndexes.isEmpty()) {
-                  return QString::number(m_lots.indexOf(const_cast<Lot *>(lot)) + 1);
+                  return QString::number(lotPosition(lot).index + 1);
               } else {
-                  auto fi = m_fakeIndexes.at(m_lots.indexOf(const_cast<Lot *>(lot)));
+                  auto fi = m_fakeIndexes.at(lotPosition(lot).index);
                   return fi >= 0 ? QString::number(fi + 1) : QString::fromLatin1("+");
               }
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return m_lots.indexOf(const_cast<Lot *>(l1)) - m_lots.indexOf(const_cast<Lot *>(l2));
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lotPosition(lot).index; },
       });
 
     C(Status, Column {
@@ -1456,17 +2478,12 @@ void DocumentModel::initializeColumns()
               case BrickLink::Status::Exclude: return tr("Exclude");
               }
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              if (l1->counterPart() != l2->counterPart()) {
-                  return boolCompare(l1->counterPart(), l2->counterPart());
-              } else if (l1->alternateId() != l2->alternateId()) {
-                  return uintCompare(l1->alternateId(), l2->alternateId());
-              } else if (l1->alternate() != l2->alternate()) {
-                  return boolCompare(l1->alternate(), l2->alternate());
-              } else {
-                  return int(l1->status()) - int(l2->status());
-              }
-          }
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) {
+              // counter-part, alternate id, alternate, status: in that order
+              return (qint64(lot->counterPart() ? 1 : 0) << 48) | (qint64(lot->alternateId()) << 9)
+                      | (qint64(lot->alternate() ? 1 : 0) << 8) | qint64(lot->status());
+          },
       });
 
     C(Picture, Column {
@@ -1480,9 +2497,8 @@ void DocumentModel::initializeColumns()
               auto pic = BrickLink::core()->picture(lot->item(), lot->color());
               return QVariant::fromValue(pic ? pic->image() : QImage { });
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return Utility::naturalCompare(QLatin1String(l1->itemId()), QLatin1String(l2->itemId()));
-          },
+          .sortKeyType = SortKeyType::NaturalString,
+          .stringSortKeyFn = [&](const Lot *lot) { return QString::fromLatin1(lot->itemId()); },
       });
     C(PartNo, Column {
           .defaultWidth = 10,
@@ -1493,9 +2509,8 @@ void DocumentModel::initializeColumns()
               if (auto newItem = BrickLink::core()->item(itid, v.toString().toLatin1()))
                   lot->setItem(newItem);
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return Utility::naturalCompare(QLatin1String(l1->itemId()), QLatin1String(l2->itemId()));
-          },
+          .sortKeyType = SortKeyType::NaturalString,
+          .stringSortKeyFn = [&](const Lot *lot) { return QString::fromLatin1(lot->itemId()); },
       });
     C(Description, Column {
           .defaultWidth = 28,
@@ -1503,25 +2518,22 @@ void DocumentModel::initializeColumns()
           .dataFn = [&](const Lot *lot) { return QVariant::fromValue(lot->item()); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setItem(v.value<const BrickLink::Item *>()); },
           .displayFn = [&](const Lot *lot) { return lot->itemName(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return Utility::naturalCompare(l1->itemName(), l2->itemName());
-          },
+          .sortKeyType = SortKeyType::NaturalString,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->itemName(); },
       });
     C(Comments, Column {
           .title = QT_TR_NOOP("Comments"),
           .dataFn = [&](const Lot *lot) { return lot->comments(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setComments(v.toString()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->comments().localeAwareCompare(l2->comments());
-          },
+          .sortKeyType = SortKeyType::LocaleAwareString,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->comments(); },
       });
     C(Remarks, Column {
           .title = QT_TR_NOOP("Remarks"),
           .dataFn = [&](const Lot *lot) { return lot->remarks(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setRemarks(v.toString()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->remarks().localeAwareCompare(l2->remarks());
-          },
+          .sortKeyType = SortKeyType::LocaleAwareString,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->remarks(); },
       });
     C(QuantityOrig, Column {
           .defaultWidth = 5,
@@ -1532,11 +2544,12 @@ void DocumentModel::initializeColumns()
               auto base = differenceBaseLot(lot);
               return base ? base->quantity() : 0;
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              auto base1 = differenceBaseLot(l1);
-              auto base2 = differenceBaseLot(l2);
-              return (base1 ? base1->quantity() : 0) - (base2 ? base2->quantity() : 0);
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) {
+              auto base = differenceBaseLot(lot);
+              return base ? base->quantity() : 0;
           },
+          .numericFilter = true,
       });
     C(QuantityDiff, Column {
           .defaultWidth = 5,
@@ -1550,11 +2563,12 @@ void DocumentModel::initializeColumns()
               if (auto base = differenceBaseLot(lot))
                   lot->setQuantity(base->quantity() + v.toInt());
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              auto base1 = differenceBaseLot(l1);
-              auto base2 = differenceBaseLot(l2);
-              return (base1 ? l1->quantity() - base1->quantity() : 0) - (base2 ? l2->quantity() - base2->quantity() : 0);
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) {
+              auto base = differenceBaseLot(lot);
+              return base ? lot->quantity() - base->quantity() : 0;
           },
+          .numericFilter = true,
       });
     C(Quantity, Column {
           .defaultWidth = 5,
@@ -1562,9 +2576,9 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Quantity"),
           .dataFn = [&](const Lot *lot) { return lot->quantity(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setQuantity(v.toInt()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->quantity() - l2->quantity();
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->quantity(); },
+          .numericFilter = true,
       });
     C(Bulk, Column {
           .defaultWidth = 5,
@@ -1572,9 +2586,9 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Bulk"),
           .dataFn = [&](const Lot *lot) { return lot->bulkQuantity(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setBulkQuantity(v.toInt()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->bulkQuantity() - l2->bulkQuantity();
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->bulkQuantity(); },
+          .numericFilter = true,
       });
     C(PriceOrig, Column {
           .alignment = Qt::AlignRight,
@@ -1584,11 +2598,12 @@ void DocumentModel::initializeColumns()
               auto base = differenceBaseLot(lot);
               return base ? base->price() : 0;
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              auto base1 = differenceBaseLot(l1);
-              auto base2 = differenceBaseLot(l2);
-              return doubleCompare(base1 ? base1->price() : 0, base2 ? base2->price() : 0);
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) {
+              auto base = differenceBaseLot(lot);
+              return base ? base->price() : 0;
           },
+          .numericFilter = true,
       });
     C(PriceDiff, Column {
           .alignment = Qt::AlignRight,
@@ -1601,38 +2616,39 @@ void DocumentModel::initializeColumns()
               if (auto base = differenceBaseLot(lot))
                   lot->setPrice(base->price() + v.toDouble());
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              auto base1 = differenceBaseLot(l1);
-              auto base2 = differenceBaseLot(l2);
-              return doubleCompare(base1 ? l1->price() - base1->price() : 0, base2 ? l2->price() - base2->price() : 0);
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) {
+              auto base = differenceBaseLot(lot);
+              return base ? lot->price() - base->price() : 0;
           },
+          .numericFilter = true,
       });
     C(Cost, Column {
           .alignment = Qt::AlignRight,
           .title = QT_TR_NOOP("Cost"),
           .dataFn = [&](const Lot *lot) { return lot->cost(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setCost(v.toDouble()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->cost(), l2->cost());
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->cost(); },
+          .numericFilter = true,
       });
     C(Price, Column {
           .alignment = Qt::AlignRight,
           .title = QT_TR_NOOP("Price"),
           .dataFn = [&](const Lot *lot) { return lot->price(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setPrice(v.toDouble()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->price(), l2->price());
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->price(); },
+          .numericFilter = true,
       });
     C(Total, Column {
           .alignment = Qt::AlignRight,
           .editable = false,
           .title = QT_TR_NOOP("Total"),
           .displayFn = [&](const Lot *lot) { return lot->total(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->total(), l2->total());
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->total(); },
+          .numericFilter = true,
       });
     C(Sale, Column {
           .defaultWidth = 5,
@@ -1640,9 +2656,9 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Sale"),
           .dataFn = [&](const Lot *lot) { return lot->sale(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setSale(v.toInt()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->sale() - l2->sale();
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->sale(); },
+          .numericFilter = true,
       });
     C(Condition, Column {
           .defaultWidth = 5,
@@ -1654,9 +2670,9 @@ void DocumentModel::initializeColumns()
           .filterFn = [&](const Lot *lot) {
               return (lot->condition() == BrickLink::Condition::New) ? tr("New") : tr("Used");
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              int d = int(l1->condition()) - int(l2->condition());
-              return d ? d : int(l1->subCondition()) - int(l2->subCondition());
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) {
+              return (qint64(lot->condition()) << 8) | qint64(lot->subCondition());
           },
       });
     C(Color, Column {
@@ -1674,9 +2690,8 @@ void DocumentModel::initializeColumns()
           .dataFn = [&](const Lot *lot) { return QVariant::fromValue(lot->color()); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setColor(v.value<const BrickLink::Color *>()); },
           .displayFn = [&](const Lot *lot) { return lot->colorName(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->colorName().localeAwareCompare(l2->colorName());
-          },
+          .sortKeyType = SortKeyType::LocaleAwareString,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->colorName(); },
       });
     C(Category, Column {
           .defaultWidth = 12,
@@ -1690,9 +2705,8 @@ void DocumentModel::initializeColumns()
               return new QStringListModel(sl);
           },
           .displayFn = [&](const Lot *lot) { return lot->categoryName(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->categoryName().localeAwareCompare(l2->categoryName());
-          },
+          .sortKeyType = SortKeyType::LocaleAwareString,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->categoryName(); },
       });
     C(ItemType, Column {
           .defaultWidth = 12,
@@ -1705,9 +2719,8 @@ void DocumentModel::initializeColumns()
               return new QStringListModel(sl);
           },
           .displayFn = [&](const Lot *lot) { return lot->itemTypeName(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->itemTypeName().localeAwareCompare(l2->itemTypeName());
-          },
+          .sortKeyType = SortKeyType::LocaleAwareString,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->itemTypeName(); },
       });
     C(TierQ1, Column {
           .defaultWidth = 5,
@@ -1715,18 +2728,18 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Tier Q1"),
           .dataFn = [&](const Lot *lot) { return lot->tierQuantity(0); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTierQuantity(0, v.toInt()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->tierQuantity(0) - l2->tierQuantity(0);
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->tierQuantity(0); },
+          .numericFilter = true,
       });
     C(TierP1, Column {
           .alignment = Qt::AlignRight,
           .title = QT_TR_NOOP("Tier P1"),
           .dataFn = [&](const Lot *lot) { return lot->tierPrice(0); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTierPrice(0, v.toDouble()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->tierPrice(0), l2->tierPrice(0));
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->tierPrice(0); },
+          .numericFilter = true,
       });
     C(TierQ2, Column {
           .defaultWidth = 5,
@@ -1734,18 +2747,18 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Tier Q2"),
           .dataFn = [&](const Lot *lot) { return lot->tierQuantity(1); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTierQuantity(1, v.toInt()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->tierQuantity(1) - l2->tierQuantity(1);
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->tierQuantity(1); },
+          .numericFilter = true,
       });
     C(TierP2, Column {
           .alignment = Qt::AlignRight,
           .title = QT_TR_NOOP("Tier P2"),
           .dataFn = [&](const Lot *lot) { return lot->tierPrice(1); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTierPrice(1, v.toDouble()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->tierPrice(1), l2->tierPrice(1));
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->tierPrice(1); },
+          .numericFilter = true,
       });
     C(TierQ3, Column {
           .defaultWidth = 5,
@@ -1753,27 +2766,27 @@ void DocumentModel::initializeColumns()
           .title = QT_TR_NOOP("Tier Q3"),
           .dataFn = [&](const Lot *lot) { return lot->tierQuantity(2); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTierQuantity(2, v.toInt()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->tierQuantity(2) - l2->tierQuantity(2);
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->tierQuantity(2); },
+          .numericFilter = true,
       });
     C(TierP3, Column {
           .alignment = Qt::AlignRight,
           .title = QT_TR_NOOP("Tier P3"),
           .dataFn = [&](const Lot *lot) { return lot->tierPrice(2); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTierPrice(2, v.toDouble()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->tierPrice(2), l2->tierPrice(2));
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->tierPrice(2); },
+          .numericFilter = true,
       });
     C(LotId, Column {
           .alignment = Qt::AlignRight,
           .editable = false,
           .title = QT_TR_NOOP("Lot Id"),
           .displayFn = [&](const Lot *lot) { return lot->lotId(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return uintCompare(l1->lotId(), l2->lotId());
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->lotId(); },
+          .numericFilter = true,
       });
     C(Retain, Column {
           .alignment = Qt::AlignHCenter,
@@ -1785,9 +2798,8 @@ void DocumentModel::initializeColumns()
           .filterFn = [&](const Lot *lot) {
               return lot->retain() ? tr("Yes", "Filter>Retain>Yes") : tr("No", "Filter>Retain>No");
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return boolCompare(l1->retain(), l2->retain());
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->retain() ? 1 : 0; },
       });
     C(Stockroom, Column {
           .alignment = Qt::AlignHCenter,
@@ -1803,26 +2815,24 @@ void DocumentModel::initializeColumns()
               default                     : return tr("None", "Filter>Stockroom>None");
               }
           },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return int(l1->stockroom()) - int(l2->stockroom());
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return int(lot->stockroom()); },
       });
     C(Reserved, Column {
           .title = QT_TR_NOOP("Reserved"),
           .dataFn = [&](const Lot *lot) { return lot->reserved(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setReserved(v.toString()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->reserved().compare(l2->reserved());
-          },
+          .sortKeyType = SortKeyType::String,
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->reserved(); },
       });
     C(Weight, Column {
           .alignment = Qt::AlignRight,
           .title = QT_TR_NOOP("Weight"),
           .dataFn = [&](const Lot *lot) { return lot->totalWeight(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setTotalWeight(v.toDouble()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return doubleCompare(l1->totalWeight(), l2->totalWeight());
-          },
+          .sortKeyType = SortKeyType::Double,
+          .doubleSortKeyFn = [&](const Lot *lot) { return lot->totalWeight(); },
+          .numericFilter = true,
       });
     C(YearReleased, Column {
           .defaultWidth = 5,
@@ -1830,36 +2840,33 @@ void DocumentModel::initializeColumns()
           .editable = false,
           .title = QT_TR_NOOP("Year"),
           .displayFn = [&](const Lot *lot) { return lot->itemYearReleased(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return l1->itemYearReleased() - l2->itemYearReleased();
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->itemYearReleased(); },
+          .numericFilter = true,
       });
     C(Marker, Column {
           .title = QT_TR_NOOP("Marker"),
           .dataFn = [&](const Lot *lot) { return lot->markerText(); },
           .setDataFn = [&](Lot *lot, const QVariant &v) { lot->setMarkerText(v.toString()); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              int d = Utility::naturalCompare(l1->markerText(), l2->markerText());
-              return d ? d : uintCompare(l1->markerColor().rgba(), l2->markerColor().rgba());
-          },
+          .sortKeyType = SortKeyType::NaturalString,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->markerColor().rgba(); },
+          .stringSortKeyFn = [&](const Lot *lot) { return lot->markerText(); },
       });
     C(DateAdded, Column {
           .defaultWidth = 11,
           .editable = false,
           .title = QT_TR_NOOP("Added"),
           .displayFn = [&](const Lot *lot) { return lot->dateAdded(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return dateTimeCompare(l1->dateAdded(), l2->dateAdded());
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->dateAdded().toSecsSinceEpoch(); },
       });
     C(DateLastSold, Column {
           .defaultWidth = 11,
           .editable = false,
           .title = QT_TR_NOOP("Last Sold"),
           .displayFn = [&](const Lot *lot) { return lot->dateLastSold(); },
-          .compareFn = [&](const Lot *l1, const Lot *l2) {
-              return dateTimeCompare(l1->dateLastSold(), l2->dateLastSold());
-          },
+          .sortKeyType = SortKeyType::Integer,
+          .intSortKeyFn = [&](const Lot *lot) { return lot->dateLastSold().toSecsSinceEpoch(); },
       });
 }
 
@@ -1950,8 +2957,7 @@ void DocumentModel::sortDirect(const QVector<QPair<int, Qt::SortOrder>> &columns
     bool emitSortColumnsChanged = (columns != m_sortColumns);
     bool wasSorted = isSorted();
 
-    emit layoutAboutToBeChanged({ }, VerticalSortHint);
-    QModelIndexList before = persistentIndexList();
+    beginLayoutChange();
 
     m_sortColumns = columns;
 
@@ -1966,50 +2972,30 @@ void DocumentModel::sortDirect(const QVector<QPair<int, Qt::SortOrder>> &columns
         m_isSorted = true;
         m_sortedLots = m_lots;
 
-        if ((columns.size() != 1) || (columns.at(0).first != -1)) {
-            // make the sort deterministic
-            auto columnsPlusIndex = columns;
-            columnsPlusIndex.append(qMakePair(0, columns.isEmpty() ? Qt::AscendingOrder
-                                                                   : columns.constFirst().second));
+        // the Index column needs the positions in m_lots, which are not changed by the sort
+        updateLotPositions();
 
-            std::sort(
-#ifdef AM_SORT_PARALLEL
-                        // c++17 parallel + vectorized, but not supported everywhere yet
-                        std::execution::par_unseq,
-#endif
-                        m_sortedLots.begin(), m_sortedLots.end(), [this, columnsPlusIndex](const auto *lot1, const auto *lot2) {
-                int r = 0;
-                for (const auto &sc : columnsPlusIndex) {
-                    auto cmp = m_columns.value(sc.first).compareFn;
-                    r = cmp ? cmp(lot1, lot2) : 0;
-                    if (r) {
-                        if (sc.second == Qt::DescendingOrder)
-                            r = -r;
-                        break;
-                    }
-                }
-                return r < 0;
-            });
-        }
+        if (!isUnsorted(columns))
+            m_sortedLots = sortLots(m_sortedLots, columns);
     }
 
+    invalidateLotPositions();
+
     // we were filtered before, but we don't want to refilter: the solution is to
     // keep the old filtered lots, but use the order from m_sortedLots
     if (!m_filteredLots.isEmpty()
             && (m_filteredLots.size() != m_sortedLots.size())
             && (m_filteredLots != m_sortedLots)) {
+        updateLotPositions();
         m_filteredLots = QtConcurrent::blockingFiltered(m_sortedLots, [this](auto *lot) {
-            return m_filteredLots.contains(lot);
+            return (lotPosition(lot).filteredIndex >= 0);
         });
     } else {
         m_filteredLots = m_sortedLots;
     }
+    invalidateLotPositions();
 
-    QModelIndexList after;
-    foreach (const QModelIndex &idx, before)
-        after.append(index(lot(idx), idx.column()));
-    changePersistentIndexList(before, after);
-    emit layoutChanged({ }, VerticalSortHint);
+    endLayoutChange();
 
     if (emitSortColumnsChanged)
         emit sortColumnsChanged(columns);
@@ -2024,10 +3010,17 @@ void DocumentModel::filterDirect(const QVector<Filter> &filter, bool &filtered,
     bool emitFilterChanged = (filter != m_filter);
     bool wasFiltered = isFiltered();
 
-    emit layoutAboutToBeChanged({ }, VerticalSortHint);
-    QModelIndexList before = persistentIndexList();
+    beginLayoutChange();
 
     m_filter = filter;
+    m_filterProgram.reset(new LotFilterProgram(this, m_filter));
+
+    // only keep the haystacks around for as long as the filter needs them
+    if (m_filterProgram->haystackColumns() != m_filterHaystackColumns) {
+        m_filterHaystacks.clear();
+        m_filterHaystacks.squeeze();
+        m_filterHaystackColumns = m_filterProgram->haystackColumns();
+    }
 
     if (!unfilteredLots.isEmpty()) {
         m_isFiltered = filtered;
@@ -2041,17 +3034,17 @@ void DocumentModel::filterDirect(const QVector<Filter> &filter, bool &filtered,
         m_filteredLots = m_sortedLots;
 
         if (!filter.isEmpty()) {
+            updateLotPositions(); // the Index column's filter data needs them
+            if (m_filterProgram->usesHaystacks())
+                updateFilterHaystacks();
             m_filteredLots = QtConcurrent::blockingFiltered(m_sortedLots, [this](auto *lot) {
                 return filterAcceptsLot(lot);
             });
         }
     }
+    invalidateLotPositions();
 
-    QModelIndexList after;
-    foreach (const QModelIndex &idx, before)
-        after.append(index(lot(idx), idx.column()));
-    changePersistentIndexList(before, after);
-    emit layoutChanged({ }, VerticalSortHint);
+    endLayoutChange();
 
     if (emitFilterChanged)
         emit filterChanged(filter);
@@ -2060,6 +3053,105 @@ void DocumentModel::filterDirect(const QVector<Filter> &filter, bool &filtered,
         emit isFilteredChanged(isFiltered());
 }
 
+LotList DocumentModel::sortLots(const LotList &lots,
+                                const QVector<QPair<int, Qt::SortOrder>> &columns) const
+{
+    // sort a permutation of indexes into the key arrays, then apply it
+    const LotSortKeys keys(this, deterministicSortColumns(columns), lots);
+    std::vector<int> order(size_t(lots.size()));
+    std::iota(order.begin(), order.end(), 0);
+
+    qParallelSort(order.begin(), order.end(), [&keys](int i1, int i2) {
+        return keys.compare(i1, i2) < 0;
+    });
+
+    LotList sortedLots;
+    sortedLots.reserve(lots.size());
+    for (int i : order)
+        sortedLots.append(lots.at(i));
+    return sortedLots;
+}
+
+bool DocumentModel::mergeSortFilterOrder(const LotList &lots, LotList &sortedLots,
+                                         LotList &filteredLots) const
+{
+    // a stale sort order or filter has to be re-applied by the user anyway
+    const bool resort = m_isSorted && !isUnsorted(m_sortColumns);
+    const bool refilter = m_isFiltered && !m_filter.isEmpty();
+
+    if (lots.isEmpty() || (!resort && !refilter))
+        return false;
+
+    updateLotPositions(); // the Index column's sort keys and filter data need them
+
+    const QSet<const Lot *> changed(lots.cbegin(), lots.cend());
+
+    if (!resort) {
+        sortedLots = m_sortedLots;
+    } else if (lots.size() > (m_sortedLots.size() / 16)) {
+        // a full sort is faster than that many binary searches
+        sortedLots = sortLots(m_sortedLots, m_sortColumns);
+    } else {
+        const LotComparator cmp(this, deterministicSortColumns(m_sortColumns));
+        auto lessThan = [&cmp](const Lot *l1, const Lot *l2) { return cmp.compare(l1, l2) < 0; };
+
+        // the unchanged lots are still sorted: merge the (sorted) changed lots into them
+        LotList unchanged, moved;
+        unchanged.reserve(m_sortedLots.size());
+        for (Lot *lot : m_sortedLots)
+            (changed.contains(lot) ? moved : unchanged).append(lot);
+        std::sort(moved.begin(), moved.end(), lessThan);
+
+        sortedLots.clear();
+        sortedLots.reserve(m_sortedLots.size());
+        auto from = unchanged.cbegin();
+        for (Lot *lot : qAsConst(moved)) {
+            auto to = std::lower_bound(from, unchanged.cend(), lot, lessThan);
+            std::copy(from, to, std::back_inserter(sortedLots));
+            sortedLots.append(lot);
+            from = to;
+        }
+        std::copy(from, unchanged.cend(), std::back_inserter(sortedLots));
+    }
+
+    QSet<const Lot *> accepted;
+    if (refilter) {
+        if (m_filterProgram->usesHaystacks())
+            updateFilterHaystacks();
+        const LotList acceptedLots = QtConcurrent::blockingFiltered(lots, [this](auto *lot) {
+            return filterAcceptsLot(lot);
+        });
+        accepted = QSet<const Lot *>(acceptedLots.cbegin(), acceptedLots.cend());
+    }
+
+    // m_filteredLots always has the same order as m_sortedLots
+    filteredLots.clear();
+    filteredLots.reserve(m_filteredLots.size() + lots.size());
+    for (Lot *lot : qAsConst(sortedLots)) {
+        bool visible = (refilter && changed.contains(lot)) ? accepted.contains(lot)
+                                                           : (lotPosition(lot).filteredIndex >= 0);
+        if (visible)
+            filteredLots.append(lot);
+    }
+
+    return (sortedLots != m_sortedLots) || (filteredLots != m_filteredLots);
+}
+
+void DocumentModel::updateSortFilterOrder(const LotList &lots)
+{
+    LotList sortedLots, filteredLots;
+    if (!mergeSortFilterOrder(lots, sortedLots, filteredLots))
+        return;
+
+    beginLayoutChange();
+
+    m_sortedLots = sortedLots;
+    m_filteredLots = filteredLots;
+    invalidateLotPositions();
+
+    endLayoutChange();
+}
+
 QByteArray DocumentModel::saveSortFilterState() const
 {
     QByteArray ba;
@@ -2076,9 +3168,9 @@ QByteArray DocumentModel::saveSortFilterState() const
 
     ds << qint32(m_sortedLots.size());
     for (int i = 0; i < m_sortedLots.size(); ++i) {
-        auto *lot = m_sortedLots.at(i);
-        qint32 row = m_lots.indexOf(lot);
-        bool visible = m_filteredLots.contains(lot);
+        const auto lp = lotPosition(m_sortedLots.at(i));
+        qint32 row = lp.index;
+        bool visible = (lp.filteredIndex >= 0);
 
         ds << (visible ? row : (-row - 1)); // can't have -0
     }
@@ -2217,30 +3309,29 @@ bool DocumentModel::filterAcceptsLot(const Lot *lot) const
     else if (m_filter.isEmpty())
         return true;
 
-    bool result = false;
-    Filter::Combination nextcomb = Filter::Or;
-
-    for (const Filter &f : m_filter) {
-        int firstcol = f.field();
-        int lastcol = firstcol;
-        if (firstcol < 0) {
-            firstcol = 0;
-            lastcol = columnCount() - 1;
-        }
+    Q_ASSERT(m_filterProgram);
+    return m_filterProgram->accepts(lot);
+}
 
-        bool localresult = false;
-        for (int col = firstcol; col <= lastcol && !localresult; ++col) {
-            QVariant v = dataForFilterRole(lot, static_cast<Field>(col));
-            localresult = f.matches(v);
-        }
-        if (nextcomb == Filter::And)
-            result = result && localresult;
-        else
-            result = result || localresult;
+void DocumentModel::updateFilterHaystacks() const
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+    Q_ASSERT(m_filterProgram && (m_filterProgram->haystackColumns() == m_filterHaystackColumns));
 
-        nextcomb = f.combination();
+    LotList missing;
+    for (Lot *lot : m_sortedLots) {
+        if (!m_filterHaystacks.contains(lot))
+            missing.append(lot);
     }
-    return result;
+    if (missing.isEmpty())
+        return;
+
+    const auto haystacks = QtConcurrent::blockingMapped<QVector<QString>>(missing, [this](Lot *lot) {
+        return m_filterProgram->haystack(lot);
+    });
+    m_filterHaystacks.reserve(m_lots.size());
+    for (int i = 0; i < missing.size(); ++i)
+        m_filterHaystacks.insert(missing.at(i), haystacks.at(i));
 }
 
 bool DocumentModel::event(QEvent *e)
@@ -2252,6 +3343,8 @@ bool DocumentModel::event(QEvent *e)
 
 void DocumentModel::languageChange()
 {
+    m_filterHaystacks.clear(); // some filter strings are translated
+
     m_filterParser->setStandardCombinationTokens(Filter::And | Filter::Or);
     m_filterParser->setStandardComparisonTokens(Filter::Matches | Filter::DoesNotMatch |
                                           Filter::Is | Filter::IsNot |
@@ -2275,8 +3368,9 @@ void DocumentModel::languageChange()
 LotList DocumentModel::sortLotList(const LotList &list) const
 {
     LotList result(list);
+    updateLotPositions();
     qParallelSort(result.begin(), result.end(), [this](const auto &i1, const auto &i2) {
-        return index(i1).row() < index(i2).row();
+        return lotPosition(i1).filteredIndex < lotPosition(i2).filteredIndex;
     });
     return result;
 }
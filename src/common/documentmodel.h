@@ -14,6 +14,7 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 
 #include <QAbstractTableModel>
 #include <QPixmap>
@@ -21,6 +22,7 @@
 #include <QTimer>
 #include <QElapsedTimer>
 #include <QMimeData>
+#include <QSet>
 
 #include "bricklink/global.h"
 #include "bricklink/lot.h"
@@ -33,6 +35,8 @@ class UndoStack;
 QT_FORWARD_DECLARE_CLASS(QUndoCommand)
 class AddRemoveCmd;
 class ChangeCmd;
+class LotDeltas;
+class LotFilterProgram;
 
 using BrickLink::Lot;
 using BrickLink::LotList;
@@ -120,30 +124,38 @@ public:
     class Statistics
     {
     public:
+        Statistics() = default;
+
         int lots() const             { return m_lots; }
         int items() const            { return m_items; }
         double value() const         { return m_val; }
         double minValue() const      { return m_minval; }
         double cost() const          { return m_cost; }
-        double weight() const        { return m_weight; }
+        double weight() const;
         int errors() const           { return m_errors; }
         int differences() const      { return m_differences; }
         int incomplete() const       { return m_incomplete; }
         QString currencyCode() const { return m_ccode; }
 
+        Statistics &operator+=(const Statistics &other);
+
     private:
         Statistics(const DocumentModel *model, const LotList &list, bool ignoreExcluded,
                    bool ignorePriceAndQuantityErrors = false);
 
-        int m_lots;
-        int m_items;
-        double m_val;
-        double m_minval;
-        double m_cost;
-        double m_weight;
-        int m_errors;
-        int m_differences;
-        int m_incomplete;
+        void add(const DocumentModel *model, const Lot *lot, bool ignorePriceAndQuantityErrors,
+                 int sign = 1);
+
+        int m_lots = 0;
+        int m_items = 0;
+        double m_val = 0;
+        double m_minval = 0;
+        double m_cost = 0;
+        double m_weight = 0;
+        int m_weightMissing = 0;
+        int m_errors = 0;
+        int m_differences = 0;
+        int m_incomplete = 0;
         QString m_ccode;
 
         friend class DocumentModel;
@@ -211,6 +223,7 @@ public:
     const LotList &lots() const;
     const LotList &sortedLots() const;
     const LotList &filteredLots() const;
+    int lotIndex(const Lot *lot) const; // the position in lots(), -1 if not part of the document
     bool clear();
 
     void appendLot(Lot * &&lot);
@@ -245,6 +258,40 @@ public:
     void beginMacro(const QString &label = QString());
     void endMacro(const QString &label = QString());
 
+    // Collects lot additions, removals and changes, which are then applied via commit() as one
+    // single undo command with one single layout change.
+    class Transaction
+    {
+    public:
+        explicit Transaction(DocumentModel *model);
+        ~Transaction();
+
+        void appendLot(Lot * &&lot);
+        void insertLotsAfter(const Lot *afterLot, BrickLink::LotList &&lots);
+        void removeLot(Lot *lot);
+        void changeLot(Lot *lot, const Lot &value);
+
+        const Lot &lot(Lot *lot) const; // including the pending changes
+        bool isChanged(const Lot *lot) const;
+        bool isAdded(const Lot *lot) const;
+        bool isRemoved(const Lot *lot) const;
+        LotList addedLots() const;
+        bool isEmpty() const;
+
+        void commit(const QString &label);
+
+    private:
+        Q_DISABLE_COPY(Transaction)
+
+        DocumentModel *m_model;
+        LotList m_appendedLots;
+        std::vector<std::pair<const Lot *, LotList>> m_insertedLots;
+        QSet<const Lot *> m_addedLots; // all of the above, owned by us until commit()
+        LotList m_removedLots;
+        QSet<const Lot *> m_removed;
+        QHash<Lot *, Lot> m_changes;
+    };
+
     QUndoStack *undoStack() const;
 
     void applyTo(const LotList &lots, std::function<bool(const Lot &, Lot &)> callback,
@@ -281,7 +328,7 @@ private:
     void setLotsDirect(const LotList &lots);
     void insertLotsDirect(const LotList &lots, QVector<int> &positions, QVector<int> &sortedPositions, QVector<int> &filteredPositions);
     void removeLotsDirect(const LotList &lots, QVector<int> &positions, QVector<int> &sortedPositions, QVector<int> &filteredPositions);
-    void changeLotsDirect(std::vector<std::pair<Lot *, Lot> > &changes);
+    void changeLotsDirect(const LotDeltas &changes, bool undo);
     void changeCurrencyDirect(const QString &ccode, qreal crate, double *&prices);
     void resetDifferenceModeDirect(QHash<const Lot *, Lot>
                                    &differenceBase);
@@ -289,10 +336,35 @@ private:
                       LotList &unfiltered);
     void sortDirect(const QVector<QPair<int, Qt::SortOrder>> &columns, bool &sorted, LotList &unsorted);
 
+    LotList sortLots(const LotList &lots, const QVector<QPair<int, Qt::SortOrder>> &columns) const;
+    bool mergeSortFilterOrder(const LotList &lots, LotList &sortedLots, LotList &filteredLots) const;
+    void updateSortFilterOrder(const LotList &lots);
+
+    struct LotPosition {
+        int index = -1;         // in m_lots
+        int sortedIndex = -1;   // in m_sortedLots
+        int filteredIndex = -1; // in m_filteredLots, -1 if filtered out
+    };
+    LotPosition lotPosition(const Lot *lot) const;
+    void updateLotPositions() const;
+    void invalidateLotPositions();
+
+    void beginLayoutChange();
+    void endLayoutChange();
+
+    void updateFilterHaystacks() const;
+
     void emitDataChanged(const QModelIndex &tl = { }, const QModelIndex &br = { });
     void emitStatisticsChanged();
+    void updateStatistics() const;
+    void invalidateStatistics();
+    void addLotStatistics(const Lot *lot);
+    void removeLotStatistics(const Lot *lot);
     void updateLotFlags(const Lot *lot);
-    void setLotFlags(const Lot *lot, quint64 errors, quint64 updated);
+    void calculatePendingLotFlags();
+    bool calculateLotFlags(const Lot *lot);
+    bool setLotFlags(const Lot *lot, quint64 errors, quint64 updated);
+    QPair<quint64, quint64> storedLotFlags(const Lot *lot) const;
 
     void updateModified();
 
@@ -306,8 +378,21 @@ private:
     friend class SortCmd;
     friend class FilterCmd;
     friend class ResetDifferenceModeCmd;
+    friend class BatchCmd;
+    friend class LotSortKeys;
+    friend class LotComparator;
+    friend class LotFilterProgram;
 
 private:
+    enum class SortKeyType {
+        None,
+        Integer,            // intSortKeyFn
+        Double,             // doubleSortKeyFn, fuzzy compare
+        String,             // stringSortKeyFn, then intSortKeyFn (if set)
+        NaturalString,      // ditto, but compared via Utility::naturalCompare
+        LocaleAwareString,  // ditto, but compared via QCollator
+    };
+
     struct Column {
         int defaultWidth = 8;
         int alignment = Qt::AlignLeft;
@@ -320,7 +405,11 @@ private:
         std::function<void(Lot *, const QVariant &v)> setDataFn = { };
         std::function<QVariant(const Lot *)> displayFn = { };
         std::function<QVariant(const Lot *)> filterFn = { };
-        std::function<int(const Lot *, const Lot *)> compareFn;
+        SortKeyType sortKeyType = SortKeyType::None;
+        std::function<qint64(const Lot *)> intSortKeyFn = { };
+        std::function<double(const Lot *)> doubleSortKeyFn = { };
+        std::function<QString(const Lot *)> stringSortKeyFn = { };
+        bool numericFilter = false; // the filter data is the int or double sort key
     };
     QHash<int, Column> m_columns;
 
@@ -328,14 +417,36 @@ private:
     QVector<Lot *> m_sortedLots;
     QVector<Lot *> m_filteredLots;
 
+    // lot -> row lookups into the 3 lists above, rebuilt on demand after any of them changed
+    mutable QHash<const Lot *, LotPosition> m_lotPositions;
+    mutable bool m_lotPositionsValid = false;
+
+    // layout changes can be nested, e.g. for the child commands of a BatchCmd
+    int m_layoutChangeLevel = 0;
+    QModelIndexList m_persistentIndexesBeforeLayoutChange;
+
     QHash<const Lot *, Lot> m_differenceBase;
     QVector<int>     m_fakeIndexes; // for the consolidate dialogs
     QHash<const Lot *, QPair<quint64, quint64>> m_lotFlags;
+    QSet<const Lot *> m_lotFlagsPending; // see updateLotFlags()
+    QTimer *m_lotFlagsTimer = nullptr;
+
+    // the statistics of all m_lots, split into the non-excluded and excluded ones: these are
+    // rebuilt on demand and then kept up to date incrementally by the *Direct() functions and
+    // by setLotFlags()
+    mutable Statistics m_includedStatistics;
+    mutable Statistics m_excludedStatistics;
+    mutable bool m_statisticsValid = false;
 
 
     QVector<QPair<int, Qt::SortOrder>> m_sortColumns = { { -1, Qt::AscendingOrder } };
     QScopedPointer<Filter::Parser> m_filterParser;
     QVector<Filter> m_filter;
+    QScopedPointer<LotFilterProgram> m_filterProgram;
+
+    // lot -> case folded text of the string columns, for the "Any" field filters
+    mutable QHash<const Lot *, QString> m_filterHaystacks;
+    QVector<int> m_filterHaystackColumns; // the columns in m_filterHaystacks
 
     bool m_isSorted = false;   // freshly sorted, no changes
     bool m_isFiltered = false; // freshly filtered, no changes
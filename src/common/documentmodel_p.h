@@ -13,8 +13,12 @@
 */
 #pragma once
 
+#include <vector>
+
 #include <QUndoCommand>
 #include <QPointer>
+#include <QSharedPointer>
+#include <QVariant>
 
 #include "documentmodel.h"
 
@@ -26,7 +30,7 @@ public:
 
     AddRemoveCmd(Type t, DocumentModel *model, const QVector<int> &positions,
                  const QVector<int> &sortedPositions, const QVector<int> &filteredPositions,
-                 const LotList &lots);
+                 const LotList &lots, QUndoCommand *parent = nullptr);
     ~AddRemoveCmd() override;
     int id() const override;
 
@@ -44,11 +48,57 @@ private:
     Type               m_type;
 };
 
+// The changes of a ChangeCmd, stored field by field: keeping a full Lot copy for every changed
+// lot is way too expensive on large documents, while most edits only touch one or two fields.
+// Numeric fields (plus the item and color pointers) are packed into 64bit values, while
+// strings, colors and dates are stored out-of-line.
+
+class LotDeltas
+{
+public:
+    LotDeltas(const std::vector<std::pair<Lot *, Lot>> &changes);
+
+    void merge(const LotDeltas &later);
+    void apply(bool undo) const;
+
+    LotList changedLots() const;
+    int lotCount() const  { return int(m_lots.size()); }
+
+private:
+    enum class Field : quint8 {
+        Item, Color, Status, Condition, SubCondition, Retain, Stockroom, Alternate, AlternateId,
+        CounterPart, LotId, Quantity, BulkQuantity, TierQuantity0, TierQuantity1, TierQuantity2,
+        Sale, Price, Cost, TierPrice0, TierPrice1, TierPrice2, Weight,
+        // out-of-line values
+        Reserved, Comments, Remarks, MarkerText, MarkerColor, DateAdded, DateLastSold,
+        // has to be applied last, because setItem() and setColor() may reset it
+        Incomplete,
+    };
+
+    struct Entry {
+        Lot *lot;
+        quint64 from;
+        quint64 to;
+        Field field;
+    };
+
+    void add(Lot *lot, const Lot &from, const Lot &to);
+    quint64 addValue(const QVariant &v);
+    quint64 addIncomplete(const QSharedPointer<const BrickLink::Incomplete> &inc);
+    quint64 rebase(const LotDeltas &other, Field field, quint64 v);
+    void set(Lot *lot, Field field, quint64 v) const;
+
+    std::vector<Entry> m_entries;   // sorted by lot, then field
+    std::vector<QVariant> m_values;
+    std::vector<QSharedPointer<const BrickLink::Incomplete>> m_incompletes;
+    std::vector<Lot *> m_lots;      // sorted, including the lots that didn't actually change
+};
+
 class ChangeCmd : public QUndoCommand
 {
 public:
     ChangeCmd(DocumentModel *model, const std::vector<std::pair<Lot *, Lot>> &changes,
-              DocumentModel::Field hint = DocumentModel::FieldCount);
+              DocumentModel::Field hint = DocumentModel::FieldCount, QUndoCommand *parent = nullptr);
     int id() const override;
     bool mergeWith(const QUndoCommand *other) override;
 
@@ -61,11 +111,25 @@ private:
     DocumentModel *m_model;
     uint m_loopCount;
     DocumentModel::Field m_hint;
-    std::vector<std::pair<Lot *, Lot>> m_changes;
+    LotDeltas m_changes;
 
     static QTimer *s_eventLoopCounter;
 };
 
+// The parent of the child commands created by DocumentModel::Transaction::commit()
+class BatchCmd : public QUndoCommand
+{
+public:
+    BatchCmd(DocumentModel *model, const QString &text);
+    int id() const override;
+
+    void redo() override;
+    void undo() override;
+
+private:
+    DocumentModel *m_model;
+};
+
 class CurrencyCmd : public QUndoCommand
 {
 public:
@@ -32,7 +32,8 @@
 ConsolidateItemsDialog::ConsolidateItemsDialog(const View *view,
                                                const LotList &lots,
                                                int preselectedIndex, View::Consolidate mode,
-                                               int current, int total, QWidget *parent)
+                                               int current, int total, QWidget *parent,
+                                               const QVector<int> &lotIndexes)
     : QDialog(parent)
 {
     setupUi(this);
@@ -42,8 +43,9 @@ ConsolidateItemsDialog::ConsolidateItemsDialog(const View *view,
     else
         w_counter->hide();
 
-    bool newLots = (lots.count() == 2) && view->model()->lots().contains(lots.at(0))
-            && !view->model()->lots().contains(lots.at(lots.count() - 1));
+    // the existing lot might still be pending in a DocumentModel::Transaction, so we can only
+    // check the new one
+    bool newLots = (lots.count() == 2) && (view->model()->lotIndex(lots.at(lots.count() - 1)) < 0);
 
     Q_ASSERT(newLots == (int(mode) >= int(View::Consolidate::IntoExisting)));
 
@@ -55,9 +57,12 @@ ConsolidateItemsDialog::ConsolidateItemsDialog(const View *view,
             w_prefer_remaining->removeItem(i);
     }
 
-    QVector<int> fakeIndexes;
-    for (int i = 0; i < lots.size(); ++i)
-        fakeIndexes << view->model()->lots().indexOf(lots.at(i));
+    // lots might be copies of pending document lots, so the caller can supply the indexes
+    QVector<int> fakeIndexes = lotIndexes;
+    if (fakeIndexes.isEmpty()) {
+        for (int i = 0; i < lots.size(); ++i)
+            fakeIndexes << view->model()->lotIndex(lots.at(i));
+    }
 
     DocumentModel *docModel = DocumentModel::createTemporary(lots, fakeIndexes);
     docModel->setParent(this);
@@ -25,7 +25,7 @@ class ConsolidateItemsDialog : public QDialog, private Ui::ConsolidateItemsDialo
 public:
     ConsolidateItemsDialog(const View *win, const LotList &lots,
                            int preselectedIndex, View::Consolidate mode, int current, int total,
-                           QWidget *parent = nullptr);
+                           QWidget *parent = nullptr, const QVector<int> &lotIndexes = { });
 
     int consolidateToIndex() const;
     bool repeatForAll() const;
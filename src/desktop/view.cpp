@@ -86,6 +86,36 @@
 using namespace std::chrono_literals;
 
 
+// Lots can be consolidated, if they have the same item, color and condition and if they are
+// either both excluded or both not excluded
+struct ConsolidateKey
+{
+    explicit ConsolidateKey(const Lot &lot)
+        : item(lot.item())
+        , color(lot.color())
+        , condition(lot.condition())
+        , excluded(lot.status() == BrickLink::Status::Exclude)
+    { }
+
+    bool operator==(const ConsolidateKey &other) const
+    {
+        return (item == other.item) && (color == other.color) && (condition == other.condition)
+                && (excluded == other.excluded);
+    }
+
+    const BrickLink::Item *item;
+    const BrickLink::Color *color;
+    BrickLink::Condition condition;
+    bool excluded;
+};
+
+static qHashResult qHash(const ConsolidateKey &key, qHashResult seed = 0)
+{
+    return qHash(key.item, seed) ^ qHash(key.color, seed)
+            ^ ((qHashResult(key.condition) << 1) | qHashResult(key.excluded));
+}
+
+
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -572,7 +602,7 @@ void View::addLots(LotList &&lots, AddLotMode addLotMode)
     if (lots.empty())
         return;
 
-    bool startedMacro = false;
+    DocumentModel::Transaction transaction(m_model);
 
     bool wasEmpty = (model()->lotCount() == 0);
     Lot *lastAdded = nullptr;
@@ -582,36 +612,39 @@ void View::addLots(LotList &&lots, AddLotMode addLotMode)
     bool repeatForRemaining = false;
     bool costQtyAvg = true;
 
+    // The merge candidate for each key is the bottom-most lot in sort order. Lots added by this
+    // transaction are appended to the document, so they replace the candidate for their key.
+    // Merging doesn't change any of the key fields, so pending changes don't matter here.
+    QHash<ConsolidateKey, Lot *> mergeCandidates;
+    if (addLotMode != AddLotMode::AddAsNew) {
+        const auto &documentLots = model()->sortedLots();
+        mergeCandidates.reserve(documentLots.size() + lots.size());
+        for (Lot *documentLot : documentLots) {
+            if (!documentLot->isIncomplete())
+                mergeCandidates.insert(ConsolidateKey(*documentLot), documentLot);
+        }
+    }
+
     for (int i = 0; i < lots.size(); ++i) {
         Lot *lot = lots.at(i);
         bool justAdd = true;
 
-        if (addLotMode != AddLotMode::AddAsNew) {
-            Lot *mergeLot = nullptr;
-
-            const auto documentLots = model()->sortedLots();
-            for (int j = documentLots.count() - 1; j >= 0; --j) {
-                Lot *otherLot = documentLots.at(j);
-                if ((!lot->isIncomplete() && !otherLot->isIncomplete())
-                        && (lot->item() == otherLot->item())
-                        && (lot->color() == otherLot->color())
-                        && (lot->condition() == otherLot->condition())
-                        && ((lot->status() == BrickLink::Status::Exclude) ==
-                            (otherLot->status() == BrickLink::Status::Exclude))) {
-                    mergeLot = otherLot;
-                    break;
-                }
-            }
+        if ((addLotMode != AddLotMode::AddAsNew) && !lot->isIncomplete()) {
+            Lot *mergeLot = mergeCandidates.value(ConsolidateKey(*lot));
 
             if (mergeLot) {
                 int mergeIndex = -1;
 
                 if ((addLotMode == AddLotMode::ConsolidateInteractive) && !repeatForRemaining) {
-                    LotList list { mergeLot, lot };
+                    // show the pending state of the lot, if it was already merged into
+                    Lot pendingLot = transaction.lot(mergeLot);
+                    LotList list { transaction.isChanged(mergeLot) ? &pendingLot : mergeLot, lot };
 
+                    // the copy isn't part of the document, so pass the real index along
                     ConsolidateItemsDialog dlg(this, list,
                                                conMode == Consolidate::IntoExisting ? 0 : 1,
-                                               conMode, i + 1, lots.size(), this);
+                                               conMode, i + 1, lots.size(), this,
+                                               { model()->lotIndex(mergeLot), -1 });
                     bool yesClicked = (dlg.exec() == QDialog::Accepted);
                     repeatForRemaining = dlg.repeatForAll();
                     costQtyAvg = dlg.costQuantityAverage();
@@ -635,23 +668,21 @@ void View::addLots(LotList &&lots, AddLotMode addLotMode)
                 if (mergeIndex >= 0) {
                     justAdd = false;
 
-                    if (!startedMacro) {
-                        m_model->beginMacro();
-                        startedMacro = true;
-                    }
-
                     if (mergeIndex == 0) {
                         // merge new into existing
-                        Lot changedLot = *mergeLot;
+                        Lot changedLot = transaction.lot(mergeLot);
                         changedLot.mergeFrom(*lot, costQtyAvg);
-                        m_model->changeLot(mergeLot, changedLot);
+                        transaction.changeLot(mergeLot, changedLot);
                         delete lot; // we own it, but we don't need it anymore
                     } else {
                         // merge existing into new, add new, remove existing
-                        lot->mergeFrom(*mergeLot, costQtyAvg);
+                        lot->mergeFrom(transaction.lot(mergeLot), costQtyAvg);
                         lot->setDateAdded(QDateTime::currentDateTimeUtc());
-                        m_model->appendLot(std::move(lot)); // pass on ownership
-                        m_model->removeLot(mergeLot);
+                        if (mergeLot == lastAdded)
+                            lastAdded = lot;
+                        mergeCandidates.insert(ConsolidateKey(*lot), lot);
+                        transaction.appendLot(std::move(lot)); // pass on ownership
+                        transaction.removeLot(mergeLot);
                     }
 
                     ++consolidateCount;
@@ -660,20 +691,17 @@ void View::addLots(LotList &&lots, AddLotMode addLotMode)
         }
 
         if (justAdd) {
-            if (!startedMacro) {
-                m_model->beginMacro();
-                startedMacro = true;
-            }
-
             lot->setDateAdded(QDateTime::currentDateTimeUtc());
             lastAdded = lot;
-            m_model->appendLot(std::move(lot));  // pass on ownership to the doc
+            if (!lot->isIncomplete())
+                mergeCandidates.insert(ConsolidateKey(*lot), lot);
+            transaction.appendLot(std::move(lot));  // pass on ownership to the transaction
             ++addCount;
         }
     }
 
-    if (startedMacro)
-        m_model->endMacro(tr("Added %1, consolidated %2 items").arg(addCount).arg(consolidateCount));
+    // all the additions, merges and removals are a single undo step and a single layout change
+    transaction.commit(tr("Added %1, consolidated %2 items").arg(addCount).arg(consolidateCount));
 
     if (wasEmpty)
         m_table->selectRow(0);
@@ -692,35 +720,32 @@ void View::consolidateLots(const LotList &lots)
     if (lots.count() < 2)
         return;
 
+    // group the lots by their key: both the groups and the lots within each group keep the
+    // order of the lots list
     QVector<LotList> mergeList;
-    LotList sourceLots = lots;
-
-    for (int i = 0; i < sourceLots.count(); ++i) {
-        Lot *lot = sourceLots.at(i);
-        LotList mergeLots;
-
-        for (int j = i + 1; j < sourceLots.count(); ++j) {
-            Lot *otherLot = sourceLots.at(j);
-            if ((!lot->isIncomplete() && !otherLot->isIncomplete())
-                    && (lot->item() == otherLot->item())
-                    && (lot->color() == otherLot->color())
-                    && (lot->condition() == otherLot->condition())
-                    && ((lot->status() == BrickLink::Status::Exclude) ==
-                        (otherLot->status() == BrickLink::Status::Exclude))) {
-                mergeLots << sourceLots.takeAt(j--);
-            }
-        }
-        if (mergeLots.isEmpty())
+    QHash<ConsolidateKey, int> mergeListIndex;
+    mergeListIndex.reserve(lots.size());
+
+    for (Lot *lot : lots) {
+        if (lot->isIncomplete())
             continue;
 
-        mergeLots.prepend(sourceLots.at(i));
-        mergeList << mergeLots;
+        auto it = mergeListIndex.constFind(ConsolidateKey(*lot));
+        if (it == mergeListIndex.cend()) {
+            mergeListIndex.insert(ConsolidateKey(*lot), mergeList.size());
+            mergeList.append({ lot });
+        } else {
+            mergeList[*it].append(lot);
+        }
     }
+    mergeList.erase(std::remove_if(mergeList.begin(), mergeList.end(), [](const LotList &mergeLots) {
+        return mergeLots.size() < 2;
+    }), mergeList.end());
 
     if (mergeList.isEmpty())
         return;
 
-    bool startedMacro = false;
+    DocumentModel::Transaction transaction(m_model);
 
     auto conMode = Consolidate::IntoLowestIndex;
     bool repeatForRemaining = false;
@@ -755,24 +780,18 @@ void View::consolidateLots(const LotList &lots)
             mergeIndex = consolidateLotsHelper(mergeLots, conMode);
         }
 
-        if (!startedMacro) {
-            m_model->beginMacro();
-            startedMacro = true;
-        }
-
         Lot newitem = *mergeLots.at(mergeIndex);
         for (int i = 0; i < mergeLots.count(); ++i) {
             if (i != mergeIndex) {
                 newitem.mergeFrom(*mergeLots.at(i), costQtyAvg);
-                m_model->removeLot(mergeLots.at(i));
+                transaction.removeLot(mergeLots.at(i));
             }
         }
-        m_model->changeLot(mergeLots.at(mergeIndex), newitem);
+        transaction.changeLot(mergeLots.at(mergeIndex), newitem);
 
         ++consolidateCount;
     }
-    if (startedMacro)
-        m_model->endMacro(tr("Consolidated %n item(s)", nullptr, consolidateCount));
+    transaction.commit(tr("Consolidated %n item(s)", nullptr, consolidateCount));
 }
 
 int View::consolidateLotsHelper(const LotList &lots, Consolidate conMode) const
@@ -783,16 +802,14 @@ int View::consolidateLotsHelper(const LotList &lots, Consolidate conMode) const
     case Consolidate::IntoBottomSorted:
         return lots.count() - 1;
     case Consolidate::IntoLowestIndex: {
-        const auto di = model()->lots();
-        auto it = std::min_element(lots.cbegin(), lots.cend(), [di](const auto &a, const auto &b) {
-            return di.indexOf(a) < di.indexOf(b);
+        auto it = std::min_element(lots.cbegin(), lots.cend(), [this](const auto &a, const auto &b) {
+            return model()->lotIndex(a) < model()->lotIndex(b);
         });
         return int(std::distance(lots.cbegin(), it));
     }
     case Consolidate::IntoHighestIndex: {
-        const auto di = model()->lots();
-        auto it = std::max_element(lots.cbegin(), lots.cend(), [di](const auto &a, const auto &b) {
-            return di.indexOf(a) < di.indexOf(b);
+        auto it = std::max_element(lots.cbegin(), lots.cend(), [this](const auto &a, const auto &b) {
+            return model()->lotIndex(a) < model()->lotIndex(b);
         });
         return int(std::distance(lots.cbegin(), it));
     }
@@ -822,9 +839,7 @@ QCoro::Task<> View::partOutItems()
             }
         }
 
-        if (inplace)
-            m_model->beginMacro();
-
+        DocumentModel::Transaction transaction(m_model);
         int partcount = 0;
 
         foreach(Lot *lot, selectedLots()) {
@@ -854,8 +869,8 @@ QCoro::Task<> View::partOutItems()
 
                             newLots << newLot;
                         }
-                        m_model->insertLotsAfter(lot, std::move(newLots));
-                        m_model->removeLot(lot);
+                        transaction.insertLotsAfter(lot, std::move(newLots));
+                        transaction.removeLot(lot);
                         partcount++;
                     }
                 }
@@ -865,7 +880,7 @@ QCoro::Task<> View::partOutItems()
             }
         }
         if (inplace)
-            m_model->endMacro(tr("Parted out %n item(s)", nullptr, partcount));
+            transaction.commit(tr("Parted out %n item(s)", nullptr, partcount));
     }
     else
         QApplication::beep();
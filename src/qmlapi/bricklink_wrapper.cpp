@@ -272,14 +272,22 @@ void QmlBrickLink::cacheStat() const
     auto pic = BrickLink::core()->pictureCacheStats();
     auto pg = BrickLink::core()->priceGuideCacheStats();
 
-    QByteArray picBar(int(double(pic.first) / pic.second * 16), '=');
-    picBar.append(16 - picBar.length(), ' ');
-    QByteArray pgBar(int(double(pg.first) / pg.second * 16), '=');
-    pgBar.append(16 - pgBar.length(), ' ');
+    auto bar = [](double cur, double max) {
+        QByteArray ba(qMin(16, int(cur / max * 16)), '=');
+        ba.append(16 - ba.length(), ' ');
+        return ba;
+    };
+    QByteArray picBar = bar(pic.hotBytes, pic.hotBudget);
+    QByteArray picWarmBar = bar(pic.warmBytes, pic.warmBudget);
+    QByteArray pgBar = bar(pg.first, pg.second);
 
     qmlDebug(this) << "Cache stats:\n"
-                   << "Pictures    : [" << picBar.constData() << "] " << (pic.first / 1000)
-                   << " / " << (pic.second / 1000) << " MB\n"
+                   << "Pictures    : [" << picBar.constData() << "] " << (pic.hotBytes / 1000000)
+                   << " / " << (pic.hotBudget / 1000000) << " MB decoded\n"
+                   << "              [" << picWarmBar.constData() << "] " << (pic.warmBytes / 1000000)
+                   << " / " << (pic.warmBudget / 1000000) << " MB compressed\n"
+                   << "              " << pic.hits << " hits, " << pic.warmHits << " warm hits, "
+                   << pic.misses << " misses, " << pic.evictions << " evictions\n"
                    << "Price guides: [" << pgBar.constData() << "] " << (pg.first)
                    << " / " << pg.second << " entries";
 }
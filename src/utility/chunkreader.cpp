@@ -33,6 +33,17 @@ on-disk format for every chunk (bits / field):
 
  ----------------------------------------------
 
+optional directory as the last child chunk of a parent (ID 'CDIR', VERSION 1):
+ * 32 COUNT
+
+ * COUNT times:
+   * 32 ID
+   * 32 VERSION
+   * 64 OFFSET  (absolute position of the child's data)
+   * 64 SIZE
+
+ ----------------------------------------------
+
 example:
 
     QFile f(...);
@@ -111,6 +122,78 @@ bool ChunkReader::skipChunk()
     return (m_stream.status() == QDataStream::Ok);
 }
 
+QVector<ChunkDirectoryEntry> ChunkReader::directory()
+{
+    // Returns all the child chunks of the current chunk. If the chunk was written with a
+    // directory, we can just read that one from the end of the chunk. Otherwise we have to walk
+    // over all the children.
+    // The current device position is not changed.
+
+    QVector<ChunkDirectoryEntry> dir;
+
+    if (!m_file || m_chunks.isEmpty() || (m_stream.status() != QDataStream::Ok))
+        return dir;
+
+    const read_chunk_info parent = m_chunks.top();
+    const qint64 oldpos = m_file->pos();
+    const qint64 parentEnd = parent.startpos + parent.size;
+
+    auto readDirectoryChunk = [&]() -> bool {
+        if ((parent.size < 32) || !m_file->seek(parentEnd - 16))
+            return false;
+
+        read_chunk_info ci;
+        m_stream >> ci.size >> ci.version >> ci.id;
+        if ((m_stream.status() != QDataStream::Ok) || (ci.id != ChunkDirectoryId)
+                || (ci.version != 1) || (ci.size < 4) || (ci.size > parent.size)) {
+            return false;
+        }
+        ci.startpos = parentEnd - 16 - ((ci.size % 16) ? (16 - ci.size % 16) : 0) - ci.size;
+
+        if ((ci.startpos - 16) < parent.startpos || !m_file->seek(ci.startpos - 16))
+            return false;
+
+        read_chunk_info cistart;
+        m_stream >> cistart.id >> cistart.version >> cistart.size;
+        if ((cistart.id != ci.id) || (cistart.version != ci.version) || (cistart.size != ci.size))
+            return false;
+
+        quint32 count = 0;
+        m_stream >> count;
+        if (qint64(count) * 24 + 4 > ci.size)
+            return false;
+
+        dir.reserve(int(count));
+        while (count--) {
+            ChunkDirectoryEntry e;
+            m_stream >> e.id >> e.version >> e.offset >> e.size;
+            if ((e.offset < parent.startpos) || ((e.offset + e.size) > parentEnd))
+                return false;
+            dir << e;
+        }
+        return (m_stream.status() == QDataStream::Ok);
+    };
+
+    if (!readDirectoryChunk()) {
+        dir.clear();
+        m_stream.resetStatus();
+        m_file->seek(parent.startpos);
+
+        while (startChunk()) {
+            const read_chunk_info &ci = m_chunks.top();
+            dir.append({ ci.id, ci.version, ci.startpos, ci.size });
+            bool ok = skipChunk();
+            if (!endChunk() || !ok) {
+                dir.clear();
+                break;
+            }
+        }
+        m_stream.resetStatus();
+    }
+    m_file->seek(oldpos);
+    return dir;
+}
+
 bool ChunkReader::endChunk()
 {
     if (!m_file || m_chunks.isEmpty())
@@ -228,5 +311,25 @@ bool ChunkWriter::endChunk()
 
     m_stream << len << ci.version << ci.id;
 
+    if (!m_chunks.isEmpty())
+        m_chunks.top().children.append({ ci.id, ci.version, ci.startpos, len });
+
     return (m_stream.status() == QDataStream::Ok);
 }
+
+bool ChunkWriter::writeDirectory()
+{
+    if (!m_file || m_chunks.isEmpty())
+        return false;
+
+    const auto children = m_chunks.top().children;
+
+    if (!startChunk(ChunkDirectoryId, 1))
+        return false;
+
+    m_stream << quint32(children.size());
+    for (const auto &e : children)
+        m_stream << e.id << e.version << e.offset << e.size;
+
+    return endChunk();
+}
@@ -16,11 +16,21 @@
 
 #include <QDataStream>
 #include <QStack>
+#include <QVector>
 
 QT_FORWARD_DECLARE_CLASS(QIODevice)
 
 #define ChunkId(a,b,c,d)    quint32((quint32(d & 0x7f) << 24) | (quint32(c & 0x7f) << 16) | (quint32(b & 0x7f) << 8) | quint32(a & 0x7f))
 
+#define ChunkDirectoryId    ChunkId('C','D','I','R')
+
+struct ChunkDirectoryEntry {
+    quint32 id;
+    quint32 version;
+    qint64 offset;  // absolute device position of the chunk's data
+    qint64 size;    // size of the chunk's data (without padding)
+};
+
 class ChunkReader {
 public:
     ChunkReader(QIODevice *dev, QDataStream::ByteOrder bo);
@@ -31,6 +41,8 @@ public:
     bool endChunk();
     bool skipChunk();
 
+    QVector<ChunkDirectoryEntry> directory();
+
     quint32 chunkId() const;
     quint32 chunkVersion() const;
     qint64 chunkSize() const;
@@ -58,11 +70,14 @@ public:
     bool startChunk(quint32 id, quint32 version = 0);
     bool endChunk();
 
+    bool writeDirectory();
+
 private:
     struct write_chunk_info {
         quint32 id;
         quint32 version;
         qint64 startpos;
+        QVector<ChunkDirectoryEntry> children;
     };
 
     QStack<write_chunk_info> m_chunks;
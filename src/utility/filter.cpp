@@ -40,6 +40,7 @@ void Filter::setField(int field)
 void Filter::setExpression(const QString &expr)
 {
     m_expression = expr;
+    m_caseFoldedExpression = expr.toCaseFolded();
 
     QLocale loc;
     bool isInt = false;
@@ -68,73 +69,103 @@ void Filter::setCombination(Combination cmb)
 
 bool Filter::matches(const QVariant &v) const
 {
-    bool isInt = false;
-    qint64 i1 = 0, i2 = 0;
-    QString s1, s2;
-    
     switch (v.userType()) {
     case QMetaType::Int:
     case QMetaType::UInt:
     case QMetaType::LongLong:
-    case QMetaType::ULongLong: {
-        if (!m_isInt)
-            return false; // data is int, but expression is not
-        i1 = m_asInt;
-        i2 = v.toInt();
-        isInt = true;
-        break;
-    }   
-    case QMetaType::Double: {
-        if (!m_isDouble)
-            return false;
-        i1 = qRound64(m_asDouble * 1000.);
-        i2 = qRound64(v.toDouble() * 1000.);
-        isInt = true;
-        break;
-    }    
+    case QMetaType::ULongLong:
+        return matchesInt(v.toLongLong());
+    case QMetaType::Double:
+        return matchesDouble(v.toDouble());
     default:
-        s1 = m_expression;
-        s2 = v.toString();
-        break;
+        return matchesString(v.toString());
     }
+}
+
+bool Filter::matchesInt(qint64 i) const
+{
+    if (!m_isInt)
+        return false; // data is int, but expression is not
+    return matchesNumber(m_asInt, i, [i]() { return QString::number(i); });
+}
+
+bool Filter::matchesDouble(double d) const
+{
+    if (!m_isDouble)
+        return false;
+    return matchesNumber(qRound64(m_asDouble * 1000.), qRound64(d * 1000.),
+                         [d]() { return QVariant(d).toString(); });
+}
 
+template <typename F> bool Filter::matchesNumber(qint64 i1, qint64 i2, F toString) const
+{
+    switch (comparison()) {
+    case Is:           return i2 == i1;
+    case IsNot:        return i2 != i1;
+    case Less:         return i2 < i1;
+    case LessEqual:    return i2 <= i1;
+    case Greater:      return i2 > i1;
+    case GreaterEqual: return i2 >= i1;
+    case Matches:
+    case DoesNotMatch: return matchesString(toString());
+    default:           return false;
+    }
+}
+
+bool Filter::matchesString(const QString &s) const
+{
     switch (comparison()) {
     case Is:
-        return isInt ? i2 == i1 : s2.compare(s1, Qt::CaseInsensitive) == 0;
+        return s.compare(m_expression, Qt::CaseInsensitive) == 0;
     case IsNot:
-        return isInt ? i2 != i1 : s2.compare(s1, Qt::CaseInsensitive) != 0;
-    case Less:
-        return isInt ? i2 < i1 : false;
-    case LessEqual:
-        return isInt ? i2 <= i1 : false;
-    case Greater:
-        return isInt ? i2 > i1 : false;
-    case GreaterEqual:
-        return isInt ? i2 >= i1 : false;
+        return s.compare(m_expression, Qt::CaseInsensitive) != 0;
     case StartsWith:
-        return isInt ? false : s2.startsWith(s1, Qt::CaseInsensitive);
+        return s.startsWith(m_expression, Qt::CaseInsensitive);
     case DoesNotStartWith:
-        return isInt ? false : !s2.startsWith(s1, Qt::CaseInsensitive);
+        return !s.startsWith(m_expression, Qt::CaseInsensitive);
     case EndsWith:
-        return isInt ? false : s2.endsWith(s1, Qt::CaseInsensitive);
+        return s.endsWith(m_expression, Qt::CaseInsensitive);
     case DoesNotEndWith:
-        return isInt ? false : !s2.endsWith(s1, Qt::CaseInsensitive);
+        return !s.endsWith(m_expression, Qt::CaseInsensitive);
     case Matches:
     case DoesNotMatch: {
+        bool res;
         if (m_isRegExp) {
             // We are using QRegularExpressions in multiple threads here, although the class is not
             // marked thread-safe. We are relying on the const match() function to be thread-safe,
             // which it currently is up to Qt 6.0.
 
-            bool res = m_asRegExp.match(v.toString()).hasMatch();
-            return (comparison() == Matches) ? res : !res;
+            res = m_asRegExp.match(s).hasMatch();
         } else {
-            bool res = v.toString().contains(m_expression, Qt::CaseInsensitive);
-            return (comparison() == Matches) ? res : !res;
+            res = s.contains(m_expression, Qt::CaseInsensitive);
         }
+        return (comparison() == Matches) ? res : !res;
+    }
+    default:
+        return false;
     }
+}
+
+bool Filter::matchesCaseFolded(QStringView s) const
+{
+    const QStringView e = m_caseFoldedExpression;
+
+    switch (comparison()) {
+    case Is:               return s == e;
+    case IsNot:            return s != e;
+    case StartsWith:       return s.startsWith(e);
+    case DoesNotStartWith: return !s.startsWith(e);
+    case EndsWith:         return s.endsWith(e);
+    case DoesNotEndWith:   return !s.endsWith(e);
+    case Matches:
+    case DoesNotMatch: {
+        // the regexp is case insensitive anyway
+        bool res = m_isRegExp ? m_asRegExp.match(s.toString()).hasMatch() : s.contains(e);
+        return (comparison() == Matches) ? res : !res;
+    }
+    default:
+        return false;
     }
-    return false;
 }
 
 QString Filter::Parser::toString(const QVector<Filter> &filter, bool preferSymbolic) const
@@ -65,6 +65,8 @@ public:
     inline QString expression() const       { return m_expression; }
     inline Comparison comparison() const    { return m_comparison; }
     inline Combination combination() const  { return m_combination; }
+    inline QString caseFoldedExpression() const { return m_caseFoldedExpression; }
+    inline bool isWildcard() const          { return m_isRegExp; }
     
     void setField(int field);
     void setExpression(const QString &expr);
@@ -72,7 +74,14 @@ public:
     void setCombination(Combination cmb);
 
     bool matches(const QVariant &v) const;
-    
+
+    // typed versions of matches(), for callers that have the raw values at hand
+    bool matchesInt(qint64 i) const;
+    bool matchesDouble(double d) const;
+    bool matchesString(const QString &s) const;
+    // a lot faster, but only works for values that have been QString::toCaseFolded() already
+    bool matchesCaseFolded(QStringView s) const;
+
 
     class Parser {
     public:
@@ -112,7 +121,10 @@ public:
     };
     
 private:
+    template <typename F> bool matchesNumber(qint64 i1, qint64 i2, F toString) const;
+
     QString     m_expression;
+    QString     m_caseFoldedExpression;
     int         m_field = -1;
     Comparison  m_comparison = Matches;
     Combination m_combination = And;
@@ -0,0 +1,123 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include <QtCore/QtGlobal>
+
+
+// A minimal, read-only array of trivially copyable values.
+// The data is either owned (when built at runtime, e.g. by the TextImport) or just a view into
+// an external memory pool that outlives the array (e.g. the memory mapped database file).
+// Copying a view is as cheap as copying a pointer.
+
+template <typename T>
+class PooledArray
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    typedef T value_type;
+    typedef const T *const_iterator;
+    typedef const_iterator iterator;
+
+    PooledArray() = default;
+    PooledArray(const std::vector<T> &v)
+    {
+        assign(v.data(), v.size());
+    }
+    template <typename Container>
+    PooledArray(const Container &c)
+    {
+        assign(c.constData(), size_t(c.size()));
+    }
+    PooledArray(const PooledArray &other)
+    {
+        if (other.m_owned) {
+            assign(other.m_data, other.m_size);
+        } else {
+            m_data = other.m_data;
+            m_size = other.m_size;
+        }
+    }
+    PooledArray(PooledArray &&other) noexcept
+    {
+        swap(other);
+    }
+    ~PooledArray()
+    {
+        if (m_owned)
+            delete [] m_data;
+    }
+
+    PooledArray &operator=(PooledArray other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(PooledArray &other) noexcept
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_owned, other.m_owned);
+    }
+
+    static PooledArray fromRawData(const T *data, quint32 size)
+    {
+        PooledArray pa;
+        pa.m_data = const_cast<T *>(data);
+        pa.m_size = size;
+        return pa;
+    }
+
+    bool isRawData() const          { return !m_owned && m_data; }
+
+    const T *constData() const      { return m_data; }
+    const T *data() const           { return m_data; }
+    quint32 size() const            { return m_size; }
+    int count() const               { return int(m_size); }
+    bool isEmpty() const            { return !m_size; }
+    bool empty() const              { return !m_size; }
+
+    const T &at(quint32 i) const    { Q_ASSERT(i < m_size); return m_data[i]; }
+    const T &operator[](quint32 i) const { return at(i); }
+    const T &front() const          { return at(0); }
+    const T &back() const           { return at(m_size - 1); }
+
+    const_iterator begin() const    { return m_data; }
+    const_iterator end() const      { return m_data + m_size; }
+    const_iterator cbegin() const   { return m_data; }
+    const_iterator cend() const     { return m_data + m_size; }
+
+private:
+    void assign(const T *data, size_t size)
+    {
+        Q_ASSERT(!m_data);
+        if (size) {
+            m_data = new T[size];
+            m_size = quint32(size);
+            m_owned = true;
+            std::memcpy(static_cast<void *>(m_data), data, size * sizeof(T));
+        }
+    }
+
+    T *m_data = nullptr;
+    quint32 m_size = 0;
+    bool m_owned = false;
+};
@@ -0,0 +1,227 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QDebug>
+
+
+// A single, append-only file of fixed-size records. Saving a record appends it to the file and
+// the in-memory index always points to the newest record with the same indexKey(). Superseded
+// records are dropped by compacting the file when it is opened.
+// All functions are thread-safe.
+
+template <typename Record, typename Key>
+class RecordFile
+{
+    static_assert(std::is_trivially_copyable_v<Record>);
+
+public:
+    // the name is only used as a prefix for warnings
+    RecordFile(const QString &fileName, const char *name, quint32 magic, quint32 version)
+        : m_file(fileName)
+        , m_name(QByteArray(name) + ':')
+        , m_magic(magic)
+        , m_version(version)
+    { }
+
+    ~RecordFile()
+    {
+        m_file.close();
+    }
+
+    bool contains(const Key &key)
+    {
+        QMutexLocker locker(&m_mutex);
+        return open() && m_index.contains(key);
+    }
+
+    bool load(const Key &key, Record &record)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!open())
+            return false;
+
+        auto it = m_index.constFind(key);
+        if (it == m_index.cend())
+            return false;
+
+        return m_file.seek(*it)
+                && (m_file.read(reinterpret_cast<char *>(&record), sizeof(Record)) == qint64(sizeof(Record)))
+                && (record.indexKey() == key);
+    }
+
+    bool save(const Record &record)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!open())
+            return false;
+
+        const qint64 offset = m_file.size();
+        if (!m_file.seek(offset)
+                || (m_file.write(reinterpret_cast<const char *>(&record), sizeof(Record)) != qint64(sizeof(Record)))) {
+            qWarning() << m_name.constData() << "could not append to" << m_file.fileName() << ":"
+                       << m_file.errorString();
+            m_file.resize(offset); // do not leave a partial record behind
+            return false;
+        }
+        const Key key = record.indexKey();
+        if (m_index.contains(key))
+            ++m_supersededRecords;
+        m_index.insert(key, offset);
+        return true;
+    }
+
+private:
+    struct Header {
+        quint32 magic;
+        quint32 version;
+        quint32 recordSize;
+        quint32 reserved;
+    };
+
+    bool open()
+    {
+        if (m_opened)
+            return m_file.isOpen();
+        m_opened = true;
+
+        if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+            qWarning() << m_name.constData() << "could not open" << m_file.fileName() << ":"
+                       << m_file.errorString();
+            return false;
+        }
+
+        Header header;
+        if ((m_file.read(reinterpret_cast<char *>(&header), sizeof(header)) != qint64(sizeof(header)))
+                || (header.magic != m_magic)
+                || (header.version != m_version)
+                || (header.recordSize != sizeof(Record))) {
+            return reset();
+        }
+
+        // build the index: later records supersede earlier ones with the same key
+        const qint64 recordCount = (m_file.size() - qint64(sizeof(Header))) / qint64(sizeof(Record));
+        std::vector<Record> block(4096);
+        qint64 offset = sizeof(Header);
+
+        for (qint64 i = 0; i < recordCount; ) {
+            const qint64 count = std::min(qint64(block.size()), recordCount - i);
+            const qint64 bytes = count * qint64(sizeof(Record));
+
+            if (m_file.read(reinterpret_cast<char *>(block.data()), bytes) != bytes) {
+                qWarning() << m_name.constData() << "could not read" << m_file.fileName() << ":"
+                           << m_file.errorString();
+                return reset();
+            }
+            for (qint64 j = 0; j < count; ++j, offset += qint64(sizeof(Record)))
+                m_index.insert(block[size_t(j)].indexKey(), offset);
+            i += count;
+        }
+
+        // a partial record at the end is the result of an interrupted write
+        if (m_file.size() != offset)
+            m_file.resize(offset);
+
+        m_supersededRecords = recordCount - m_index.size();
+        if ((m_supersededRecords > 1000) && (m_supersededRecords > m_index.size()))
+            compact();
+
+        return m_file.isOpen();
+    }
+
+    bool reset()
+    {
+        m_index.clear();
+        m_supersededRecords = 0;
+
+        Header header = { m_magic, m_version, sizeof(Record), 0 };
+
+        if (!m_file.resize(0) || !m_file.seek(0)
+                || (m_file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header)))) {
+            qWarning() << m_name.constData() << "could not initialize" << m_file.fileName() << ":"
+                       << m_file.errorString();
+            m_file.close();
+            return false;
+        }
+        return true;
+    }
+
+    void compact()
+    {
+        // read all live records in file order ...
+        std::vector<qint64> offsets;
+        offsets.reserve(size_t(m_index.size()));
+        for (auto it = m_index.cbegin(); it != m_index.cend(); ++it)
+            offsets.push_back(it.value());
+        std::sort(offsets.begin(), offsets.end());
+
+        std::vector<Record> records(offsets.size());
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            if (!m_file.seek(offsets[i])
+                    || (m_file.read(reinterpret_cast<char *>(&records[i]), sizeof(Record)) != qint64(sizeof(Record)))) {
+                return; // just keep on using the uncompacted file
+            }
+        }
+
+        // ... and atomically replace the file with just these records
+        QSaveFile sf(m_file.fileName());
+        Header header = { m_magic, m_version, sizeof(Record), 0 };
+        const qint64 recordBytes = qint64(records.size() * sizeof(Record));
+
+        if (!sf.open(QIODevice::WriteOnly)
+                || (sf.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header)))
+                || (sf.write(reinterpret_cast<const char *>(records.data()), recordBytes) != recordBytes)) {
+            return;
+        }
+
+        m_file.close(); // Windows can not replace open files
+        bool committed = sf.commit();
+
+        if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+            qWarning() << m_name.constData() << "could not re-open" << m_file.fileName() << ":"
+                       << m_file.errorString();
+            m_index.clear();
+            return;
+        }
+        if (committed) {
+            m_index.clear();
+            qint64 offset = sizeof(Header);
+            for (const Record &r : records) {
+                m_index.insert(r.indexKey(), offset);
+                offset += qint64(sizeof(Record));
+            }
+            m_supersededRecords = 0;
+        }
+    }
+
+    QMutex m_mutex;
+    QFile m_file;
+    const QByteArray m_name;
+    const quint32 m_magic;
+    const quint32 m_version;
+    bool m_opened = false;
+    QHash<Key, qint64> m_index; // key -> file offset of the newest record
+    qint64 m_supersededRecords = 0;
+};
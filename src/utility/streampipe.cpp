@@ -0,0 +1,121 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#include <cstring>
+
+#include <QMutexLocker>
+
+#include "streampipe.h"
+
+
+StreamPipe::StreamPipe(QObject *parent)
+    : QIODevice(parent)
+{
+    // unbuffered, because QIODevice's own buffers are not thread-safe
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+StreamPipe::~StreamPipe()
+{
+    abort(QString { });
+}
+
+void StreamPipe::closeWriteChannel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_writeChannelClosed = true;
+    m_condition.wakeAll();
+}
+
+void StreamPipe::abort(const QString &errorString)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_aborted)
+        return;
+    m_aborted = true;
+    m_writeChannelClosed = true;
+    m_chunks.clear();
+    m_offset = m_size = 0;
+    if (!errorString.isEmpty())
+        setErrorString(errorString);
+    m_condition.wakeAll();
+}
+
+bool StreamPipe::isSequential() const
+{
+    return true;
+}
+
+bool StreamPipe::atEnd() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_writeChannelClosed && !m_size;
+}
+
+qint64 StreamPipe::bytesAvailable() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_size + QIODevice::bytesAvailable();
+}
+
+qint64 StreamPipe::bytesToWrite() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_size;
+}
+
+qint64 StreamPipe::readData(char *data, qint64 maxSize)
+{
+    qint64 done = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_size && !m_writeChannelClosed)
+            m_condition.wait(&m_mutex);
+
+        if (m_aborted)
+            return -1;
+
+        while ((done < maxSize) && !m_chunks.empty()) {
+            const QByteArray &chunk = m_chunks.front();
+            qint64 n = qMin(maxSize - done, chunk.size() - m_offset);
+            memcpy(data + done, chunk.constData() + m_offset, size_t(n));
+            done += n;
+            m_offset += n;
+            if (m_offset == chunk.size()) {
+                m_chunks.pop_front();
+                m_offset = 0;
+            }
+        }
+        m_size -= done;
+    }
+    if (done)
+        emit bytesWritten(done);
+    return done;
+}
+
+qint64 StreamPipe::writeData(const char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_writeChannelClosed) {
+        setErrorString(tr("The write channel has been closed"));
+        return -1;
+    }
+    if (maxSize > 0) {
+        m_chunks.emplace_back(data, int(maxSize));
+        m_size += maxSize;
+        m_condition.wakeAll();
+    }
+    return maxSize;
+}
+
+#include "moc_streampipe.cpp"
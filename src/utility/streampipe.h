@@ -0,0 +1,59 @@
+/* Copyright (C) 2004-2021 Robert Griebl. All rights reserved.
+**
+** This file is part of BrickStore.
+**
+** This file may be distributed and/or modified under the terms of the GNU
+** General Public License version 2 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
+*/
+#pragma once
+
+#include <deque>
+
+#include <QIODevice>
+#include <QMutex>
+#include <QWaitCondition>
+
+
+// A thread-safe FIFO between one writer and one reader thread, e.g. a TransferJob writing the
+// data it receives and a parser consuming it at the same time on a worker thread.
+// Writing never blocks, but reading blocks until there is data or until the write channel
+// has been closed. The data that hasn't been read yet is reported via bytesToWrite() and
+// reading it emits bytesWritten(), so a writer can throttle itself.
+
+class StreamPipe : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    StreamPipe(QObject *parent = nullptr);
+    ~StreamPipe() override;
+
+    void closeWriteChannel();
+    void abort(const QString &errorString);
+
+    bool isSequential() const override;
+    bool atEnd() const override;
+    qint64 bytesAvailable() const override;
+    qint64 bytesToWrite() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    std::deque<QByteArray> m_chunks;
+    qint64 m_offset = 0; // into the first chunk
+    qint64 m_size = 0;
+    bool m_writeChannelClosed = false;
+    bool m_aborted = false;
+
+    Q_DISABLE_COPY(StreamPipe)
+};
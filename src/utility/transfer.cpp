@@ -12,6 +12,8 @@
 ** See http://fsf.org/licensing/licenses/gpl.html for GPL licensing information.
 */
 
+#include <algorithm>
+
 #include <QThread>
 #include <QFile>
 #include <QLocale>
@@ -48,6 +50,17 @@ TransferJob *TransferJob::getIfNewer(const QUrl &url, const QDateTime &ifnewer,
     return create(HttpGet, url, ifnewer, file, false);
 }
 
+TransferJob *TransferJob::getIfChanged(const QUrl &url, const QByteArray &etag,
+                                      const QDateTime &lastModified, QIODevice *file, uint retries)
+{
+    Q_ASSERT(retries < 31);
+
+    auto *j = create(HttpGet, url, lastModified, file, false, retries);
+    if (j)
+        j->m_only_if_none_match = etag;
+    return j;
+}
+
 TransferJob *TransferJob::post(const QUrl &url, QIODevice *file, bool noRedirects)
 {
     return create(HttpPost, url, QDateTime(), file, noRedirects);
@@ -161,8 +174,18 @@ void Transfer::retrieve(TransferJob *job, bool highPriority)
     Q_ASSERT(!job->m_transfer);
     job->m_transfer = this;
 
-    QMetaObject::invokeMethod(m_retriever, [this, job, highPriority]() {
-        m_retriever->addJob(job, highPriority);
+    if (highPriority)
+        job->setPriority(TransferJob::HighPriority);
+
+    QMetaObject::invokeMethod(m_retriever, [this, job]() {
+        m_retriever->addJob(job);
+    }, Qt::QueuedConnection);
+}
+
+void Transfer::raisePriority(TransferJob *job, TransferJob::Priority priority)
+{
+    QMetaObject::invokeMethod(m_retriever, [this, job, priority]() {
+        m_retriever->raisePriority(job, priority);
     }, Qt::QueuedConnection);
 }
 
@@ -196,61 +219,246 @@ QString Transfer::defaultUserAgent()
 
 #include "moc_transfer.cpp"
 
+// QNAM itself uses up to 6 connections per host for HTTP/1.1, but HTTP/2 can multiplex a lot
+// more requests over a single connection
+static constexpr int MinConnectionsPerHost = 1;
+static constexpr int MaxConnectionsPerHost = 12;
+
+// BrickLink sometimes answers with a 404 for a short time, so don't remember these for long
+static constexpr int NotFoundCacheTime = 60 * 1000;
+
+// The payload is handed over to the job's target in chunks while it is being received. If the
+// target can't keep up, we stop reading once this much data is pending.
+static constexpr qint64 StreamChunkSize = 64 * 1024;
+static constexpr qint64 StreamBufferSize = 1024 * 1024;
+
+bool TransferRetriever::Host::hasJobs() const
+{
+    return std::any_of(jobs.cbegin(), jobs.cend(), [](const auto &queue) {
+        return !queue.isEmpty();
+    });
+}
+
+bool TransferRetriever::Host::canStart(TransferJob::Priority priority) const
+{
+    if (!pausedUntil.hasExpired())
+        return false;
+
+    // one extra connection is reserved for high priority jobs: bulk downloads should never
+    // starve the one picture the user is actually looking at
+    int limit = maxConnections + ((priority == TransferJob::HighPriority) ? 1 : 0);
+    return activeJobs < limit;
+}
+
 TransferRetriever::TransferRetriever(Transfer *transfer)
     : QObject()
     , m_transfer(transfer)
-    , m_maxConnections(4) // mirror the internal QNAM setting
 { }
 
 TransferRetriever::~TransferRetriever()
 {
     abortAllJobs();
+    qDeleteAll(m_hosts);
 }
 
-void TransferRetriever::addJob(TransferJob *job, bool highPriority)
+TransferRetriever::Host *TransferRetriever::host(const TransferJob *job)
+{
+    Host *&h = m_hosts[job->url().host()];
+    if (!h) {
+        h = new Host;
+        m_hostOrder.append(h);
+    }
+    return h;
+}
+
+bool TransferRetriever::canBeCoalesced(const TransferJob *job)
+{
+    // conditional requests depend on the caller's state, so they can't be shared
+    return (job->m_http_method == TransferJob::HttpGet) && !job->m_only_if_newer.isValid()
+            && job->m_only_if_none_match.isEmpty();
+}
+
+void TransferRetriever::addJob(TransferJob *job)
 {
     if (job->isAborted()) {
         emit finished(job);
         emit m_transfer->overallProgress(++m_progressDone, ++m_progressTotal);
-    } else {
-        if (highPriority)
-            m_jobs.prepend(job);
-        else
-            m_jobs.append(job);
+        return;
+    }
 
-        emit m_transfer->overallProgress(m_progressDone, ++m_progressTotal);
-        schedule();
+    ++m_progressTotal;
+
+    if (canBeCoalesced(job)) {
+        auto nf = m_notFound.constFind(job->url());
+        if (nf != m_notFound.cend()) {
+            if (!nf->expires.hasExpired()) {
+                qCInfo(LogTransfer) << "<< CACHED 404" << job->url();
+                job->m_effective_url = job->url();
+                job->m_respcode = 404;
+                job->m_error_string = nf->errorString;
+                job->setStatus(TransferJob::Failed);
+                finishJob(job);
+                return;
+            }
+            m_notFound.erase(nf);
+        }
+
+        // a job that is already streaming its payload can't be shared anymore
+        TransferJob *leader = m_jobsByUrl.value(job->url());
+        if (leader && !leader->m_has_data) {
+            qCInfo(LogTransfer) << "== COALESCED" << job->url();
+            m_coalescedJobs[leader].append(job);
+
+            // a queued job inherits the highest priority of all the requests it serves
+            if ((job->priority() > leader->priority()) && !leader->isActive()) {
+                host(leader)->jobs[leader->priority()].removeOne(leader);
+                leader->setPriority(job->priority());
+                queueJob(leader);
+                schedule(); // it might be able to use the extra high priority connection now
+            }
+            emit m_transfer->overallProgress(m_progressDone, m_progressTotal);
+            return;
+        }
+        m_jobsByUrl.insert(job->url(), job);
     }
+
+    queueJob(job);
+    emit m_transfer->overallProgress(m_progressDone, m_progressTotal);
+    schedule();
+}
+
+void TransferRetriever::queueJob(TransferJob *job)
+{
+    auto &queue = host(job)->jobs[job->priority()];
+
+    // the most recent high priority request is the one the user is waiting for
+    if (job->priority() == TransferJob::HighPriority)
+        queue.prepend(job);
+    else
+        queue.append(job);
+}
+
+void TransferRetriever::finishJob(TransferJob *job)
+{
+    emit overallProgress(++m_progressDone, m_progressTotal);
+    if (m_progressDone == m_progressTotal)
+        m_progressDone = m_progressTotal = 0;
+
+    emit finished(job); // the thread adapter lambda in Transfer will delete the job
 }
 
 void TransferRetriever::abortJob(TransferJob *j)
 {
+    // a request that was coalesced into another one can simply be dropped
+    for (auto it = m_coalescedJobs.begin(); it != m_coalescedJobs.end(); ++it) {
+        if (it->removeOne(j)) {
+            if (it->isEmpty())
+                m_coalescedJobs.erase(it);
+            j->abortInternal();
+            finishJob(j);
+            return;
+        }
+    }
+
+    // the other requests for the same URL still need this one: hand it over to the first of them
+    const auto coalesced = m_coalescedJobs.take(j);
+    if (!coalesced.isEmpty()) {
+        TransferJob *leader = coalesced.constFirst();
+        if (coalesced.size() > 1)
+            m_coalescedJobs.insert(leader, coalesced.mid(1));
+        m_jobsByUrl.insert(j->url(), leader);
+
+        if (j->m_reply) {
+            leader->m_reply = j->m_reply;
+            leader->m_reply->setProperty("bsJob", QVariant::fromValue(leader));
+            leader->m_latencyTimer = j->m_latencyTimer;
+            leader->m_throttle_retries = j->m_throttle_retries;
+            leader->m_has_data = j->m_has_data; // no more coalescing into a partial payload
+            leader->setStatus(TransferJob::Active);
+            m_currentJobs.replace(m_currentJobs.indexOf(j), leader);
+            j->m_reply = nullptr;
+            watchTarget(leader);
+        } else {
+            host(j)->jobs[j->priority()].removeOne(j);
+            if (j->priority() > leader->priority())
+                leader->setPriority(j->priority());
+            queueJob(leader);
+        }
+        j->setStatus(TransferJob::Aborted);
+        finishJob(j);
+        schedule();
+        return;
+    }
+
+    // new requests for the same URL must not be coalesced into an aborted one
+    if (m_jobsByUrl.value(j->url()) == j)
+        m_jobsByUrl.remove(j->url());
+
     j->abortInternal();
 
-    if (m_jobs.removeOne(j)) {
-        emit finished(j);
+    if (host(j)->jobs[j->priority()].removeOne(j))
+        finishJob(j);
+}
+
+void TransferRetriever::raisePriority(TransferJob *j, TransferJob::Priority priority)
+{
+    // The job might have finished (and might even have been deleted) in the meantime, so it is
+    // only dereferenced if it is still waiting in one of the queues.
+    for (auto it = m_coalescedJobs.cbegin(); it != m_coalescedJobs.cend(); ++it) {
+        if (it->contains(j)) {
+            if (priority > j->priority())
+                j->setPriority(priority);
+            j = it.key(); // the job that is actually doing the request for both
+            break;
+        }
+    }
 
-        m_progressDone++;
-        emit overallProgress(m_progressDone, m_progressTotal);
-        if (m_progressDone == m_progressTotal)
-            m_progressDone = m_progressTotal = 0;
+    for (Host *h : qAsConst(m_hostOrder)) {
+        for (auto &queue : h->jobs) {
+            if (queue.contains(j)) {
+                if (priority > j->priority()) {
+                    queue.removeOne(j);
+                    j->setPriority(priority);
+                    queueJob(j);
+                    schedule();
+                }
+                return;
+            }
+        }
     }
 }
 
 void TransferRetriever::abortAllJobs()
 {
-    for (auto &j : qAsConst(m_jobs)) {
-        j->abortInternal();
-        emit finished(j);
+    int abortCount = 0;
+
+    for (const auto &coalesced : qAsConst(m_coalescedJobs)) {
+        for (auto &j : coalesced) {
+            j->abortInternal();
+            emit finished(j);
+        }
+        abortCount += coalesced.size();
+    }
+    m_coalescedJobs.clear();
+
+    for (Host *h : qAsConst(m_hostOrder)) {
+        for (auto &queue : h->jobs) {
+            for (auto &j : qAsConst(queue)) {
+                if (m_jobsByUrl.value(j->url()) == j)
+                    m_jobsByUrl.remove(j->url());
+                j->abortInternal();
+                emit finished(j);
+            }
+            abortCount += queue.size();
+            queue.clear();
+        }
     }
 
-    m_progressDone += m_jobs.size();
+    m_progressDone += abortCount;
     emit overallProgress(m_progressDone, m_progressTotal);
     if (m_progressDone == m_progressTotal)
         m_progressDone = m_progressTotal = 0;
 
-    m_jobs.clear();
-
     for (auto &j : qAsConst(m_currentJobs))
         j->abortInternal();
 }
@@ -264,69 +472,212 @@ void TransferRetriever::schedule()
                 this, &TransferRetriever::downloadFinished);
     }
 
-    while ((m_currentJobs.size() <= m_maxConnections) && !m_jobs.isEmpty()) {
-        auto j = m_jobs.takeFirst();
+    // Strictly by priority, but round-robin over all the hosts within a priority: a long queue
+    // for one host can't block the jobs for all the others.
+    for (int p = TransferJob::HighPriority; p >= TransferJob::LowPriority; --p) {
+        const auto priority = static_cast<TransferJob::Priority>(p);
+        bool started;
+        do {
+            started = false;
+            for (Host *h : qAsConst(m_hostOrder)) {
+                auto &queue = h->jobs[priority];
+                if (!queue.isEmpty() && h->canStart(priority)) {
+                    startJob(h, queue.takeFirst());
+                    started = true;
+                }
+            }
+        } while (started);
+    }
 
-        bool isget = (j->m_http_method == TransferJob::HttpGet);
-        QUrl url = j->url();
-        j->m_effective_url = url;
+    // hosts that asked us to back off need a wake-up call
+    qint64 wakeUp = -1;
+    for (const Host *h : qAsConst(m_hostOrder)) {
+        if (!h->pausedUntil.hasExpired() && h->hasJobs()) {
+            qint64 remaining = h->pausedUntil.remainingTime();
+            wakeUp = (wakeUp < 0) ? remaining : qMin(wakeUp, remaining);
+        }
+    }
+    if (wakeUp >= 0) {
+        if (!m_wakeUpTimer) {
+            m_wakeUpTimer = new QTimer(this);
+            m_wakeUpTimer->setSingleShot(true);
+            connect(m_wakeUpTimer, &QTimer::timeout, this, &TransferRetriever::schedule);
+        }
+        m_wakeUpTimer->start(int(wakeUp));
+    }
+}
+
+void TransferRetriever::startJob(Host *h, TransferJob *j)
+{
+    bool isget = (j->m_http_method == TransferJob::HttpGet);
+    QUrl url = j->url();
+    j->m_effective_url = url;
 
-        QNetworkRequest req(url);
+    QNetworkRequest req(url);
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
-        req.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+    req.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
 #endif
-        req.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
-        req.setHeader(QNetworkRequest::UserAgentHeader, m_transfer->userAgent());
-        if (j->m_no_redirects) {
-            req.setAttribute(QNetworkRequest::RedirectPolicyAttribute,
-                             QNetworkRequest::ManualRedirectPolicy);
-        }
+    req.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
+    req.setHeader(QNetworkRequest::UserAgentHeader, m_transfer->userAgent());
+    if (j->m_no_redirects) {
+        req.setAttribute(QNetworkRequest::RedirectPolicyAttribute,
+                         QNetworkRequest::ManualRedirectPolicy);
+    }
 
-        auto ssl = req.sslConfiguration();
-        ssl.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
-        if (!m_sslSession.isEmpty())
-            ssl.setSessionTicket(m_sslSession);
-        req.setSslConfiguration(ssl);
-
-        j->setStatus(TransferJob::Active);
-        if (isget) {
-            if (j->m_only_if_newer.isValid())
-                req.setHeader(QNetworkRequest::IfModifiedSinceHeader, j->m_only_if_newer);
-            j->m_reply = m_nam->get(req);
-        }
-        else {
-            req.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded"_l1);
-            QByteArray postdata = url.query(QUrl::FullyEncoded).toLatin1();
-            url.setQuery(QUrlQuery());
-            req.setUrl(url);
-            j->m_reply = m_nam->post(req, postdata);
-        }
+    auto ssl = req.sslConfiguration();
+    ssl.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    if (!m_sslSession.isEmpty())
+        ssl.setSessionTicket(m_sslSession);
+    req.setSslConfiguration(ssl);
+
+    j->setStatus(TransferJob::Active);
+    if (isget) {
+        if (j->m_only_if_newer.isValid())
+            req.setHeader(QNetworkRequest::IfModifiedSinceHeader, j->m_only_if_newer);
+        if (!j->m_only_if_none_match.isEmpty())
+            req.setRawHeader("If-None-Match", j->m_only_if_none_match);
+        j->m_reply = m_nam->get(req);
+    }
+    else {
+        req.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded"_l1);
+        QByteArray postdata = url.query(QUrl::FullyEncoded).toLatin1();
+        url.setQuery(QUrlQuery());
+        req.setUrl(url);
+        j->m_reply = m_nam->post(req, postdata);
+    }
 
-        qCInfo(LogTransfer) << (isget ? ">> GET" : ">> POST") << req.url();
-        if (LogTransfer().isDebugEnabled()) {
-            const auto headers = j->m_reply->request().rawHeaderList();
-            for (const auto &header : headers)
-                qCDebug(LogTransfer()) << header << ":" << j->m_reply->request().rawHeader(header);
-        }
+    qCInfo(LogTransfer) << (isget ? ">> GET" : ">> POST") << req.url();
+    if (LogTransfer().isDebugEnabled()) {
+        const auto headers = j->m_reply->request().rawHeaderList();
+        for (const auto &header : headers)
+            qCDebug(LogTransfer()) << header << ":" << j->m_reply->request().rawHeader(header);
+    }
+
+    setupReply(h, j);
+    j->m_latencyTimer.start();
 
-        j->m_reply->setProperty("bsJob", QVariant::fromValue(j));
+    ++h->activeJobs;
+    m_currentJobs.append(j);
+    emit started(j);
+}
+
+void TransferRetriever::setupReply(Host *h, TransferJob *j)
+{
+    auto *reply = j->m_reply;
+    reply->setProperty("bsJob", QVariant::fromValue(j));
 
-        connect(j->m_reply, &QNetworkReply::downloadProgress, this, [this, j](qint64 recv, qint64 total) {
-            emit progress(j, int(recv), int(total));
-        });
+    // we are reading the payload as it arrives, so QNAM doesn't need to buffer much on its own
+    reply->setReadBufferSize(StreamBufferSize);
 
-        m_currentJobs.append(j);
-        emit started(j);
+    // the job for a reply can change, if it was coalesced with other jobs and then aborted
+    connect(reply, &QNetworkReply::metaDataChanged, this, [this, h, reply]() {
+        updateLatency(h, reply->property("bsJob").value<TransferJob *>());
+    });
+    connect(reply, &QNetworkReply::downloadProgress, this, [this, reply](qint64 recv, qint64 total) {
+        emit progress(reply->property("bsJob").value<TransferJob *>(), int(recv), int(total));
+    });
+    connect(reply, &QNetworkReply::readyRead, this, [this, reply]() {
+        readFromReply(reply->property("bsJob").value<TransferJob *>());
+    });
+    watchTarget(j);
+}
+
+void TransferRetriever::watchTarget(TransferJob *j)
+{
+    // resume reading, once a target that couldn't keep up has consumed some of its data
+    if (j->m_file) {
+        auto *reply = j->m_reply;
+        connect(j->m_file, &QIODevice::bytesWritten, reply, [this, reply]() {
+            auto *j = reply->property("bsJob").value<TransferJob *>();
+            if (j && m_currentJobs.contains(j) && (j->m_reply == reply))
+                readFromReply(j);
+        }, Qt::QueuedConnection);
     }
 }
 
+void TransferRetriever::readFromReply(TransferJob *j, bool all)
+{
+    auto *reply = j->m_reply;
+
+    // Only the payload of a successful request is of any interest, but the bodies of error
+    // replies still need to be drained: QNAM stops reading, once its read buffer is full.
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200) {
+        reply->skip(reply->bytesAvailable());
+        return;
+    }
+
+    const auto coalesced = m_coalescedJobs.value(j);
+
+    // coalescing stops with the first chunk, even across a hand-over in abortJob(): every
+    // coalesced job needs to have seen exactly the same chunks as the one doing the transfer
+    for (TransferJob *cj : coalesced)
+        Q_ASSERT(cj->m_has_data == j->m_has_data);
+
+    while (reply->bytesAvailable() > 0) {
+        if (!all && j->m_file && (j->m_file->bytesToWrite() >= StreamBufferSize))
+            break;
+
+        const QByteArray chunk = reply->read(StreamChunkSize);
+        j->m_has_data = true;
+        writeToTarget(j, chunk);
+        for (TransferJob *cj : coalesced) {
+            cj->m_has_data = true;
+            writeToTarget(cj, chunk);
+        }
+    }
+}
+
+void TransferRetriever::writeToTarget(TransferJob *j, const QByteArray &chunk)
+{
+    if (j->m_data)
+        j->m_data->append(chunk);
+    else if (j->m_file)
+        j->m_file->write(chunk);
+}
+
+void TransferRetriever::updateLatency(Host *h, TransferJob *j)
+{
+    // only the first response headers count, not the ones after a redirect
+    if (!j->m_latencyTimer.isValid())
+        return;
+    double ms = qMax(qint64(1), j->m_latencyTimer.elapsed());
+    j->m_latencyTimer.invalidate();
+
+    // the best case latency slowly creeps up, so that we adapt to permanently slower networks
+    h->minLatency = (h->minLatency > 0) ? qMin(ms, h->minLatency * 1.01) : ms;
+    h->latency = (h->latency > 0) ? ((7 * h->latency + ms) / 8) : ms;
+}
+
+void TransferRetriever::backOff(Host *h, TransferJob *j)
+{
+    // multiplicative decrease, plus a pause for as long as the server wants us to
+    h->maxConnections = qMax(MinConnectionsPerHost, h->maxConnections / 2);
+    h->goodReplies = 0;
+
+    bool ok = false;
+    int seconds = j->m_reply->rawHeader("Retry-After").toInt(&ok);
+    if (!ok)
+        seconds = 2;
+    h->pausedUntil.setRemainingTime(qBound(1, seconds, 60) * 1000);
+
+    qCInfo(LogTransfer) << "Backing off from" << j->url().host() << "for" << seconds
+                        << "sec, max. connections are now" << h->maxConnections;
+}
+
 void TransferRetriever::downloadFinished(QNetworkReply *reply)
 {
     auto *j = reply->property("bsJob").value<TransferJob *>();
     auto error = j->m_reply->error();
+    Host *h = host(j);
+
+    // This reply is done in any case (even when retrying, there will be a new one), but queued
+    // bytesWritten() notifications from the target might still be pending: they must not
+    // find a job that is finished and maybe even deleted by then.
+    reply->setProperty("bsJob", QVariant());
 
     j->m_respcode = j->m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toUInt();
     j->m_effective_url = j->m_reply->url();
+    updateLatency(h, j);
 
     qCInfo(LogTransfer) << "<< REPLY" << j->m_respcode << j->m_effective_url;
     if (LogTransfer().isDebugEnabled()) {
@@ -338,11 +689,28 @@ void TransferRetriever::downloadFinished(QNetworkReply *reply)
     if (error != QNetworkReply::NoError) {
         m_sslSession.clear();
 
-        if ((j->m_respcode == 404) && j->m_retries_left) {
+        bool throttled = (j->m_respcode == 429) || (j->m_respcode == 503);
+
+        if (throttled || ((j->m_respcode >= 500) && (j->m_respcode <= 599)))
+            backOff(h, j);
+
+        if (throttled && (j->m_throttle_retries < 3)) {
+            // re-queue the job: it will be started again after the pause
+            ++j->m_throttle_retries;
+            j->m_reply->deleteLater();
+            j->m_reply = nullptr;
+            j->m_respcode = 0;
+            j->setStatus(TransferJob::Inactive);
+            m_currentJobs.removeAll(j);
+            --h->activeJobs;
+            h->jobs[j->priority()].prepend(j);
+            QMetaObject::invokeMethod(this, &TransferRetriever::schedule, Qt::QueuedConnection);
+            return;
+        } else if ((j->m_respcode == 404) && j->m_retries_left) {
             --j->m_retries_left;
             j->m_reply->deleteLater();
             j->m_reply = m_nam->get(j->m_reply->request());
-            j->m_reply->setProperty("bsJob", QVariant::fromValue(j));
+            setupReply(h, j);
             qWarning() << "Got a 404 on" << j->m_url << " ... retrying (still" << j->m_retries_left << "retries left)";
             return;
         } else if ((j->m_respcode == 302) && (error == QNetworkReply::HostNotFoundError)) {
@@ -354,7 +722,7 @@ void TransferRetriever::downloadFinished(QNetworkReply *reply)
                 url.setHost(j->m_url.host());
                 url.setScheme(j->m_url.scheme());
                 j->m_reply = m_nam->get(QNetworkRequest(url));
-                j->m_reply->setProperty("bsJob", QVariant::fromValue(j));
+                setupReply(h, j);
                 return;
             }
         }
@@ -363,9 +731,23 @@ void TransferRetriever::downloadFinished(QNetworkReply *reply)
     } else {
         m_sslSession = reply->sslConfiguration().sessionTicket();
 
+        // additive increase: the server answers quickly, even though all our connections are
+        // busy, so it can probably handle more
+        if (h->latency < (2 * h->minLatency)) {
+            if ((h->activeJobs >= h->maxConnections) && (++h->goodReplies >= h->maxConnections)) {
+                h->maxConnections = qMin(h->maxConnections + 1, MaxConnectionsPerHost);
+                h->goodReplies = 0;
+            }
+        } else if (h->latency > (4 * h->minLatency)) {
+            // the requests are queuing up on the server side
+            if (h->maxConnections > (MinConnectionsPerHost + 1))
+                --h->maxConnections;
+            h->goodReplies = 0;
+        }
+
         switch (j->m_respcode) {
         case 304:
-            if (j->m_only_if_newer.isValid()) {
+            if (j->m_only_if_newer.isValid() || !j->m_only_if_none_match.isEmpty()) {
                 j->m_was_not_modified = true;
                 j->setStatus(TransferJob::Completed);
             }
@@ -378,10 +760,8 @@ void TransferRetriever::downloadFinished(QNetworkReply *reply)
             auto lastmod = j->m_reply->header(QNetworkRequest::LastModifiedHeader);
             if (lastmod.isValid())
                 j->m_last_modified = lastmod.toDateTime();
-            if (j->m_data)
-                *j->m_data = j->m_reply->readAll();
-            else if (j->m_file)
-                j->m_file->write(j->m_reply->readAll());
+            j->m_etag = j->m_reply->rawHeader("ETag");
+            readFromReply(j, true /* all the rest */);
             j->setStatus(TransferJob::Completed);
             break;
         }
@@ -393,13 +773,45 @@ void TransferRetriever::downloadFinished(QNetworkReply *reply)
     j->m_reply->deleteLater();
     j->m_reply = nullptr;
 
-    emit overallProgress(++m_progressDone, m_progressTotal);
-    if (m_progressDone == m_progressTotal)
-        m_progressDone = m_progressTotal = 0;
+    // the download might have failed after parts of the payload were streamed already
+    if (!j->isCompleted() && j->m_data)
+        j->m_data->clear();
+
+    if (canBeCoalesced(j)) {
+        if (m_jobsByUrl.value(j->url()) == j)
+            m_jobsByUrl.remove(j->url());
+
+        if (j->isFailed() && (j->m_respcode == 404)) {
+            if (m_notFound.size() > 1000) {
+                for (auto it = m_notFound.begin(); it != m_notFound.end(); ) {
+                    if (it->expires.hasExpired())
+                        it = m_notFound.erase(it);
+                    else
+                        ++it;
+                }
+            }
+            m_notFound.insert(j->url(), { QDeadlineTimer(NotFoundCacheTime), j->m_error_string });
+        }
+    }
+
+    // all the coalesced jobs got a copy of the payload already, now they get the result
+    const auto coalesced = m_coalescedJobs.take(j);
+    for (TransferJob *cj : coalesced) {
+        cj->m_respcode = j->m_respcode;
+        cj->m_effective_url = j->m_effective_url;
+        cj->m_last_modified = j->m_last_modified;
+        cj->m_etag = j->m_etag;
+        cj->m_error_string = j->m_error_string;
+        if (!j->isCompleted() && cj->m_data)
+            cj->m_data->clear();
+        cj->setStatus(static_cast<TransferJob::Status>(j->m_status));
+        finishJob(cj);
+    }
 
-    emit finished(j); // the thread adapter lambda in Transfer will delete the job
+    finishJob(j);
 
     m_currentJobs.removeAll(j);
+    --h->activeJobs;
 
     QMetaObject::invokeMethod(this, &TransferRetriever::schedule, Qt::QueuedConnection);
 
@@ -13,7 +13,12 @@
 */
 #pragma once
 
+#include <array>
+
 #include <QDateTime>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QUrl>
 #include <QThread>
 #include <QNetworkAccessManager>
@@ -22,16 +27,28 @@
 Q_DECLARE_LOGGING_CATEGORY(LogTransfer)
 
 QT_FORWARD_DECLARE_CLASS(QIODevice)
+QT_FORWARD_DECLARE_CLASS(QTimer)
 class Transfer;
 class TransferRetriever;
 
 class TransferJob
 {
 public:
+    enum Priority : uint {
+        LowPriority = 0,    // bulk downloads, e.g. prefetching
+        NormalPriority,
+        HighPriority,       // the user is waiting for this one
+
+        PriorityCount
+    };
+
     ~TransferJob();
 
     static TransferJob *get(const QUrl &url, QIODevice *file = nullptr, uint retries = 0);
     static TransferJob *getIfNewer(const QUrl &url, const QDateTime &dt, QIODevice *file = nullptr);
+    static TransferJob *getIfChanged(const QUrl &url, const QByteArray &etag,
+                                     const QDateTime &lastModified, QIODevice *file = nullptr,
+                                     uint retries = 0);
     static TransferJob *post(const QUrl &url, QIODevice *file = nullptr, bool noRedirects = false);
 
     QUrl url() const                 { return m_url; }
@@ -41,10 +58,14 @@ public:
     QIODevice *file() const          { return m_file; }
     QByteArray *data() const         { return m_data; }
     QDateTime lastModified() const   { return m_last_modified; }
+    QByteArray etag() const          { return m_etag; }
     bool wasNotModifiedSince() const { return m_was_not_modified; }
 
     bool isActive() const            { return m_status == Active; }
 
+    Priority priority() const        { return static_cast<Priority>(m_priority); }
+    void setPriority(Priority p)     { m_priority = p; }
+
     bool isCompleted() const         { return m_status == Completed; }
     bool isFailed() const            { return m_status == Failed; }
     bool isAborted() const           { return m_status == Aborted; }
@@ -86,8 +107,11 @@ private:
     QIODevice *  m_file = nullptr;
     QString      m_error_string;
     QDateTime    m_only_if_newer;
+    QByteArray   m_only_if_none_match;
     QDateTime    m_last_modified;
+    QByteArray   m_etag;
     QNetworkReply *m_reply = nullptr;
+    QElapsedTimer m_latencyTimer;
 
     QByteArray   m_userTag;
     QVariant     m_userData;
@@ -100,6 +124,9 @@ private:
     uint         m_retries_left     : 5;
     int          m_was_not_modified : 1 = false;
     int          m_no_redirects     : 1;
+    uint         m_priority         : 2 = NormalPriority;
+    uint         m_throttle_retries : 2 = 0;
+    uint         m_has_data         : 1 = false; // received (parts of) the payload already
 
     friend class Transfer;
     friend class TransferRetriever;
@@ -115,8 +142,9 @@ public:
     TransferRetriever(Transfer *transfer);
     ~TransferRetriever() override;
 
-    void addJob(TransferJob *job, bool highPriority);
+    void addJob(TransferJob *job);
     void abortJob(TransferJob *job);
+    void raisePriority(TransferJob *job, TransferJob::Priority priority);
     void abortAllJobs();
     void schedule();
 
@@ -127,13 +155,52 @@ signals:
     void finished(TransferJob *job);
 
 private:
+    // Every host has its own job queues (one per priority) and its own concurrency limit,
+    // which adapts to the measured latency and to the server asking us to back off.
+    struct Host
+    {
+        std::array<QVector<TransferJob *>, TransferJob::PriorityCount> jobs;
+        int activeJobs = 0;
+        int maxConnections = 4;
+        double latency = 0;      // moving average of the time to the response headers in ms
+        double minLatency = 0;   // the best case, i.e. without any queuing on the server side
+        int goodReplies = 0;     // fast replies while all connections were busy
+        QDeadlineTimer pausedUntil { 0 };
+
+        bool hasJobs() const;
+        bool canStart(TransferJob::Priority priority) const;
+    };
+
+    Host *host(const TransferJob *job);
+    void queueJob(TransferJob *job);
+    static bool canBeCoalesced(const TransferJob *job);
+    void finishJob(TransferJob *job);
+    void startJob(Host *host, TransferJob *job);
+    void setupReply(Host *host, TransferJob *job);
+    void watchTarget(TransferJob *job);
+    void readFromReply(TransferJob *job, bool all = false);
+    static void writeToTarget(TransferJob *job, const QByteArray &chunk);
+    void updateLatency(Host *host, TransferJob *job);
+    void backOff(Host *host, TransferJob *job);
     void downloadFinished(QNetworkReply *reply);
 
     Transfer *m_transfer;
     QNetworkAccessManager *m_nam = nullptr;
-    QVector<TransferJob *> m_jobs;
+    QHash<QString, Host *> m_hosts;
+    QVector<Host *>        m_hostOrder; // round-robin
+    QTimer *               m_wakeUpTimer = nullptr; // for paused hosts
+
+    // concurrent GET requests for the same URL share one queued or running job
+    QHash<QUrl, TransferJob *> m_jobsByUrl;
+    QHash<TransferJob *, QVector<TransferJob *>> m_coalescedJobs;
+
+    struct NotFound
+    {
+        QDeadlineTimer expires;
+        QString errorString;
+    };
+    QHash<QUrl, NotFound>  m_notFound; // a short-lived negative cache for 404s
     QVector<TransferJob *> m_currentJobs;
-    int                    m_maxConnections;
     int                    m_progressDone = 0;
     int                    m_progressTotal = 0;
     QByteArray             m_sslSession;
@@ -148,6 +215,7 @@ public:
     ~Transfer() override;
 
     void retrieve(TransferJob *job, bool highPriority = false);
+    void raisePriority(TransferJob *job, TransferJob::Priority priority);
 
     void abortJob(TransferJob *job);
     void abortAllJobs();
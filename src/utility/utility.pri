@@ -9,9 +9,12 @@ HEADERS += \
     $$PWD/chunkreader.h \
     $$PWD/chunkwriter.h \
     $$PWD/exception.h \
+    $$PWD/pooledarray.h \
     $$PWD/q3cache.h \
+    $$PWD/recordfile.h \
     $$PWD/ref.h \
     $$PWD/stopwatch.h \
+    $$PWD/streampipe.h \
     $$PWD/systeminfo.h \
     $$PWD/transfer.h \
     $$PWD/utility.h \
@@ -21,6 +24,7 @@ SOURCES += \
     $$PWD/chunkreader.cpp \
     $$PWD/exception.cpp \
     $$PWD/ref.cpp \
+    $$PWD/streampipe.cpp \
     $$PWD/systeminfo.cpp \
     $$PWD/transfer.cpp \
     $$PWD/utility.cpp \
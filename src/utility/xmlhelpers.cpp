@@ -15,6 +15,7 @@
 #include <QFile>
 #include <QDomDocument>
 #include <QDomElement>
+#include <QXmlStreamReader>
 #include <QDebug>
 
 #include "utility.h"
@@ -135,6 +136,70 @@ QString XmlHelpers::ParseXML::elementText(QDomElement parent, const char *tagNam
     }
 }
 
+void XmlHelpers::ParseXML::parseStream(std::function<void (const Fields &)> callback)
+{
+    QXmlStreamReader xml(m_file);
+
+    if (xml.readNextStartElement() && (xml.name() != m_rootNodeName)) {
+        throw ParseException(m_file, "expected root node %1, but got %2")
+                .arg(m_rootNodeName).arg(xml.name().toString());
+    }
+
+    Fields fields;
+    fields.reserve(16);
+
+    try {
+        while (xml.readNextStartElement()) {
+            if (xml.name() != m_elementNodeName) {
+                xml.skipCurrentElement();
+                continue;
+            }
+            fields.clear();
+            while (xml.readNextStartElement()) {
+                QString name = xml.name().toString();
+                fields.append(qMakePair(name, xml.readElementText(QXmlStreamReader::IncludeChildElements)));
+            }
+            if (!xml.hasError())
+                callback(fields);
+        }
+    } catch (const Exception &e) {
+        throw ParseException(m_file, e.what());
+    }
+
+    if (xml.hasError()) {
+        throw ParseException(m_file, "%1 at line %2, column %3")
+                .arg(xml.errorString()).arg(xml.lineNumber()).arg(xml.columnNumber());
+    }
+}
+
+QString XmlHelpers::ParseXML::elementText(const Fields &fields, const char *tagName)
+{
+    const QLatin1String tag(tagName);
+    const QString *text = nullptr;
+    for (const auto &field : fields) {
+        if (field.first == tag) {
+            if (text)
+                throw ParseException("Expected a single %1 tag, but found more").arg(tag);
+            text = &field.second;
+        }
+    }
+    if (!text)
+        throw ParseException("Expected a single %1 tag, but found none").arg(tag);
+
+    // the contents are double XML escaped. QXmlStreamReader unescaped once already
+    return decodeEntities(text->simplified());
+}
+
+QString XmlHelpers::ParseXML::elementText(const Fields &fields, const char *tagName,
+                                          const char *defaultText)
+{
+    try {
+        return elementText(fields, tagName);
+    } catch (...) {
+        return QLatin1String(defaultText);
+    }
+}
+
 
 
 XmlHelpers::CreateXML::CreateXML(const char *rootNodeName, const char *elementNodeName)